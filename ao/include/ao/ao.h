@@ -161,6 +161,11 @@ ao_mesh* ao_tree_render_mesh(ao_tree tree, ao_region3 R, float res);
 /*
  *  Renders and saves a mesh to a file
  *
+ *  The format is picked from the filename's extension:
+ *      .ply    binary PLY (indexed)
+ *      .obj    OBJ (indexed)
+ *      other   binary STL
+ *
  *  Returns true on success, false otherwise
  *  See argument details in ao_tree_render_mesh
  */
@@ -0,0 +1,161 @@
+#pragma once
+
+#include <cmath>
+#include <limits>
+
+#include "ao/eval/interval.hpp"
+
+namespace Kernel {
+namespace Affine {
+
+/*
+ *  A reduced affine form over the three input coordinates:
+ *      c + dx*ex + dy*ey + dz*ez +/- e
+ *
+ *  Each noise symbol ex, ey, ez ranges over [-1, 1] and is shared by every
+ *  form derived from the same box, so correlated terms cancel:  x*x - 2*x*y
+ *  + y*y is bounded far more tightly than with plain intervals.  Nonlinear
+ *  operations fold their approximation error into e, which isn't shared.
+ *
+ *  Terms are kept in double precision, and each operation widens e to cover
+ *  its own rounding error, so the range stays conservative once it has been
+ *  rounded outwards to floats.  A form with a non-finite term has an
+ *  unbounded range.
+ */
+class A
+{
+public:
+    A() : c(0), d{0, 0, 0}, e(0) {}
+    A(double v) : c(v), d{0, 0, 0}, e(0) {}
+
+    /*  Returns the form for an input coordinate, given its interval and
+     *  axis (0, 1, 2 for X, Y, Z); this is exact  */
+    static A input(const Interval::I& i, unsigned axis)
+    {
+        A out((double(i.lower()) + i.upper()) / 2);
+        out.d[axis] = (double(i.upper()) - i.lower()) / 2;
+        return out;
+    }
+
+    /*  Returns a form with no correlation to the inputs  */
+    static A fromInterval(const Interval::I& i)
+    {
+        A out((double(i.lower()) + i.upper()) / 2);
+        out.e = (double(i.upper()) - i.lower()) / 2;
+        return out.rounded();
+    }
+
+    /*  Sum of the magnitudes of every term other than the center  */
+    double radius() const
+    {
+        return std::abs(d[0]) + std::abs(d[1]) + std::abs(d[2]) + e;
+    }
+
+    /*  Returns the range of the form, rounded outwards to floats  */
+    Interval::I range() const
+    {
+        const double r = radius();
+        if (!std::isfinite(c) || !std::isfinite(r))
+        {
+            return Interval::I::whole();
+        }
+        const double slack = (std::abs(c) + r) * EPSILON;
+        return Interval::I::bounds(Interval::down(c - r - slack),
+                                   Interval::up(c + r + slack));
+    }
+
+    /*  Widens e to cover the rounding error of the operation that built
+     *  this form (a few double-precision roundings per term)  */
+    A rounded() const
+    {
+        A out = *this;
+        out.e += (std::abs(c) + radius()) * EPSILON +
+                 std::numeric_limits<double>::denorm_min();
+        return out;
+    }
+
+    double c;
+    double d[3];
+    double e;
+
+protected:
+    static constexpr double EPSILON = 1.0 / (1ULL << 48);
+};
+
+////////////////////////////////////////////////////////////////////////////////
+
+inline A operator-(const A& x)
+{
+    A out(-x.c);
+    for (unsigned i=0; i < 3; ++i)
+    {
+        out.d[i] = -x.d[i];
+    }
+    out.e = x.e;
+    return out;
+}
+
+inline A operator+(const A& x, const A& y)
+{
+    A out(x.c + y.c);
+    for (unsigned i=0; i < 3; ++i)
+    {
+        out.d[i] = x.d[i] + y.d[i];
+    }
+    out.e = x.e + y.e;
+    return out.rounded();
+}
+
+inline A operator-(const A& x, const A& y)
+{
+    return x + -y;
+}
+
+/*
+ *  The product of the linear parts is bounded by the product of the
+ *  radii and moved into the error term
+ */
+inline A operator*(const A& x, const A& y)
+{
+    A out(x.c * y.c);
+    for (unsigned i=0; i < 3; ++i)
+    {
+        out.d[i] = x.c * y.d[i] + y.c * x.d[i];
+    }
+    out.e = std::abs(x.c) * y.e + std::abs(y.c) * x.e +
+            x.radius() * y.radius();
+    return out.rounded();
+}
+
+/*
+ *  Squaring knows that the quadratic term is non-negative, so half of it
+ *  moves into the center
+ */
+inline A square(const A& x)
+{
+    const double r = x.radius();
+    A out(x.c * x.c + r * r / 2);
+    for (unsigned i=0; i < 3; ++i)
+    {
+        out.d[i] = 2 * x.c * x.d[i];
+    }
+    out.e = 2 * std::abs(x.c) * x.e + r * r / 2;
+    return out.rounded();
+}
+
+/*
+ *  Scales the form by a constant
+ */
+inline A scale(const A& x, double s)
+{
+    A out(x.c * s);
+    for (unsigned i=0; i < 3; ++i)
+    {
+        out.d[i] = x.d[i] * s;
+    }
+    out.e = x.e * std::abs(s);
+    return out.rounded();
+}
+
+}   // namespace Affine
+}   // namespace Kernel
@@ -14,8 +14,10 @@ struct Clause
     /*
      *  Clause constructor
      */
-    Clause(Opcode::Opcode op, uint32_t id, uint32_t a, uint32_t b)
-        : op(op), id(id), a(a), b(b) {}
+    Clause(Opcode::Opcode op, uint32_t id, uint32_t a, uint32_t b,
+           uint32_t slot, uint32_t slot_a, uint32_t slot_b)
+        : op(op), id(id), a(a), b(b),
+          slot(slot), slot_a(slot_a), slot_b(slot_b) {}
 
     /*  Opcode for this clause  */
     const Opcode::Opcode op;
@@ -24,6 +26,13 @@ struct Clause
     Id const id;
     Id const a;
     Id const b;
+
+    /*  Rows in the Result arrays where this clause and its arguments
+     *  store their values.  Clauses with non-overlapping lifetimes may
+     *  share a slot, so these aren't unique (unlike id, a, and b). */
+    Id const slot;
+    Id const slot_a;
+    Id const slot_b;
 };
 
 }   // namespace Kernel
@@ -1,9 +1,11 @@
 #pragma once
 
 #include <array>
+#include <memory>
 #include <unordered_map>
 #include <vector>
 #include <map>
+#include <set>
 
 #include <Eigen/Eigen>
 #include <boost/bimap.hpp>
@@ -28,6 +30,17 @@ public:
         { /* Nothing to do here */ }
     Evaluator(const Tree root, const std::map<Tree::Id, float>& vars);
 
+    /*
+     *  Makes a new evaluator that shares this one's compiled program, with
+     *  its own tape stack and result arrays.  Variables start out with
+     *  their current values in other.
+     *
+     *  This doesn't revisit the Tree, so it's much cheaper than building
+     *  a new evaluator and is the preferred way to make per-thread copies.
+     */
+    Evaluator(const Evaluator& other);
+    Evaluator(Evaluator&& other) = default;
+
     /*  Make an aligned new operator, as this class has Eigen structs
      *  inside of it (which are aligned for SSE) */
     EIGEN_MAKE_ALIGNED_OPERATOR_NEW
@@ -77,6 +90,36 @@ public:
      */
     Interval::I interval();
 
+    /*
+     *  Arithmetic used to bound the tape over a box, in interval()
+     *  and intervals() (and so in the push calls that follow them)
+     *
+     *  AFFINE tracks how each clause depends on X, Y, and Z, so that
+     *  correlated terms cancel (see Affine::A).
+     *
+     *  MEAN_VALUE also finds each clause's value at the center of the box
+     *  and its gradient over the box, which bound the clause by the mean
+     *  value theorem; this is tight for smooth functions on small boxes.
+     *
+     *  In either case, each clause's range is intersected with its plain
+     *  interval, so it's never looser, but evaluation is several times
+     *  slower.
+     */
+    enum RangeMode { INTERVAL, AFFINE, MEAN_VALUE };
+    void setRangeMode(RangeMode m) { range_mode = m; }
+    RangeMode rangeMode() const { return range_mode; }
+
+    /*
+     *  Evaluates a batch of intervals (stored with set) in a single pass
+     *  over the tape, returning a pointer to count results.
+     *
+     *  The results (and the branch choices that push(index) needs) are
+     *  stored with the current tape, so they stay valid while deeper
+     *  tapes are pushed and popped, until intervals is called again with
+     *  this tape.
+     */
+    const Interval::I* intervals(Result::Index count);
+
     /*
      *  Stores the given value in the result arrays
      *  (inlined for efficiency)
@@ -93,11 +136,43 @@ public:
      */
     void set(const Eigen::Vector3f& lower, const Eigen::Vector3f& upper);
 
+    /*
+     *  Stores the given interval in the batched result arrays
+     *  (for use with intervals)
+     */
+    void set(const Eigen::Vector3f& lower, const Eigen::Vector3f& upper,
+             Result::Index index)
+    {
+        result->lo(X, index) = lower.x();
+        result->lo(Y, index) = lower.y();
+        result->lo(Z, index) = lower.z();
+        result->hi(X, index) = upper.x();
+        result->hi(Y, index) = upper.y();
+        result->hi(Z, index) = upper.z();
+    }
+
     /*
      *  Pushes into a subinterval, disabling inactive nodes
      */
     void push();
 
+    /*
+     *  Pushes into the subinterval at the given index of the last batch
+     *  evaluated with the current tape (see intervals)
+     */
+    void push(Result::Index index);
+
+    /*
+     *  Evaluates the given region with the base (unpruned) tape, then
+     *  pushes the resulting pruned tape on top of the tape stack.
+     *
+     *  This lets a caller start work on a region that is unrelated to the
+     *  current tape without disturbing the tapes below it; pop() returns
+     *  to the previous tape as usual.
+     */
+    Interval::I pushBase(const Eigen::Vector3f& lower,
+                         const Eigen::Vector3f& upper);
+
     /*
      *  Pushes into a tree based on the given feature
      *
@@ -120,6 +195,26 @@ public:
      */
     double utilization() const;
 
+    /*
+     *  Pushes that prune the same tape with the same min / max choices
+     *  (e.g. in sibling cells, or neighboring tiles) build the same tape,
+     *  so pruned tapes are kept in a cache keyed by those choices.
+     *
+     *  tapeCacheStats counts pushes that found their tape in the cache
+     *  (hits) and pushes that had to build it (misses).
+     */
+    struct CacheStats {
+        uint64_t hits;
+        uint64_t misses;
+    };
+    const CacheStats& tapeCacheStats() const { return cache_stats; }
+
+    /*
+     *  Sets the number of tapes kept in the cache (0 disables it),
+     *  evicting the least recently used tapes as needed
+     */
+    void setTapeCacheSize(size_t size);
+
     /*
      *  Changes a variable's value
      *
@@ -137,6 +232,25 @@ public:
      */
     bool updateVars(const std::map<Kernel::Tree::Id, float>& vars);
 
+    /*
+     *  Returns a fingerprint of the current tape, which is the same for
+     *  any two tapes with the same clauses (and so the same results)
+     */
+    uint64_t tapeHash() const { return tape->hash; }
+
+    /*
+     *  Returns a mask of the variables read by the current tape.
+     *
+     *  The kth variable in the evaluator sets bit (k % 64), so with more
+     *  than 64 variables the mask may report variables that aren't read.
+     */
+    uint64_t varMask() const { return tape->vars; }
+
+    /*
+     *  Returns the mask bits (as above) for the given variables
+     */
+    uint64_t varMask(const std::set<Tree::Id>& vars) const;
+
     /*
      *  Pushes into a tree with min/max nodes specialized
      *  based on evaluation at the given point
@@ -173,12 +287,51 @@ public:
     bool isAmbiguous();
 
 protected:
+    /*
+     *  A single compiled step of a tape:  a per-opcode kernel, plus the
+     *  result rows that it reads and writes (looked up ahead of time),
+     *  and a kernel that evaluates the opcode over a batch of intervals
+     */
+    struct Step {
+        typedef void (*Fn)(float* out, const float* a, const float* b,
+                           Result::Index count);
+        typedef void (*IntervalFn)(float* lo, float* hi,
+                                   const float* a_lo, const float* a_hi,
+                                   const float* b_lo, const float* b_hi,
+                                   Result::Index count);
+        Fn fn;
+        float* out;
+        const float* a;
+        const float* b;
+        IntervalFn ifn;
+    };
+
     /*  This is our evaluation tape type */
     struct Tape {
         std::vector<Clause> t;
+
+        /*  Compiled version of t, stored in evaluation order  */
+        std::vector<Step> p;
+
         Clause::Id i;
         Interval::I X, Y, Z;
+
+        /*  Fingerprint of the clauses and root, and mask of the variables
+         *  that they read (both filled in by compile)  */
+        uint64_t hash;
+        uint64_t vars;
+
+        /*  Indices of the min and max clauses in t (filled in by compile)  */
+        std::vector<size_t> branches;
+
         enum Type { UNKNOWN, INTERVAL, SPECIALIZED, FEATURE } type;
+
+        /*  Results of the last call to intervals with this tape:  each
+         *  box's X, Y, Z region and output, and (for each clause in t,
+         *  then each box) which branches are kept when pushing  */
+        std::vector<std::array<Interval::I, 3>> regions;
+        std::vector<Interval::I> results;
+        std::vector<uint8_t> choices;
     };
 
     /*
@@ -186,17 +339,101 @@ protected:
      *
      *  Requires disabled and remap both to contain useful data; this is used
      *  when deciding which clauses to push into the new tape.
+     *
+     *  The new tape is built from the clauses in src (by default, the
+     *  current tape) and is placed above the current tape.
+     */
+    void pushTape(Tape::Type t) { pushTape(t, tape); }
+    void pushTape(Tape::Type t, std::list<Tape>::iterator src);
+
+    /*
+     *  Moves tape up the tape stack, adding a new (empty) tape if needed
      */
-    void pushTape(Tape::Type t);
+    void nextTape();
 
     /*
-     *  Evaluate the tree's values and Jacobian
-     *  with respect to all its variables
+     *  A pruned tape in the tape cache, along with its source tape's
+     *  fingerprint and the choices that built it (in decisions)
      */
-    static void eval_clause_jacobians(Opcode::Opcode op,
-        const float av,  std::vector<float>& aj,
-        const float bv,  std::vector<float>& bj,
-                         std::vector<float>& oj);
+    struct CachedTape {
+        uint64_t key;
+        uint64_t src;
+        std::vector<uint8_t> choices;
+        Tape tape;
+    };
+
+    /*
+     *  If the cache has the tape built from src by the choices in
+     *  decisions, copies it above the current tape and returns true
+     */
+    bool pushCached(std::list<Tape>::iterator src, uint64_t key);
+
+    /*
+     *  Stores the current tape (built from src by the choices in
+     *  decisions) in the cache, evicting the least recently used tape
+     *  if the cache is full
+     */
+    void storeCached(std::list<Tape>::iterator src, uint64_t key);
+
+    /*
+     *  Fills the tape's compiled steps from its clauses, along with its
+     *  fingerprint and variable mask
+     *
+     *  This is done once when the tape is built, so each evaluation of
+     *  the tape is a flat walk over kernels with no opcode dispatch.
+     */
+    void compile(Tape& t);
+
+    /*
+     *  Returns the float kernel for the given opcode
+     */
+    static Step::Fn valuesKernel(Opcode::Opcode op);
+
+    /*
+     *  Prepares disabled and remap for pushing a tape built from src,
+     *  marking every clause in src as disabled (except the root)
+     *
+     *  This only touches clauses in src, so it's cheap for pruned tapes.
+     */
+    void resetMarks(std::list<Tape>::iterator src);
+
+    /*
+     *  Marks disabled and remaps clauses in src based on the interval
+     *  results, then pushes the pruned tape above the current tape
+     */
+    void pushInterval(std::list<Tape>::iterator src);
+
+    /*
+     *  As above, but using the stored results for the given box of the
+     *  last batch evaluated with src (see intervals)
+     */
+    void pushInterval(std::list<Tape>::iterator src, Result::Index box);
+
+    /*
+     *  Branches of a min or max clause that are kept when pushing
+     *  (intervals packs these as bits, so the values are fixed)
+     */
+    enum Choice : uint8_t { KEEP_BOTH=0, KEEP_A=1, KEEP_B=2 };
+
+    /*
+     *  Picks the branches of a min or max clause to keep, given the
+     *  bounds of its arguments
+     */
+    static Choice choose(Opcode::Opcode op, float a_lower, float a_upper,
+                         float b_lower, float b_upper);
+
+    /*
+     *  Marks disabled and remaps clauses in src based on the given
+     *  branch choices (one per clause in src), then pushes the pruned
+     *  tape above the current tape
+     */
+    template <typename F>
+    void pushChoices(std::list<Tape>::iterator src, F choice);
+
+    /*
+     *  Returns the batched interval kernel for the given opcode
+     */
+    static Step::IntervalFn intervalsKernel(Opcode::Opcode op);
 
     /*
      *  Evaluates a single Interval clause
@@ -204,16 +441,92 @@ protected:
     static Interval::I eval_clause_interval(
         Opcode::Opcode op, const Interval::I& a, const Interval::I& b);
 
-    /*  Indices of X, Y, Z coordinates */
-    Clause::Id X, Y, Z;
+    /*
+     *  Evaluates a single affine clause, given its arguments' affine forms
+     *  and intervals, and its own interval result i (which is used for
+     *  operations without an affine approximation)
+     */
+    static Affine::A eval_clause_affine(
+        Opcode::Opcode op, const Affine::A& a, const Affine::A& b,
+        const Interval::I& ia, const Interval::I& ib, const Interval::I& i);
 
-    /*  Map of variables (in terms of where they live in this Evaluator) to
-     *  their ids in their respective Tree (e.g. what you get when calling
-     *  Tree::var().id() */
-    boost::bimap<Clause::Id, Tree::Id> vars;
-    /*  We also store shared-pointer handles to var Trees, so we can
-     *  reconstruct a proper Tree from the Evaluator  */
-    std::map<Tree::Id, Tree> var_handles;
+    /*
+     *  Evaluates a single interval (stored with set) with affine
+     *  arithmetic, storing each clause's range in the interval results
+     */
+    Interval::I affine();
+
+    /*
+     *  Evaluates the interval gradient of a single clause, given its
+     *  arguments' intervals and gradients and its own interval result i
+     */
+    static std::array<Interval::I, 3> eval_clause_gradient(
+        Opcode::Opcode op, const Interval::I& a, const Interval::I& b,
+        const std::array<Interval::I, 3>& ga,
+        const std::array<Interval::I, 3>& gb, const Interval::I& i);
+
+    /*
+     *  Evaluates a single interval (stored with set) with the mean value
+     *  form, storing each clause's range in the interval results
+     */
+    Interval::I meanValue();
+
+    /*
+     *  Everything that's derived from the Tree when the evaluator is built.
+     *  This never changes afterwards, so it's shared between clones.
+     */
+    struct Program {
+        /*  Base tape (in reverse order) and its root  */
+        std::vector<Clause> t;
+        Clause::Id i;
+
+        /*  Maps from clause id to its slot in the result arrays  */
+        std::vector<Clause::Id> slots;
+        Clause::Id num_slots;
+
+        /*  Slots of X, Y, Z coordinates in the result arrays */
+        Clause::Id X, Y, Z;
+
+        /*  Initial values of constants and variables, by slot  */
+        std::map<Clause::Id, float> constants;
+
+        /*  Map of variables (in terms of where they live in this Evaluator)
+         *  to their ids in their respective Tree (e.g. what you get when
+         *  calling Tree::var().id() */
+        boost::bimap<Clause::Id, Tree::Id> vars;
+
+        /*  Mask bit for each slot that holds a variable (0 otherwise)  */
+        std::vector<uint64_t> var_bits;
+        /*  We also store shared-pointer handles to var Trees, so we can
+         *  reconstruct a proper Tree from the Evaluator  */
+        std::map<Tree::Id, Tree> var_handles;
+    };
+
+    /*
+     *  Sets up the per-evaluator state (result arrays, base tape, and
+     *  scratch arrays) from the program
+     */
+    void init();
+
+    /*
+     *  Assigns every id in the given (reverse-ordered) tape a slot in the
+     *  result arrays, storing the mapping in slots.
+     *
+     *  A liveness pass lets clauses re-use slots whose values are no longer
+     *  needed, so the result arrays scale with the maximum number of live
+     *  values rather than the size of the tree.
+     *
+     *  Returns the number of distinct slots.
+     */
+    static Clause::Id allocateSlots(const std::list<Clause>& t,
+                                    Clause::Id root, Clause::Id count,
+                                    std::vector<Clause::Id>& slots);
+
+    std::shared_ptr<const Program> program;
+
+    /*  Slots of X, Y, Z coordinates (copied from the program, since they're
+     *  used in the inlined set function) */
+    Clause::Id X, Y, Z;
 
     /*  Tape containing our opcodes in reverse order */
     std::list<Tape> tapes;
@@ -227,6 +540,24 @@ protected:
     std::vector<Clause::Id> remap;
 
     std::unique_ptr<Result> result;
+
+    /*  Arithmetic used for interval evaluation  */
+    RangeMode range_mode=INTERVAL;
+
+    /*  Cache of pruned tapes, most recently used first, and an index
+     *  into it by key  */
+    std::list<CachedTape> tape_cache;
+    std::unordered_map<uint64_t, std::list<CachedTape>::iterator> tape_index;
+    size_t tape_cache_size=32;
+    CacheStats cache_stats={0, 0};
+
+    /*  Keys of recently built tapes, indexed by key modulo the size of the
+     *  array (so that tapes are only cached once they've been seen twice)  */
+    std::array<uint64_t, 1024> tape_seen={{0}};
+
+    /*  Choices made by each min / max clause while pushing, in tape
+     *  order (scratch space for the cache key)  */
+    std::vector<uint8_t> decisions;
 };
 
 }   // namespace Kernel
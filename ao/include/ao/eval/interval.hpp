@@ -1,89 +1,400 @@
 #pragma once
 
-#include <boost/numeric/interval.hpp>
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <limits>
 
 namespace Kernel {
 namespace Interval {
 
-typedef boost::numeric::interval<float,
-    boost::numeric::interval_lib::policies<
-        boost::numeric::interval_lib::save_state<
-            boost::numeric::interval_lib::rounded_transc_std<float>>,
-        boost::numeric::interval_lib::checking_base<float>>> I;
+/*
+ *  A closed interval of floats, rounded outwards.
+ *
+ *  Each bound is computed in double precision (where products of floats
+ *  are exact, and sums, quotients and square roots reveal whether they
+ *  were rounded) and then rounded to the nearest float in the outwards
+ *  direction, so we never have to touch the FPU rounding mode.  Bounds
+ *  that are exact stay exact: [1, 2] + 1 is [2, 3].
+ *
+ *  An interval with a NaN bound (or with lower > upper) is empty, and
+ *  operations on empty intervals return empty intervals.
+ */
+class I
+{
+public:
+    I() : lo(0), hi(0) {}
+    I(float v) : lo(v), hi(v) {}
+    I(float l, float u) : lo(l), hi(u)
+    {
+        if (!(l <= u))
+        {
+            lo = hi = std::numeric_limits<float>::quiet_NaN();
+        }
+    }
 
-enum State { EMPTY, FILLED, AMBIGUOUS, UNKNOWN };
+    float lower() const { return lo; }
+    float upper() const { return hi; }
 
-inline bool isFilled(const Interval::I& i) { return i.upper() < 0; }
-inline bool isEmpty(const Interval::I& i)  { return i.lower() > 0; }
-inline State state(const Interval::I& i)
+    /*  Checks whether this interval is empty (see above)  */
+    bool isNaN() const { return !(lo <= hi); }
+
+    /*  Builds an interval without checking that the bounds are ordered  */
+    static I bounds(float l, float u)
+    {
+        I out;
+        out.lo = l;
+        out.hi = u;
+        return out;
+    }
+
+    static I empty()
+    {
+        const float nan = std::numeric_limits<float>::quiet_NaN();
+        return bounds(nan, nan);
+    }
+
+    static I whole()
+    {
+        const float inf = std::numeric_limits<float>::infinity();
+        return bounds(-inf, inf);
+    }
+
+protected:
+    float lo;
+    float hi;
+};
+
+////////////////////////////////////////////////////////////////////////////////
+
+/*
+ *  Returns the next float below (or above) f, which must not be NaN or
+ *  the infinity in that direction
+ */
+inline float nextDown(float f)
 {
-    return isEmpty(i)  ? EMPTY :
-           isFilled(i) ? FILLED : AMBIGUOUS;
+    if (f == 0)
+    {
+        return -std::numeric_limits<float>::denorm_min();
+    }
+    uint32_t u;
+    memcpy(&u, &f, sizeof(u));
+    u += (f > 0) ? -1 : 1;
+    memcpy(&f, &u, sizeof(f));
+    return f;
 }
 
-}   // namespace Interval
-}   // namespace Kernel
+inline float nextUp(float f)
+{
+    return -nextDown(-f);
+}
+
+/*
+ *  Rounds an exact (or correctly rounded) double to a float below / above
+ */
+inline float down(double d)
+{
+    const float f = static_cast<float>(d);
+    return (f > d) ? nextDown(f) : f;
+}
+
+inline float up(double d)
+{
+    const float f = static_cast<float>(d);
+    return (f < d) ? nextUp(f) : f;
+}
 
-inline Kernel::Interval::I atan2(const Kernel::Interval::I& y,
-                                 const Kernel::Interval::I& x)
+/*
+ *  Sums of floats are exact in double precision unless their magnitudes
+ *  are very different, so we recover the rounding error (Knuth's TwoSum)
+ *  to handle the case where the rounded sum lands on a float
+ */
+inline float addDown(float a, float b)
 {
-    // There are 9 possible cases for interval atan2:
-    // - Completely within a quadrant (4 cases)
-    // - Completely within two quadrants (4 cases)
-    // - Containing the origin (1 case)
+    const double s = double(a) + double(b);
+    const float f = static_cast<float>(s);
+    if (f > s)
+    {
+        return nextDown(f);
+    }
+    else if (f == s)
+    {
+        const double bb = s - a;
+        if ((a - (s - bb)) + (b - bb) < 0)
+        {
+            return nextDown(f);
+        }
+    }
+    return f;
+}
+
+inline float addUp(float a, float b)
+{
+    return -addDown(-a, -b);
+}
+
+inline float mulDown(float a, float b) { return down(double(a) * b); }
+inline float mulUp(float a, float b)   { return up(double(a) * b); }
+inline float divDown(float a, float b) { return down(double(a) / b); }
+inline float divUp(float a, float b)   { return up(double(a) / b); }
+
+////////////////////////////////////////////////////////////////////////////////
+
+inline I operator-(const I& x)
+{
+    if (x.isNaN())
+    {
+        return I::empty();
+    }
+    return I::bounds(-x.upper(), -x.lower());
+}
+
+inline I operator+(const I& x, const I& y)
+{
+    if (x.isNaN() || y.isNaN())
+    {
+        return I::empty();
+    }
+    return I::bounds(addDown(x.lower(), y.lower()),
+                     addUp(x.upper(), y.upper()));
+}
+
+inline I operator-(const I& x, const I& y)
+{
+    if (x.isNaN() || y.isNaN())
+    {
+        return I::empty();
+    }
+    return I::bounds(addDown(x.lower(), -y.upper()),
+                     addUp(x.upper(), -y.lower()));
+}
 
-    if (x.lower() > 0)
-    {   // Right half of the plane
-        if (y.lower() > 0)
-        {   // 1st quadrant
-            return Kernel::Interval::I(atan2(y.lower(), x.upper()),
-                                       atan2(y.upper(), x.lower()));
+/*
+ *  Multiplication picks the bounds by sign (rather than taking the min
+ *  and max of four products) so that 0 * inf never comes up
+ */
+inline I operator*(const I& x, const I& y)
+{
+    if (x.isNaN() || y.isNaN())
+    {
+        return I::empty();
+    }
+
+    const float xl = x.lower();
+    const float xu = x.upper();
+    const float yl = y.lower();
+    const float yu = y.upper();
+
+    if (xl < 0)
+    {
+        if (xu > 0)
+        {
+            if (yl < 0)
+            {
+                if (yu > 0) // M * M
+                {
+                    return I::bounds(
+                            std::min(mulDown(xl, yu), mulDown(xu, yl)),
+                            std::max(mulUp(xl, yl), mulUp(xu, yu)));
+                }
+                // M * N
+                return I::bounds(mulDown(xu, yl), mulUp(xl, yl));
+            }
+            else if (yu > 0) // M * P
+            {
+                return I::bounds(mulDown(xl, yu), mulUp(xu, yu));
+            }
         }
-        else if (y.upper() < 0)
-        {   // 4th quadrant
-            return Kernel::Interval::I(atan2(y.lower(), x.lower()),
-                                       atan2(y.upper(), x.upper()));
+        else if (yl < 0)
+        {
+            if (yu > 0) // N * M
+            {
+                return I::bounds(mulDown(xl, yu), mulUp(xl, yl));
+            }
+            // N * N
+            return I::bounds(mulDown(xu, yu), mulUp(xl, yl));
         }
-        else
-        {   // Crossing the X axis
-            return Kernel::Interval::I(atan2(y.lower(), x.lower()),
-                                       atan2(y.upper(), x.lower()));
+        else if (yu > 0) // N * P
+        {
+            return I::bounds(mulDown(xl, yu), mulUp(xu, yl));
         }
     }
-    else if (x.upper() < 0)
-    {   // Left half of the plane
-        if (y.lower() > 0)
-        {   // 2nd quadrant
-            return Kernel::Interval::I(atan2(y.upper(), x.upper()),
-                                       atan2(y.lower(), x.lower()));
-        }
-        else if (y.upper() < 0)
-        {   // 3rd quadrant
-            return Kernel::Interval::I(atan2(y.upper(), x.lower()),
-                                       atan2(y.lower(), x.upper()));
+    else if (xu > 0)
+    {
+        if (yl < 0)
+        {
+            if (yu > 0) // P * M
+            {
+                return I::bounds(mulDown(xu, yl), mulUp(xu, yu));
+            }
+            // P * N
+            return I::bounds(mulDown(xu, yl), mulUp(xl, yu));
         }
-        else
-        {   // Branch cut
-            return Kernel::Interval::I(-M_PI, M_PI);
+        else if (yu > 0) // P * P
+        {
+            return I::bounds(mulDown(xl, yl), mulUp(xu, yu));
         }
     }
-    else
-    {  // Both sides of the plane
-        if (y.lower() > 0)
-        {   // Top half of the plane
-            return Kernel::Interval::I(atan2(y.lower(), x.upper()),
-                                       atan2(y.lower(), x.lower()));
+    // One side is zero
+    return I::bounds(0, 0);
+}
+
+inline I operator/(const I& x, const I& y)
+{
+    if (x.isNaN() || y.isNaN())
+    {
+        return I::empty();
+    }
+
+    const float inf = std::numeric_limits<float>::infinity();
+    const float xl = x.lower();
+    const float xu = x.upper();
+    const float yl = y.lower();
+    const float yu = y.upper();
+
+    // Dividing by an interval that contains zero
+    if (yl <= 0 && yu >= 0)
+    {
+        if (yl == 0 && yu == 0)
+        {
+            return I::empty();
+        }
+        else if (xl == 0 && xu == 0)
+        {
+            return x;
         }
-        else if (y.upper() < 0)
+        else if (yl != 0 && yu != 0)
         {
-            // Bottom half of the plane
-            return Kernel::Interval::I(atan2(y.upper(), x.lower()),
-                                       atan2(y.upper(), x.upper()));
+            return I::whole();
         }
-        else
+        else if (yl == 0) // Dividing by [0, yu]
         {
-            // Contains the origin
-            return Kernel::Interval::I(-M_PI, M_PI);
+            return (xu < 0) ? I::bounds(-inf, divUp(xu, yu))
+                 : (xl < 0) ? I::whole()
+                            : I::bounds(divDown(xl, yu), inf);
         }
+        else // Dividing by [yl, 0]
+        {
+            return (xu < 0) ? I::bounds(divDown(xu, yl), inf)
+                 : (xl < 0) ? I::whole()
+                            : I::bounds(-inf, divUp(xl, yl));
+        }
+    }
+
+    if (xu < 0)
+    {
+        return (yu < 0) ? I::bounds(divDown(xu, yl), divUp(xl, yu))
+                        : I::bounds(divDown(xl, yl), divUp(xu, yu));
+    }
+    else if (xl < 0)
+    {
+        return (yu < 0) ? I::bounds(divDown(xu, yu), divUp(xl, yu))
+                        : I::bounds(divDown(xl, yl), divUp(xu, yl));
+    }
+    else
+    {
+        return (yu < 0) ? I::bounds(divDown(xu, yu), divUp(xl, yl))
+                        : I::bounds(divDown(xl, yu), divUp(xu, yl));
+    }
+}
+
+inline I min(const I& x, const I& y)
+{
+    if (x.isNaN() || y.isNaN())
+    {
+        return I::empty();
     }
+    return I::bounds(std::min(x.lower(), y.lower()),
+                     std::min(x.upper(), y.upper()));
 }
+
+inline I max(const I& x, const I& y)
+{
+    if (x.isNaN() || y.isNaN())
+    {
+        return I::empty();
+    }
+    return I::bounds(std::max(x.lower(), y.lower()),
+                     std::max(x.upper(), y.upper()));
+}
+
+inline I abs(const I& x)
+{
+    if (x.isNaN())
+    {
+        return I::empty();
+    }
+    else if (x.lower() >= 0)
+    {
+        return x;
+    }
+    else if (x.upper() <= 0)
+    {
+        return -x;
+    }
+    return I::bounds(0, std::max(-x.lower(), x.upper()));
+}
+
+inline I square(const I& x)
+{
+    if (x.isNaN())
+    {
+        return I::empty();
+    }
+
+    const float xl = x.lower();
+    const float xu = x.upper();
+    if (xu < 0)
+    {
+        return I::bounds(mulDown(xu, xu), mulUp(xl, xl));
+    }
+    else if (xl > 0)
+    {
+        return I::bounds(mulDown(xl, xl), mulUp(xu, xu));
+    }
+    return I::bounds(0, (-xl > xu) ? mulUp(xl, xl) : mulUp(xu, xu));
+}
+
+inline I sqrt(const I& x)
+{
+    if (x.isNaN() || x.upper() < 0)
+    {
+        return I::empty();
+    }
+    return I::bounds(
+            (x.lower() > 0) ? down(std::sqrt(double(x.lower()))) : 0,
+            up(std::sqrt(double(x.upper()))));
+}
+
+/*
+ *  Transcendental functions are evaluated in double precision, which is
+ *  far more accurate than the float result, then rounded outwards with an
+ *  extra ulp of slack (since libm isn't correctly rounded).
+ *  (They're defined in interval.cpp)
+ */
+I pow(const I& x, int p);
+I nth_root(const I& x, int n);
+I sin(const I& x);
+I cos(const I& x);
+I tan(const I& x);
+I asin(const I& x);
+I acos(const I& x);
+I atan(const I& x);
+I atan2(const I& y, const I& x);
+I exp(const I& x);
+
+////////////////////////////////////////////////////////////////////////////////
+
+enum State { EMPTY, FILLED, AMBIGUOUS, UNKNOWN };
+
+inline bool isFilled(const Interval::I& i) { return i.upper() < 0; }
+inline bool isEmpty(const Interval::I& i)  { return i.lower() > 0; }
+inline State state(const Interval::I& i)
+{
+    return isEmpty(i)  ? EMPTY :
+           isFilled(i) ? FILLED : AMBIGUOUS;
+}
+
+}   // namespace Interval
+}   // namespace Kernel
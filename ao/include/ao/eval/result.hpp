@@ -6,6 +6,7 @@
 #include <Eigen/Eigen>
 
 #include "ao/eval/interval.hpp"
+#include "ao/eval/affine.hpp"
 #include "ao/eval/clause.hpp"
 
 namespace Kernel {
@@ -16,15 +17,17 @@ struct Result {
 
     /*
      *  Constructs a result object with appropriate array sizes
+     *
+     *  slots is the number of distinct storage rows, which may be smaller
+     *  than the number of clauses (see Evaluator::allocateSlots)
      */
-    Result(Index clauses, Index vars=0);
+    Result(Index slots);
 
     /*
      *  Sets all of the values to the given constant float
      *  (across the Interval, and float / __m256 arrays)
      *
      *  Gradients are set to {0, 0, 0}
-     *  Gradient is set to 0
      */
     void fill(float v, Index clause);
 
@@ -34,11 +37,6 @@ struct Result {
      */
     void setValue(float v, Index clause);
 
-    /*
-     *  Marks that j[clause][var] = 1
-     */
-    void setGradient(Index clause, Index var);
-
     /*
      *  Fills the derivative arrays with the given values
      */
@@ -47,6 +45,9 @@ struct Result {
     // This is the number of samples that we can process in one pass
     static constexpr Index N = 256;
 
+    // This is the number of intervals that we can process in one pass
+    static constexpr Index K = 8;
+
     /*  Make an aligned new operator, as this class has Eigen structs
      *  inside of it (which are aligned for SSE) */
     EIGEN_MAKE_ALIGNED_OPERATOR_NEW
@@ -57,12 +58,31 @@ struct Result {
     /*  d(clause).col(index) is a set of partial derivatives [dx, dy, dz] */
     Eigen::Array<Eigen::Array<float, 3, N>, Eigen::Dynamic, 1> d;
 
-    /*  j(clause, var) = dclause / dvar */
-    Eigen::Array<float, Eigen::Dynamic, Eigen::Dynamic> j;
+    /*  Scratch space for reverse-mode gradients (allocated on first use):
+     *  adj[clause] accumulates droot / dclause, and vals[step] stores a
+     *  tape step's argument values from the forward pass  */
+    std::vector<float> adj;
+    std::vector<std::array<float, 2>> vals;
 
     /*  i[clause] is the interval result for that clause */
     std::vector<Interval::I> i;
 
+    /*  a[clause] is the affine result for that clause
+     *  (only used by Evaluator::AFFINE evaluation)  */
+    std::vector<Affine::A> a;
+
+    /*  ic[clause] is the interval result at the center of the region, and
+     *  ig[clause] is the interval gradient over the region
+     *  (only used by Evaluator::MEAN_VALUE evaluation)  */
+    std::vector<Interval::I> ic;
+    std::vector<std::array<Interval::I, 3>> ig;
+
+    /*  lo(clause, box) and hi(clause, box) are the bounds of a batched
+     *  interval result (see Evaluator::intervals), stored as structures
+     *  of arrays so that each box is one lane  */
+    Eigen::Array<float, Eigen::Dynamic, K, Eigen::RowMajor> lo;
+    Eigen::Array<float, Eigen::Dynamic, K, Eigen::RowMajor> hi;
+
     /*  ambig(index) returns whether a particular slot is ambiguous */
     Eigen::Array<bool, N, 1> ambig;
 };
@@ -0,0 +1,45 @@
+#pragma once
+
+#include <cstdint>
+
+#include "ao/tree/opcode.hpp"
+
+namespace Kernel {
+
+namespace Simd
+{
+/*
+ *  Signature shared by all float kernels:
+ *      out[i] = op(a[i], b[i]) for i in [0, count)
+ */
+typedef void (*Fn)(float* out, const float* a, const float* b,
+                   uint32_t count);
+
+/*
+ *  Returns a hand-written SIMD kernel for the given opcode, picked at
+ *  runtime for the best instruction set that this CPU supports.  Returns
+ *  nullptr if there isn't one, in which case the caller should fall back
+ *  to its portable implementation.
+ *
+ *  Kernels work in blocks of 8 values, so every buffer must be readable
+ *  and writable up to count rounded up to a multiple of 8.  This is always
+ *  true for rows of a Result, which are N = 256 values wide.
+ *
+ *  Transcendental kernels are polynomial approximations (from Cephes):
+ *      sin, cos:   absolute error < 3e-7 for |x| <= 8192
+ *                  (larger inputs fall back to the C library)
+ *      exp:        relative error < 2e-7 for normal results
+ *      atan:       relative error < 2e-7
+ *      atan2:      as atan, plus one rounding in y / x
+ *  mod is exact for b > 0; other lanes fall back to the C library.
+ */
+Fn kernel(Opcode::Opcode op);
+
+/*
+ *  Returns the name of the instruction set used by kernel()
+ *  ("avx2" or "none")
+ */
+const char* isa();
+}   // namespace Simd
+
+}   // namespace Kernel
@@ -15,6 +15,15 @@ class Dual
 public:
     template<typename V>
     static void walk(const XTree<N>* tree, V& v);
+
+    /*
+     *  Calls the face and edge procedures across a branch's children,
+     *  without recursing into the children themselves.  walk(t) is
+     *  equivalent to walk on each child of t (in order), then seams(t);
+     *  this lets callers split a walk into independent subtrees.
+     */
+    template<typename V>
+    static void seams(const XTree<N>* tree, V& v);
 };
 
 ////////////////////////////////////////////////////////////////////////////////
@@ -60,6 +69,20 @@ void edge2(const std::array<const XTree<2>*, 2>& ts, V& v)
     }
 }
 
+template <>
+template <typename V>
+void Dual<2>::seams(const XTree<2>* t, V& v)
+{
+    if (t->isBranch())
+    {
+        //  Call edge on every pair of cells
+        edge2<V, Axis::Y>({{t->child(0), t->child(Axis::X)}}, v);
+        edge2<V, Axis::Y>({{t->child(Axis::Y), t->child(Axis::Y | Axis::X)}}, v);
+        edge2<V, Axis::X>({{t->child(0), t->child(Axis::Y)}}, v);
+        edge2<V, Axis::X>({{t->child(Axis::X), t->child(Axis::X | Axis::Y)}}, v);
+    }
+}
+
 template <>
 template <typename V>
 void Dual<2>::walk(const XTree<2>* t, V& v)
@@ -67,7 +90,7 @@ void Dual<2>::walk(const XTree<2>* t, V& v)
     if (t->isBranch())
     {
         // Recurse down every subface in the quadtree
-        for (unsigned i=0; i < t->children.size(); ++i)
+        for (unsigned i=0; i < t->children->size(); ++i)
         {
             auto c = t->child(i);
             if (c != t)
@@ -76,11 +99,7 @@ void Dual<2>::walk(const XTree<2>* t, V& v)
             }
         }
 
-        //  Then, call edge on every pair of cells
-        edge2<V, Axis::Y>({{t->child(0), t->child(Axis::X)}}, v);
-        edge2<V, Axis::Y>({{t->child(Axis::Y), t->child(Axis::Y | Axis::X)}}, v);
-        edge2<V, Axis::X>({{t->child(0), t->child(Axis::Y)}}, v);
-        edge2<V, Axis::X>({{t->child(Axis::X), t->child(Axis::X | Axis::Y)}}, v);
+        seams(t, v);
     }
 }
 ////////////////////////////////////////////////////////////////////////////////
@@ -187,6 +206,24 @@ void call_face3(const XTree<3>* t, V& v)
     face3<V, A>({{t->child(q|r), t->child(q|r|A)}}, v);
 }
 
+template <>
+template <typename V>
+void Dual<3>::seams(const XTree<3>* t, V& v)
+{
+    if (t->isBranch())
+    {
+        // Call the face procedure on every pair of cells (4x per axis)
+        call_face3<V, Axis::X>(t, v);
+        call_face3<V, Axis::Y>(t, v);
+        call_face3<V, Axis::Z>(t, v);
+
+        // Call the edge function 6 times (2x per axis)
+        call_edge3<V, Axis::X>(t, v);
+        call_edge3<V, Axis::Y>(t, v);
+        call_edge3<V, Axis::Z>(t, v);
+    }
+}
+
 template <>
 template <typename V>
 void Dual<3>::walk(const XTree<3>* t, V& v)
@@ -194,7 +231,7 @@ void Dual<3>::walk(const XTree<3>* t, V& v)
     if (t->isBranch())
     {
         // Recurse, calling the cell procedure for every child
-        for (unsigned i=0; i < t->children.size(); ++i)
+        for (unsigned i=0; i < t->children->size(); ++i)
         {
             auto c = t->child(i);
             if (c != t)
@@ -203,15 +240,7 @@ void Dual<3>::walk(const XTree<3>* t, V& v)
             }
         }
 
-        // Call the face procedure on every pair of cells (4x per axis)
-        call_face3<V, Axis::X>(t, v);
-        call_face3<V, Axis::Y>(t, v);
-        call_face3<V, Axis::Z>(t, v);
-
-        // Call the edge function 6 times (2x per axis)
-        call_edge3<V, Axis::X>(t, v);
-        call_edge3<V, Axis::Y>(t, v);
-        call_edge3<V, Axis::Z>(t, v);
+        seams(t, v);
     }
 }
 
@@ -1,6 +1,7 @@
 #pragma once
 #include <array>
 #include <set>
+#include <memory>
 
 namespace Kernel {
 
@@ -84,8 +85,21 @@ struct MarchingTable
     EdgeToPatch<N> p;
 };
 
+/*
+ *  Builds a marching squares / cubes table from a small set of cases
+ *  and their rigid rotations.
+ *
+ *  This is run at build time by ao-marching-gen, which writes out the
+ *  precomputed TABLE2 and TABLE3 below.
+ */
 template <unsigned N>
 std::unique_ptr<MarchingTable<N>> buildTable();
 
+/*  Precomputed marching squares and cubes tables.  These are constant-
+ *  initialized, so they live in read-only memory and are safe to use
+ *  from any thread without setup.  */
+extern const MarchingTable<2> TABLE2;
+extern const MarchingTable<3> TABLE3;
+
 }   // namespace Marching
 }   // namespace Kernel
@@ -1,5 +1,7 @@
 #pragma once
 
+#include <fstream>
+
 #include "ao/tree/tree.hpp"
 
 #include "ao/render/axes.hpp"
@@ -9,6 +11,59 @@
 
 namespace Kernel {
 
+/*
+ *  A MeshSink receives a mesh piece by piece, as it is generated
+ *  (see the streaming Mesh::render)
+ */
+class MeshSink
+{
+public:
+    virtual ~MeshSink() {}
+
+    /*
+     *  Called once for each vertex.  Vertices are numbered from 1 in the
+     *  order that they're passed in (as in Mesh::verts, where index 0 is
+     *  a marker).
+     */
+    virtual void vertex(const Eigen::Vector3f& v) = 0;
+
+    /*
+     *  Called once for each triangle, after all of its vertices.  Both
+     *  vertex indices and positions are passed in, so that a sink doesn't
+     *  need to store vertices to handle triangles.
+     */
+    virtual void triangle(const Eigen::Matrix<uint32_t, 3, 1>& t,
+                          const std::array<Eigen::Vector3f, 3>& pos) = 0;
+};
+
+/*  Buffered output stream (defined in mesh.cpp)  */
+class BlockWriter;
+
+/*
+ *  Sink that streams triangles into a binary STL file
+ */
+class STLSink : public MeshSink
+{
+public:
+    STLSink(const std::string& filename);
+    ~STLSink();
+
+    /*
+     *  Fills in the triangle count and closes the file,
+     *  returning false if anything went wrong
+     */
+    bool close();
+
+    void vertex(const Eigen::Vector3f&) override {}
+    void triangle(const Eigen::Matrix<uint32_t, 3, 1>& t,
+                  const std::array<Eigen::Vector3f, 3>& pos) override;
+
+protected:
+    std::ofstream file;
+    std::unique_ptr<BlockWriter> out;
+    uint32_t count=0;
+};
+
 class Mesh : public BRep<3> {
 public:
     /*
@@ -23,27 +78,120 @@ public:
     static std::unique_ptr<Mesh> render(
             const Tree t, const std::map<Tree::Id, float>& vars,
             const Region<3>& r, double min_feature, double max_err,
-            std::atomic_bool& cancel);
+            std::atomic_bool& cancel, unsigned workers=8);
+
+    /*
+     *  Streaming render function, which passes vertices and triangles to
+     *  the sink as soon as they're final (rather than building a Mesh).
+     *
+     *  The whole octree is built before it's walked, so peak memory is
+     *  still that of the full octree; what's saved is the Mesh's vertex
+     *  and triangle storage.  Cells are released as the walk finishes
+     *  with them, which shrinks the octree during meshing.  renderTiled
+     *  (below) also bounds the octree's memory.
+     *
+     *  Returns false if cancelled before meshing began.
+     */
+    static bool render(
+            const Tree t, const std::map<Tree::Id, float>& vars,
+            const Region<3>& r, double min_feature, double max_err,
+            std::atomic_bool& cancel, MeshSink& sink, unsigned workers=8);
+
+    /*
+     *  Walks an XTree, passing the mesh to a sink (see above)
+     */
+    static void stream(std::unique_ptr<const XTree<3>> tree, MeshSink& sink);
+
+    /*
+     *  Tiled streaming render function, for regions that are too large
+     *  (relative to min_feature) to fit a whole octree in memory.
+     *
+     *  The region is split into 2^tile_levels tiles along each axis.
+     *  Tiles are built (with all workers) and meshed one at a time, so
+     *  only one complete tile is in memory, plus the boundary cells of
+     *  finished tiles.  Tiles are the top levels of a single octree, so
+     *  vertices along tile seams are shared and the result is watertight.
+     *  Triangles go straight to the sink, which may write them to disk.
+     *
+     *  Returns false if cancelled.
+     */
+    static bool renderTiled(
+            const Tree t, const std::map<Tree::Id, float>& vars,
+            const Region<3>& r, double min_feature, double max_err,
+            std::atomic_bool& cancel, MeshSink& sink,
+            unsigned tile_levels, unsigned workers=8);
 
     /*
      *  Render function that re-uses evaluators
-     *  es must be a pointer to at least eight Evaluators
+     *  (with one worker thread per evaluator)
      */
     static std::unique_ptr<Mesh> render(
-            Evaluator* es,
+            const std::vector<Evaluator*>& es,
             const Region<3>& r, double min_feature, double max_err,
             std::atomic_bool& cancel);
 
     /*
-     *  Writes the mesh to a file
+     *  Incremental render function, for re-meshing after the variables in
+     *  changed have been given new values (already loaded into es).
+     *
+     *  xtree holds the octree from the previous render over the same
+     *  region (with the same min_feature and max_err), or nullptr.  It's
+     *  replaced by the new octree, which re-uses every cell that doesn't
+     *  depend on a changed variable (see XTree::rebuild), so the cost of
+     *  evaluation scales with the size of the edit.
+     */
+    static std::unique_ptr<Mesh> render(
+            const std::vector<Evaluator*>& es,
+            const Region<3>& r, double min_feature, double max_err,
+            std::atomic_bool& cancel, std::unique_ptr<const XTree<3>>& xtree,
+            const std::set<Tree::Id>& changed);
+
+    /*
+     *  Progressive render function, for previews at increasing resolution.
+     *
+     *  xtree holds the octree from a render of the same region at a larger
+     *  min_feature (with the same max_err), or nullptr.  It's replaced by
+     *  the new octree, which re-uses every cell with an exact filled /
+     *  empty state without evaluating it again (see XTree::refine).
+     */
+    static std::unique_ptr<Mesh> refine(
+            const std::vector<Evaluator*>& es,
+            const Region<3>& r, double min_feature, double max_err,
+            std::atomic_bool& cancel, std::unique_ptr<const XTree<3>>& xtree);
+
+    /*
+     *  Writes the mesh to a binary STL file
      */
     bool saveSTL(const std::string& filename);
 
+    /*
+     *  Writes the mesh to a binary (little-endian) PLY file, which is
+     *  indexed, so vertices aren't duplicated for each triangle
+     */
+    bool savePLY(const std::string& filename);
+
+    /*
+     *  Writes the mesh to an indexed OBJ (text) file
+     */
+    bool saveOBJ(const std::string& filename);
+
+    /*
+     *  Writes the mesh to a file, picking the format from its extension
+     *  (.ply, .obj, or binary STL otherwise)
+     */
+    bool save(const std::string& filename);
+
     /*
      *  Merge multiple bodies and write them to a single file
      */
     static bool saveSTL(const std::string& filename,
                         const std::list<const Mesh*>& meshes);
+    static bool savePLY(const std::string& filename,
+                        const std::list<const Mesh*>& meshes);
+    static bool saveOBJ(const std::string& filename,
+                        const std::list<const Mesh*>& meshes);
+    static bool save(const std::string& filename,
+                     const std::list<const Mesh*>& meshes);
 
     /*
      *  Called by Dual::walk to construct the triangle mesh
@@ -53,14 +201,49 @@ public:
 
 protected:
     /*  Walks an XTree, returning a mesh  */
-    static std::unique_ptr<Mesh> mesh(std::unique_ptr<const XTree<3>> tree,
-                                      std::atomic_bool& cancel);
+    static std::unique_ptr<Mesh> mesh(const XTree<3>* tree,
+                                      std::atomic_bool& cancel,
+                                      unsigned workers=1);
+
+    /*
+     *  Runs the dual walk over the given tree, splitting it into subtrees
+     *  that are meshed in parallel (into separate Meshes), then merged in
+     *  the same order as a serial walk.  The output is identical to
+     *  Dual<3>::walk(t, *this).
+     */
+    void walk(const XTree<3>* t, unsigned workers);
+
+    /*
+     *  Appends a mesh built from a separate subtree, shifting its vertex
+     *  indices (and the indices stamped into its cells) to match
+     */
+    void absorb(const Mesh& m);
+
+    /*
+     *  Shared by load and Stream::load: looks up (or creates) a vertex for
+     *  each of the four cells around an edge, then emits two triangles
+     *  through out.vertex(cell, vi, pos) and out.triangle(t, pos)
+     */
+    template <Axis::Axis A, bool D, typename Out>
+    static void loadQuad(const std::array<const XTree<3>*, 4>& ts, Out& out);
+
+    /*  Hooks called by loadQuad  */
+    uint32_t vertex(const XTree<3>* t, unsigned vi, const Eigen::Vector3f& v);
+    void triangle(const Eigen::Matrix<uint32_t, 3, 1>& t,
+                  const std::array<Eigen::Vector3f, 3>& pos);
+
+    /*  Visitor used by stream (defined in mesh.cpp)  */
+    class Stream;
 
     /*
      *  Inserts a line into the mesh as a zero-size triangle
      *  (used for debugging)
      */
     void line(Eigen::Vector3f a, Eigen::Vector3f b);
+
+    /*  Every (cell, vertex) whose index was stamped by load,
+     *  so that indices can be shifted when this mesh is absorbed  */
+    std::vector<std::pair<const XTree<3>*, unsigned>> claimed;
 };
 
 }   // namespace Kernel
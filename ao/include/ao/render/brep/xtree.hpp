@@ -2,11 +2,14 @@
 #include <iostream>
 
 #include <array>
+#include <atomic>
 #include <cstdint>
+#include <set>
 #include <Eigen/Eigen>
 
 #include "ao/render/brep/region.hpp"
 #include "ao/render/brep/marching.hpp"
+#include "ao/render/pool.hpp"
 #include "ao/eval/evaluator.hpp"
 #include "ao/eval/interval.hpp"
 
@@ -26,38 +29,105 @@ public:
 
     /*
      *  Fully-specified XTree builder (stoppable through cancel)
+     *
+     *  workers is the number of threads (and evaluators) used to build
+     *  the tree; work is split between them at any depth.  range picks
+     *  the arithmetic used to prune the tree (see Evaluator::RangeMode).
      */
     static std::unique_ptr<const XTree> build(
             Tree t, const std::map<Tree::Id, float>& vars,
             Region<N> region, double min_feature,
-            double max_err, bool multithread,
-            std::atomic_bool& cancel);
+            double max_err, unsigned workers,
+            std::atomic_bool& cancel,
+            Evaluator::RangeMode range=Evaluator::INTERVAL);
+
+    /*
+     *  Specializes t for the region's perpendicular coordinates (if any),
+     *  which never change within the region.  The tree cache folds every
+     *  clause that only depends on them (and on constants) into a constant.
+     *
+     *  build(Tree, ...) does this before constructing its evaluators.
+     */
+    static Tree specialize(Tree t, const Region<N>& region);
 
     /*
      *  XTree builder that re-uses existing evaluators
-     *  If multithread is true, es must be a pointer to an array of evaluators
+     *  (with one worker thread per evaluator, using their range modes)
      */
     static std::unique_ptr<const XTree> build(
-            Evaluator* es,
+            const std::vector<Evaluator*>& es,
+            Region<N> region, double min_feature,
+            double max_err, std::atomic_bool& cancel);
+
+    /*
+     *  Incremental builder, for use after the variables in changed have
+     *  been given new values (which must already be loaded into es).
+     *
+     *  Every cell of prev whose pruned tape is unchanged and doesn't read
+     *  a changed variable is moved into the new tree as-is; the rest are
+     *  rebuilt.  prev must have been built over the same region, with the
+     *  same min_feature and max_err.  It's consumed whether or not the
+     *  build finishes, and nullptr is returned if cancelled.
+     */
+    static std::unique_ptr<const XTree> rebuild(
+            const std::vector<Evaluator*>& es,
             Region<N> region, double min_feature,
-            double max_err, bool multithread,
-            std::atomic_bool& cancel);
+            double max_err, std::atomic_bool& cancel,
+            std::unique_ptr<const XTree> prev,
+            const std::set<Tree::Id>& changed);
+
+    /*
+     *  Progressive builder, which refines prev (built over the same region
+     *  and with the same max_err, but a larger min_feature) down to the
+     *  given min_feature.
+     *
+     *  Cells of prev whose filled / empty state was proven by interval
+     *  arithmetic hold at any resolution, so they're moved into the new
+     *  tree without being evaluated again; only ambiguous cells are rebuilt
+     *  (re-using their children where possible).  prev is consumed, and
+     *  nullptr is returned if cancelled.
+     */
+    static std::unique_ptr<const XTree> refine(
+            const std::vector<Evaluator*>& es,
+            Region<N> region, double min_feature,
+            double max_err, std::atomic_bool& cancel,
+            std::unique_ptr<const XTree> prev);
+
+    /*
+     *  Returns a branch over the given region with no children, for
+     *  callers that build each child separately (e.g. tiled meshing).
+     *  Every child must be filled in with setChild before the branch
+     *  is used.
+     */
+    static std::unique_ptr<XTree> branch(Region<N> region);
+
+    /*
+     *  Moves t into the ith child of a branch returned by branch()
+     */
+    void setChild(unsigned i, std::unique_ptr<const XTree> t);
+
+    /*
+     *  Moves a cell into new storage (e.g. a parent's block of children).
+     *  Its vertex data and children stay where they are.
+     */
+    XTree(XTree&& other)=default;
 
     /*
      *  Checks whether this tree splits
      */
-    bool isBranch() const { return children[0].get() != nullptr; }
+    bool isBranch() const { return children.get() != nullptr; }
 
     /*
      *  Looks up a child, returning *this if this isn't a branch
      */
     const XTree<N>* child(unsigned i) const
-    { return isBranch() ? children[i].get() : this; }
+    { return isBranch() ? &(*children)[i] : this; }
 
     /*
      *  Returns the filled / empty state for the ith corner
      */
-    Interval::State cornerState(uint8_t i) const { return corners[i]; }
+    Interval::State cornerState(uint8_t i) const
+    { return (corner_mask & (1 << i)) ? Interval::FILLED : Interval::EMPTY; }
 
     /*
      *  Returns the corner position for the ith corner
@@ -87,76 +157,186 @@ public:
      */
     Eigen::Vector3d vert3(unsigned index=0) const;
 
-    /*  The region filled by this XTree */
-    const Region<N> region;
-
-    /*  Children pointers, if this is a branch  */
-    std::array<std::unique_ptr<const XTree<N>>, 1 << N> children;
-
-    /*  level = max(map(level, children)) + 1  */
-    unsigned level=0;
-
-    /*  Vertex locations, if this is a leaf
-     *
-     *  To make cells manifold, we may store multiple vertices in a single
-     *  leaf; see writeup in marching.cpp for details  */
-    Eigen::Matrix<double, N, _pow(2, N - 1)> verts;
-
     /*
      *  Look up a particular vertex by index
      */
     Eigen::Matrix<double, N, 1> vert(unsigned i=0) const
-    { assert(i < vertex_count); return verts.col(i); }
+    { assert(i < vertex_count); return leaf->verts.col(i); }
 
-    /*  Array of filled states for the cell's corners
-     *  (must only be FILLEd / EMPTY, not UNKNOWN or AMBIGUOUS ) */
-    std::array<Interval::State, 1 << N> corners;
+    /*
+     *  Vertices and QEF matrices, which are only allocated for cells that
+     *  have vertices (ambiguous leaves, and branches that may collapse)
+     */
+    struct Leaf
+    {
+        /*  Vertex locations
+         *
+         *  To make cells manifold, we may store multiple vertices in a
+         *  single leaf; see writeup in marching.cpp for details  */
+        Eigen::Matrix<double, N, _pow(2, N - 1)> verts;
+
+        /* Used as a unique per-vertex index when unpacking into a b-rep; *
+         * this is cheaper than storing a map of XTree* -> uint32_t       */
+        std::array<uint32_t, _pow(2, N - 1)> index={{0}};
+
+        /*  Feature rank for the cell's vertex, where                    *
+         *      1 is face, 2 is edge, 3 is corner                        *
+         *                                                               *
+         *  This value is populated in find{Leaf|Branch}Matrices and     *
+         *  used when merging intersections from lower-ranked children   */
+        unsigned rank=0;
+
+        /*  Mass point is the average intersection location *
+         *  (the last coordinate is number of points summed) */
+        Eigen::Matrix<double, N + 1, 1> mass_point=
+            Eigen::Matrix<double, N + 1, 1>::Zero();
+
+        /*  QEF matrices */
+        Eigen::Matrix<double, N, N> AtA=Eigen::Matrix<double, N, N>::Zero();
+        Eigen::Matrix<double, N, 1> AtB=Eigen::Matrix<double, N, 1>::Zero();
+        double BtB=0;
+
+        /*  Boilerplate for an object that contains an Eigen struct  */
+        EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+    };
+
+    /*  A branch's children, which are allocated in a single block  */
+    class Children;
 
-    /*  Leaf cell state, when known  */
-    Interval::State type=Interval::UNKNOWN;
+    /*  The region filled by this XTree */
+    const Region<N> region;
 
-    /*  Feature rank for the cell's vertex, where                    *
-     *      1 is face, 2 is edge, 3 is corner                        *
-     *                                                               *
-     *  This value is populated in find{Leaf|Branch}Matrices and     *
-     *  used when merging intersections from lower-ranked children   */
-    unsigned rank=0;
+    /*  Children, if this is a branch  */
+    std::unique_ptr<Children> children;
 
-    /* Used as a unique per-vertex index when unpacking into a b-rep;   *
-     * this is cheaper than storing a map of XTree* -> uint32_t         */
-    mutable std::array<uint32_t, _pow(2, N - 1)> index;
+    /*  Vertex data, if this cell has any vertices  */
+    std::unique_ptr<Leaf> leaf;
 
-    /*  Bitfield marking which corners are set */
-    uint8_t corner_mask=0;
+    /*  Fingerprint of the pruned tape used to build this cell's contents
+     *  (see Evaluator::tapeHash), checked by rebuild  */
+    uint64_t tape=0;
+
+    /*  level = max(map(level, children)) + 1  */
+    unsigned level=0;
+
+    /*  Leaf cell state, when known  */
+    Interval::State type=Interval::UNKNOWN;
 
     /*  Stores the number of patches / vertices in this cell
      *  (which could be more than one to keep the surface manifold */
     unsigned vertex_count=0;
 
+    /*  Bitfield marking which corners are filled (the rest are empty) */
+    uint8_t corner_mask=0;
+
     /*  Marks whether this cell is manifold or not  */
     bool manifold=false;
 
-    /*  Single copy of the marching squares / cubes table, lazily
-     *  initialized when needed */
-    static std::unique_ptr<const Marching::MarchingTable<N>> mt;
+    /*  Marks whether this cell's filled / empty state was proven by
+     *  interval arithmetic (rather than by sampling corners), in which
+     *  case it holds at any resolution  */
+    bool exact=false;
+
+    /*  Marching squares / cubes table (precomputed at build time)  */
+    static const Marching::MarchingTable<N>* const mt;
 
 protected:
     /*  Helper typedef for N-dimensional column vector */
     typedef Eigen::Matrix<double, N, 1> Vec;
 
+    /*
+     *  Rules for re-using the cells of an earlier tree (see make)
+     */
+    struct Reuse
+    {
+        /*  Mask of variables that have changed (see Evaluator::varMask)  */
+        uint64_t changed;
+
+        /*  Set when refining to a smaller min_feature, in which case only
+         *  cells with exact states are re-used  */
+        bool refine;
+    };
+
     /*
      *  Private constructor for XTree
      *
-     *  If multiple evaluators are provided, then tree construction will
-     *  be distributed across multiple threads.
+     *  eval is the evaluator belonging to the given worker.  If pool is
+     *  non-null, then children may be handed off to other workers as
+     *  separate tasks when some of them are idle.
+     *
+     *  Cells at the minimum feature size are left with type UNKNOWN if
+     *  they're ambiguous, to be finished by finishLeaves.
+     *
+     *  If batch is non-null, then the cell has already been evaluated
+     *  (along with its siblings) by Evaluator::intervals with eval's
+     *  current tape, and batch[box] is its result.
      */
     XTree(Evaluator* eval, Region<N> region,
-          double min_feature, double max_err, bool multithread,
-          std::atomic_bool& cancel);
+          double min_feature, double max_err,
+          WorkPool* pool, unsigned worker,
+          std::atomic_bool& cancel,
+          XTree* prev=nullptr, Reuse reuse={0, false},
+          const Interval::I* batch=nullptr, unsigned box=0);
+
+    /*
+     *  Shared by build, rebuild, and refine
+     */
+    static std::unique_ptr<const XTree> build(
+            const std::vector<Evaluator*>& es,
+            Region<N> region, double min_feature,
+            double max_err, std::atomic_bool& cancel,
+            std::unique_ptr<const XTree> prev, Reuse reuse);
+
+    /*
+     *  Constructs a cell in the (uninitialized) storage at out, returning
+     *  a pointer to it.
+     *
+     *  If prev (the same cell from an earlier build) can be re-used as-is,
+     *  then it's moved into out.  When refining, this is true if its state
+     *  is exact; otherwise, it's true if its region still prunes to the
+     *  same tape and that tape doesn't read a changed variable.
+     *
+     *  If prev can't be re-used, builds a new cell, handing prev's children
+     *  down for re-use.  Either way, prev is left to its owner to release.
+     *
+     *  batch and box are as in the constructor.
+     */
+    static XTree* make(void* out,
+            Evaluator* eval, Region<N> region,
+            double min_feature, double max_err,
+            WorkPool* pool, unsigned worker,
+            std::atomic_bool& cancel,
+            XTree* prev, Reuse reuse,
+            const Interval::I* batch=nullptr, unsigned box=0);
+
+    /*
+     *  Finishes leaves that were left with type UNKNOWN by the constructor,
+     *  sampling their corners, then searching their edges for intersections
+     *  and positioning their vertices.
+     *
+     *  Points from every leaf are packed into shared evaluator calls, so
+     *  eval's current tape must be valid over all of their regions (e.g.
+     *  the tape pushed by their parent, which was pruned over a region that
+     *  contains them).  Branches that the leaves' own tapes would prune
+     *  are never selected at their points, so the results are the same.
+     */
+    static void finishLeaves(Evaluator* eval,
+                             const std::vector<XTree*>& leaves);
+
+    /*
+     *  Clears vertex indices in this cell and its children, so that a
+     *  re-used subtree can be meshed again
+     */
+    void resetIndices();
+
+    /*
+     *  Constructs an ambiguous branch with no children (used in branch)
+     */
+    explicit XTree(Region<N> region);
 
     /*
      *  Searches for a vertex within the XTree cell, using the QEF matrices
-     *  that are pre-populated in AtA, AtB, etc.
+     *  that are pre-populated in leaf->AtA, leaf->AtB, etc.
      *
      *  Minimizes the QEF towards mass_point
      *
@@ -191,20 +371,58 @@ protected:
      */
     bool leafsAreManifold() const;
 
-    /*  Mass point is the average intersection location *
-     *  (the last coordinate is number of points summed) */
-    Eigen::Matrix<double, N + 1, 1> _mass_point=
-        Eigen::Matrix<double, N + 1, 1>::Zero();
-
-    /*  QEF matrices */
-    Eigen::Matrix<double, N, N> AtA=Eigen::Matrix<double, N, N>::Zero();
-    Eigen::Matrix<double, N, 1> AtB=Eigen::Matrix<double, N, 1>::Zero();
-    double BtB=0;
-
     /*  Eigenvalue threshold for determining feature rank  */
     constexpr static double EIGENVALUE_CUTOFF=0.1f;
 };
 
+template <unsigned N>
+class XTree<N>::Children
+{
+public:
+    Children() : built(0) {}
+
+    ~Children()
+    {
+        for (unsigned i=0; i < size(); ++i)
+        {
+            if (built & (1 << i))
+            {
+                (*this)[i].~XTree();
+            }
+        }
+    }
+
+    static constexpr unsigned size() { return 1 << N; }
+
+    XTree<N>& operator[](unsigned i)
+    { return *static_cast<XTree<N>*>(slot(i)); }
+    const XTree<N>& operator[](unsigned i) const
+    { return *reinterpret_cast<const XTree<N>*>(data + i * sizeof(XTree)); }
+
+    /*  Iteration is only valid once every child is built  */
+    const XTree<N>* begin() const { return &(*this)[0]; }
+    const XTree<N>* end() const { return begin() + size(); }
+
+    /*
+     *  Returns uninitialized storage for the ith child, which the caller
+     *  must construct and then mark as built
+     */
+    void* slot(unsigned i) { return data + i * sizeof(XTree); }
+
+    /*
+     *  Marks the ith child as built, so that it's destroyed with the block
+     *  (children may be built by different threads)
+     */
+    void markBuilt(unsigned i) { built |= 1 << i; }
+
+    /*  Boilerplate for an object that contains an Eigen struct  */
+    EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+
+protected:
+    alignas(XTree) unsigned char data[sizeof(XTree) * (1 << N)];
+    std::atomic<uint8_t> built;
+};
+
 // Explicit template instantiation declarations
 template <> bool XTree<2>::cornersAreManifold() const;
 template <> bool XTree<3>::cornersAreManifold() const;
@@ -215,6 +433,9 @@ template <> bool XTree<3>::leafsAreManifold() const;
 template <> const std::vector<std::pair<uint8_t, uint8_t>>& XTree<2>::edges() const;
 template <> const std::vector<std::pair<uint8_t, uint8_t>>& XTree<3>::edges() const;
 
+template <> const Marching::MarchingTable<2>* const XTree<2>::mt;
+template <> const Marching::MarchingTable<3>* const XTree<3>::mt;
+
 extern template class XTree<2>;
 extern template class XTree<3>;
 
@@ -18,13 +18,18 @@ public:
      *  Render a height-map image into an array of floats (representing depth)
      *  and the height-map's normals into a shaded image with R, G, B, A packed
      *  into int32_t pixels.
+     *
+     *  range picks the arithmetic used to prune empty and filled regions
+     *  (see Evaluator::RangeMode).
      */
     static std::unique_ptr<Heightmap> render(
             const Tree t, Voxels r,
-            const std::atomic_bool& abort, size_t threads=8);
+            const std::atomic_bool& abort, size_t threads=8,
+            Evaluator::RangeMode range=Evaluator::INTERVAL);
 
     /*
      *  Render an image using pre-allocated evaluators
+     *  (and their range modes)
      */
     static std::unique_ptr<Heightmap> render(
             const std::vector<Evaluator*>& es, Voxels r,
@@ -45,9 +50,14 @@ protected:
     /*
      *  Recurses down into a rendering operation
      *  Returns true if aborted, false otherwise
+     *
+     *  If batch is non-null, then r has already been evaluated by
+     *  Evaluator::intervals (with e's current tape), and batch[box]
+     *  is its result.
      */
     bool recurse(Evaluator* e, const Voxels::View& r,
-                 const std::atomic_bool& abort);
+                 const std::atomic_bool& abort,
+                 const Interval::I* batch=nullptr, unsigned box=0);
 
     /*
      *  Evaluates a set of voxels on a pixel-by-pixel basis
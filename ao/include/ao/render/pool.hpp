@@ -0,0 +1,128 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <vector>
+
+#include "ao/eval/evaluator.hpp"
+
+namespace Kernel {
+
+/*
+ *  A WorkPool is a small work-stealing scheduler for recursive rendering.
+ *
+ *  Each worker owns one Evaluator (and therefore one tape stack) plus a
+ *  deque of tasks.  Workers push and pop tasks at the back of their own
+ *  deque and steal from the front of other workers' deques, so stolen
+ *  work tends to be the largest (oldest) outstanding subtree.
+ *
+ *  Tasks are fork-join: a task that spawns children must wait for them
+ *  (with wait), running other queued work in the meantime.
+ *
+ *  Workers that can't find anything to do spin briefly, then sleep until
+ *  a task is spawned or finished.
+ */
+class WorkPool
+{
+public:
+    /*  A task is called with the index of the worker that is running it */
+    typedef std::function<void(unsigned)> Task;
+
+    /*
+     *  Constructs a pool with one worker per evaluator
+     *  (the evaluators must outlive the pool)
+     */
+    WorkPool(const std::vector<Evaluator*>& es);
+
+    /*
+     *  Runs the given task on worker 0 (in the calling thread), with the
+     *  other workers running in separate threads.  Blocks until the task
+     *  returns, which means that everything it spawned has finished.
+     */
+    void run(Task t);
+
+    /*
+     *  Queues a task on the given worker's deque
+     */
+    void spawn(unsigned worker, Task t);
+
+    /*
+     *  Runs queued (or stolen) tasks on the given worker until pending
+     *  reaches zero.
+     */
+    void wait(unsigned worker, const std::atomic_uint& pending);
+
+    /*
+     *  Returns true if any worker is looking for work, i.e. if spawning
+     *  a new task would be useful rather than just overhead.
+     */
+    bool hungry() const { return idle.load() > 0; }
+
+    /*
+     *  Returns the evaluator associated with a particular worker
+     */
+    Evaluator* eval(unsigned worker) const { return es[worker]; }
+
+    /*
+     *  Returns the number of workers in the pool
+     */
+    unsigned size() const { return es.size(); }
+
+protected:
+    /*
+     *  Pops a task from this worker's deque or steals one from another
+     *  worker, then runs it.  Returns false if no task was found.
+     */
+    bool runOne(unsigned worker);
+
+    /*
+     *  Marks a worker as idle or busy (used to compute hungry)
+     */
+    void setIdle(unsigned worker, bool i);
+
+    /*
+     *  Called each time that runOne fails to find a task.  Yields for the
+     *  first few misses in a row, then sleeps until a task is queued or
+     *  finished, or until ready returns true.
+     */
+    template <typename F>
+    void rest(unsigned& misses, F ready);
+
+    /*
+     *  Wakes sleeping workers after the pool's state has changed
+     */
+    void wake();
+
+    /*  Per-worker state (idle is only touched by the worker's own thread) */
+    struct Worker
+    {
+        std::mutex lock;
+        std::deque<Task> tasks;
+        bool idle=false;
+    };
+
+    const std::vector<Evaluator*> es;
+    std::vector<Worker> workers;
+
+    /*  Number of workers that are currently looking for work  */
+    std::atomic_uint idle;
+
+    /*  Set when the root task has finished  */
+    std::atomic_bool done;
+
+    /*  Number of tasks waiting in the deques  */
+    std::atomic_uint queued;
+
+    /*  Idle workers sleep on this condition variable (see rest)  */
+    std::mutex sleep_lock;
+    std::condition_variable sleep_cond;
+    std::atomic_uint sleeping;
+
+    /*  Number of misses in a row before an idle worker goes to sleep  */
+    static constexpr unsigned SPIN_LIMIT = 64;
+};
+
+}   // namespace Kernel
@@ -0,0 +1,77 @@
+#pragma once
+
+#include <cassert>
+#include <cstddef>
+
+namespace Kernel {
+
+/*
+ *  The Arena is a thread-safe store of fixed-size blocks, used for Tree
+ *  nodes (and their reference counts).
+ *
+ *  Blocks are carved out of large contiguous chunks, so nodes that are
+ *  built together are stored together, and allocation is usually a pop
+ *  from a thread-local free list.  Chunks are never returned to the system;
+ *  released blocks are recycled by later allocations (on any thread, since
+ *  each thread's free list is capped and the excess is shared).
+ */
+namespace Arena
+{
+/*  Every block is this many bytes, aligned to a cache line  */
+static const size_t BLOCK_SIZE = 64;
+
+/*
+ *  Returns a block of BLOCK_SIZE bytes
+ */
+void* alloc();
+
+/*
+ *  Returns a block to the arena (it may be released by any thread)
+ */
+void release(void* ptr);
+
+/*
+ *  Returns the number of blocks that have been carved from chunks so far
+ *  (whether in use or on a free list)
+ */
+size_t reserved();
+}   // namespace Arena
+
+/*
+ *  Minimal allocator backed by the Arena, for use with std::allocate_shared
+ *  (which puts the node and its reference counts in the same block)
+ */
+template <typename T>
+class ArenaAllocator
+{
+public:
+    typedef T value_type;
+
+    ArenaAllocator() {}
+    template <typename U>
+    ArenaAllocator(const ArenaAllocator<U>&) {}
+
+    T* allocate(size_t n)
+    {
+        static_assert(sizeof(T) <= Arena::BLOCK_SIZE,
+                      "Type is too large for an Arena block");
+        assert(n == 1);
+        (void)n;
+        return static_cast<T*>(Arena::alloc());
+    }
+
+    void deallocate(T* ptr, size_t)
+    {
+        Arena::release(ptr);
+    }
+};
+
+template <typename T, typename U>
+bool operator==(const ArenaAllocator<T>&, const ArenaAllocator<U>&)
+{ return true; }
+
+template <typename T, typename U>
+bool operator!=(const ArenaAllocator<T>&, const ArenaAllocator<U>&)
+{ return false; }
+
+}   // namespace Kernel
@@ -1,8 +1,9 @@
 #pragma once
 
-#include <map>
+#include <array>
 #include <memory>
 #include <mutex>
+#include <unordered_map>
 
 #include "ao/tree/tree.hpp"
 
@@ -10,25 +11,25 @@ namespace Kernel {
 
 /*
  *  A Cache stores values in a deduplicated math expression
+ *
+ *  The cache is split into shards, each with its own lock, so that trees
+ *  can be built (and destroyed) from many threads at once.
  */
 class Cache
 {
     /*  Helper typedef to avoid writing this over and over again  */
     typedef std::shared_ptr<Tree::Tree_> Node;
 
-    /*  Handle to safely access cache  */
+    /*  Handle to access the cache (which does its own locking)  */
     class Handle
     {
     public:
-        Handle() : lock(mut) {}
         Cache* operator->() const { return &_instance; }
-    protected:
-        std::unique_lock<std::recursive_mutex> lock;
     };
 
 public:
     /*
-     *  Returns a safe (locking) handle to the global Cache
+     *  Returns a handle to the global Cache
      */
     static Handle instance() { return Handle(); }
 
@@ -43,10 +44,10 @@ public:
     Node var();
 
     /*
-     *  Called when the last Tree_ is destroyed
+     *  Called when the last reference to a Tree_ is dropped, to remove
+     *  that Tree_ from the cache
      */
-    void del(float v);
-    void del(Opcode::Opcode op, Node lhs=nullptr, Node rhs=nullptr);
+    void del(Tree::Id t);
 
 protected:
     /*
@@ -74,12 +75,43 @@ protected:
     typedef std::tuple<Opcode::Opcode,  /* opcode */
                        Tree::Id,        /* lhs */
                        Tree::Id         /* rhs */ > Key;
-    std::map<Key, std::weak_ptr<Tree::Tree_>> ops;
+    struct KeyHash
+    {
+        size_t operator()(const Key& k) const;
+    };
+
+    /*
+     *  Each entry stores its node's address as well as a weak pointer.
+     *
+     *  A weak pointer expires before the node's destructor gets a chance to
+     *  call del, and another thread may replace the entry in the meantime;
+     *  comparing addresses means that del only erases its own entry.
+     */
+    struct Entry
+    {
+        Tree::Id raw;
+        std::weak_ptr<Tree::Tree_> ptr;
+    };
+
+    struct Shard
+    {
+        std::mutex mut;
+        std::unordered_map<Key, Entry, KeyHash> ops;
+
+        /*  Constants are uniquely identified by their value's bit pattern
+         *  (so that NaN and -0 are handled properly) */
+        std::unordered_map<uint32_t, Entry> constants;
+    };
+
+    /*
+     *  Returns the shard that stores a particular key
+     */
+    Shard& shard(const Key& k);
+    Shard& shard(uint32_t bits);
 
-    /*  Constants in the tree are uniquely identified by their value  */
-    std::map<float, std::weak_ptr<Tree::Tree_>> constants;
+    static const size_t SHARDS = 64;
+    std::array<Shard, SHARDS> shards;
 
-    static std::recursive_mutex mut;
     static Cache _instance;
 };
 
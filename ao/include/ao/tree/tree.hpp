@@ -60,10 +60,18 @@ public:
         FLAG_LOCATION_AGNOSTIC  = (1<<1),
     };
 
-    /*  This is where tree data is actually stored  */
+    /*  This is where tree data is actually stored
+     *  (nodes are allocated from the Arena by the Cache)  */
     struct Tree_ {
+        Tree_(Opcode::Opcode op, uint8_t flags, unsigned rank, float value,
+              std::shared_ptr<Tree_> lhs, std::shared_ptr<Tree_> rhs)
+            : op(op), flags(flags), rank(rank), value(value),
+              lhs(std::move(lhs)), rhs(std::move(rhs)) {}
+
         /*
-         *  Destructor erases this Tree from the global Cache
+         *  Destructor erases this Tree from the global Cache, then
+         *  releases its children iteratively (so that deep trees can't
+         *  overflow the stack)
          */
         ~Tree_();
 
@@ -122,10 +130,11 @@ public:
     Tree remap(std::map<Id, std::shared_ptr<Tree_>> m) const;
 
     /*
-     *  Walks the tree in rank order, from lowest to highest
-     *  The last item in the list will be the tree this is called on
+     *  Flattens the tree into rank order, from lowest to highest,
+     *  with each unique node appearing once (in O(n) time)
+     *  The last item in the vector will be the tree this is called on
      */
-    std::list<Tree> ordered() const;
+    std::vector<Tree> ordered() const;
 
     /*
      *  Serializes to a vector of bytes
@@ -8,6 +8,7 @@
 #include "ao/tree/template.hpp"
 
 #include "ao/render/brep/region.hpp"
+#include "ao/render/brep/xtree.hpp"
 #include "ao/render/brep/contours.hpp"
 #include "ao/render/brep/mesh.hpp"
 
@@ -220,7 +221,7 @@ bool ao_tree_save_mesh(ao_tree tree, ao_region3 R, float res, const char* f)
     Region<3> region({R.X.lower, R.Y.lower, R.Z.lower},
                      {R.X.upper, R.Y.upper, R.Z.upper});
     auto ms = Mesh::render(*tree, region, 1/res);
-    return ms->saveSTL(f);
+    return ms->save(f);
 }
 
 ao_pixels* ao_tree_render_pixels(ao_tree tree, ao_region2 R,
@@ -229,7 +230,13 @@ ao_pixels* ao_tree_render_pixels(ao_tree tree, ao_region2 R,
     Voxels v({R.X.lower, R.Y.lower, z},
              {R.X.upper, R.Y.upper, z}, res);
     std::atomic_bool abort(false);
-    auto h = Heightmap::render(*tree, v, abort);
+
+    // Every sample is at the same Z, so fold it into the tree (which
+    // turns clauses that only depend on Z into constants)
+    Region<2> region({R.X.lower, R.Y.lower}, {R.X.upper, R.Y.upper},
+            Region<2>::Perp(v.pts[2].front()));
+    auto t = XTree<2>::specialize(*tree, region);
+    auto h = Heightmap::render(t, v, abort);
 
     ao_pixels* out = new ao_pixels;
     out->width = h->depth.cols();
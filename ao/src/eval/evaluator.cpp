@@ -2,27 +2,57 @@
 #include <numeric>
 #include <memory>
 #include <cmath>
+#include <limits>
 
 #include "ao/tree/cache.hpp"
 #include "ao/tree/tree.hpp"
 #include "ao/eval/evaluator.hpp"
 #include "ao/eval/clause.hpp"
+#include "ao/eval/simd.hpp"
 
 namespace Kernel {
 
+/*
+ *  FNV-1a style mixing, used to fingerprint tapes
+ */
+static inline uint64_t mixHash(uint64_t h, uint64_t v)
+{
+    return (h ^ v) * 0x100000001b3ULL;
+}
+
+/*
+ *  Copies a list of clauses, re-using the target's storage
+ *  (clauses can't be assigned, because their members are const)
+ */
+static void copyClauses(const std::vector<Clause>& from,
+                        std::vector<Clause>& to)
+{
+    to.clear();
+    to.reserve(from.size());
+    for (const auto& c : from)
+    {
+        to.push_back(c);
+    }
+}
+
 ////////////////////////////////////////////////////////////////////////////////
 
 Evaluator::Evaluator(const Tree root, const std::map<Tree::Id, float>& vs)
     : root_op(root->op)
 {
+    auto prog = new Program;
+    program.reset(prog);
+
     auto flat = root.ordered();
 
     // Helper function to create a new clause in the data array
     // The dummy clause (0) is mapped to the first result slot
     std::unordered_map<Tree::Id, Clause::Id> clauses = {{nullptr, 0}};
+    clauses.reserve(flat.size() + 4);
     Clause::Id id = flat.size();
 
     // Helper function to make a new function
+    // (slots are assigned below, once the whole tape is known)
     std::list<Clause> tape_;
     auto newClause = [&clauses, &id, &tape_](const Tree::Id t)
     {
@@ -30,11 +60,13 @@ Evaluator::Evaluator(const Tree root, const std::map<Tree::Id, float>& vs)
                 {t->op,
                  id,
                  clauses.at(t->lhs.get()),
-                 clauses.at(t->rhs.get())});
+                 clauses.at(t->rhs.get()),
+                 0, 0, 0});
     };
 
     // Write the flattened tree into the tape!
     std::map<Clause::Id, float> constants;
+    std::map<Clause::Id, Tree::Id> var_ids;
     for (const auto& m : flat)
     {
         // Normal clauses end up in the tape
@@ -61,8 +93,8 @@ Evaluator::Evaluator(const Tree root, const std::map<Tree::Id, float>& vs)
             {
                 constants[id] = v->second;
             }
-            vars.left.insert({id, m.id()});
-            var_handles.insert({m.id(), m});
+            var_ids[id] = m.id();
+            prog->var_handles.insert({m.id(), m});
         }
         else
         {
@@ -74,14 +106,6 @@ Evaluator::Evaluator(const Tree root, const std::map<Tree::Id, float>& vs)
     }
     assert(id == 0);
 
-    //  Move from the list tape to a more-compact vector tape
-    tapes.push_back(Tape());
-    tape = tapes.begin();
-    for (auto& t : tape_)
-    {
-        tape->t.push_back(t);
-    }
-
     // Make sure that X, Y, Z have been allocated space
     std::vector<Tree> axes = {Tree::X(), Tree::Y(), Tree::Z()};
     for (auto a : axes)
@@ -92,38 +116,177 @@ Evaluator::Evaluator(const Tree root, const std::map<Tree::Id, float>& vs)
         }
     }
 
+    // Store the index of the tree's root
+    assert(clauses.at(root.id()) == 1);
+    const Clause::Id root_id = clauses.at(root.id());
+
+    // Pick result slots for every clause, then move from the list tape
+    // to a more-compact vector tape (with slots filled in)
+    auto& slots = prog->slots;
+    prog->num_slots = allocateSlots(tape_, root_id, clauses.size() + 1,
+                                    slots);
+    prog->t.reserve(tape_.size());
+    for (auto& t : tape_)
+    {
+        prog->t.push_back({t.op, t.id, t.a, t.b,
+                           slots[t.id], slots[t.a], slots[t.b]});
+    }
+    prog->i = root_id;
+
+    // Store all constants and variables by slot
+    for (auto c : constants)
+    {
+        prog->constants[slots[c.first]] = c.second;
+    }
+
+    // Save X, Y, Z slots
+    prog->X = slots[clauses.at(axes[0].id())];
+    prog->Y = slots[clauses.at(axes[1].id())];
+    prog->Z = slots[clauses.at(axes[2].id())];
+
+    // Record where each variable lives in the result array
+    for (auto v : var_ids)
+    {
+        prog->vars.left.insert({slots[v.first], v.second});
+    }
+
+    // Give each variable a bit, used to track which tapes read it
+    prog->var_bits.assign(prog->num_slots, 0);
+    {
+        unsigned k = 0;
+        for (auto v : prog->vars.left)
+        {
+            prog->var_bits[v.first] = 1ULL << (k++ % 64);
+        }
+    }
+
+    init();
+}
+
+Evaluator::Evaluator(const Evaluator& other)
+    : program(other.program), root_op(other.root_op),
+      range_mode(other.range_mode), tape_cache_size(other.tape_cache_size)
+{
+    init();
+
+    // Pick up any changes to variables made with setVar
+    for (auto v : program->vars.left)
+    {
+        result->setValue(other.result->f(v.first, 0), v.first);
+    }
+}
+
+void Evaluator::init()
+{
     // Allocate enough memory for all the clauses
-    result.reset(new Result(clauses.size() + 1, vars.size()));
-    disabled.resize(clauses.size() + 1);
-    remap.resize(clauses.size() + 1);
+    result.reset(new Result(program->num_slots));
+    disabled.resize(program->slots.size());
+    remap.resize(program->slots.size());
 
     // Store all constants in results array
-    for (auto c : constants)
+    for (auto c : program->constants)
     {
         result->fill(c.second, c.first);
     }
 
-    // Save X, Y, Z ids
-    X = clauses.at(axes[0].id());
-    Y = clauses.at(axes[1].id());
-    Z = clauses.at(axes[2].id());
-
     // Set derivatives for X, Y, Z (unchanging)
+    X = program->X;
+    Y = program->Y;
+    Z = program->Z;
     result->setDeriv(Eigen::Vector3f::UnitX(), X);
     result->setDeriv(Eigen::Vector3f::UnitY(), Y);
     result->setDeriv(Eigen::Vector3f::UnitZ(), Z);
 
-    {   // Set the Jacobian for our variables (unchanging)
-        size_t index = 0;
-        for (auto v : vars.left)
+    // Copy the base tape, then compile it against our own result arrays
+    tapes.push_back(Tape());
+    tape = tapes.begin();
+    tape->t.reserve(program->t.size());
+    for (const auto& c : program->t)
+    {
+        tape->t.push_back(c);
+    }
+    tape->i = program->i;
+    tape->type = Tape::UNKNOWN;
+    compile(*tape);
+}
+
+Clause::Id Evaluator::allocateSlots(const std::list<Clause>& t,
+                                    Clause::Id root, Clause::Id count,
+                                    std::vector<Clause::Id>& slots)
+{
+    // Find the last step (in evaluation order) that reads each clause.
+    //
+    // Arguments to MIN and MAX are kept alive forever, because push,
+    // specialize, and feature-finding compare them after evaluation, and a
+    // pruned tape may read them in place of the MIN / MAX clause itself.
+    const unsigned FOREVER = std::numeric_limits<unsigned>::max();
+    std::vector<unsigned> last_use(count, FOREVER);
+    for (const auto& c : t)
+    {
+        last_use[c.id] = 0;
+    }
+    {
+        unsigned step = 0;
+        for (auto itr = t.rbegin(); itr != t.rend(); ++itr, ++step)
+        {
+            const bool keep = itr->op == Opcode::MIN ||
+                              itr->op == Opcode::MAX;
+            for (auto arg : {itr->a, itr->b})
+            {
+                if (last_use[arg] != FOREVER)
+                {
+                    last_use[arg] = keep ? FOREVER : step;
+                }
+            }
+        }
+    }
+    last_use[root] = FOREVER;
+
+    // Long-lived ids (constants, variables, axes, the dummy clause, and
+    // anything marked above) get a permanent slot of their own.  These
+    // can't share with short-lived clauses, since a pruned tape may skip
+    // the long-lived clause but still evaluate the short-lived one.
+    slots.assign(count, 0);
+    Clause::Id num_slots = 0;
+    for (Clause::Id i=0; i < count; ++i)
+    {
+        if (last_use[i] == FOREVER)
         {
-            result->setGradient(v.first, index++);
+            slots[i] = num_slots++;
         }
     }
 
-    // Store the index of the tree's root
-    assert(clauses.at(root.id()) == 1);
-    tape->i = clauses.at(root.id());
+    // Then, walk the tape in evaluation order, assigning an output slot
+    // to each short-lived clause and releasing its arguments' slots
+    // afterwards (so that a clause never writes into its own argument)
+    std::vector<Clause::Id> free;
+    unsigned step = 0;
+    for (auto itr = t.rbegin(); itr != t.rend(); ++itr, ++step)
+    {
+        if (last_use[itr->id] != FOREVER)
+        {
+            if (free.size())
+            {
+                slots[itr->id] = free.back();
+                free.pop_back();
+            }
+            else
+            {
+                slots[itr->id] = num_slots++;
+            }
+        }
+
+        if (last_use[itr->a] == step)
+        {
+            free.push_back(slots[itr->a]);
+        }
+        if (itr->b != itr->a && last_use[itr->b] == step)
+        {
+            free.push_back(slots[itr->b]);
+        }
+    }
+
+    return num_slots;
 }
 
 ////////////////////////////////////////////////////////////////////////////////
@@ -175,10 +338,8 @@ void Evaluator::set(const Eigen::Vector3f& lower, const Eigen::Vector3f& upper)
 
 ////////////////////////////////////////////////////////////////////////////////
 
-void Evaluator::pushTape(Tape::Type t)
+void Evaluator::nextTape()
 {
-    auto prev_tape = tape;
-
     // Add another tape to the top of the tape stack if one doesn't already
     // exist (we never erase them, to avoid re-allocating memory during
     // nested evaluations).
@@ -186,6 +347,7 @@ void Evaluator::pushTape(Tape::Type t)
     {
         tape = tapes.insert(tape, Tape());
         tape->t.reserve(tapes.front().t.size());
+        tape->p.reserve(tapes.front().t.size());
     }
     else
     {
@@ -193,6 +355,11 @@ void Evaluator::pushTape(Tape::Type t)
         // (preserving allocated storage)
         tape->t.clear();
     }
+}
+
+void Evaluator::pushTape(Tape::Type t, std::list<Tape>::iterator prev_tape)
+{
+    nextTape();
 
     assert(tape != tapes.end());
     assert(tape != tapes.begin());
@@ -209,59 +376,127 @@ void Evaluator::pushTape(Tape::Type t)
             Clause::Id ra, rb;
             for (ra = c.a; remap[ra]; ra = remap[ra]);
             for (rb = c.b; remap[rb]; rb = remap[rb]);
-            tape->t.push_back({c.op, c.id, ra, rb});
+            tape->t.push_back({c.op, c.id, ra, rb, c.slot,
+                               program->slots[ra], program->slots[rb]});
         }
     }
 
     // Remap the tape root index
     for (tape->i = prev_tape->i; remap[tape->i]; tape->i = remap[tape->i]);
 
+    compile(*tape);
+
     // Make sure that the tape got shorter
     assert(tape->t.size() <= prev_tape->t.size());
 }
 
 void Evaluator::push()
 {
-    // Since we'll be figuring out which clauses are disabled and
-    // which should be remapped, we reset those arrays here
-    std::fill(disabled.begin(), disabled.end(), true);
-    std::fill(remap.begin(), remap.end(), 0);
+    pushInterval(tape);
+}
+
+void Evaluator::push(Result::Index index)
+{
+    pushInterval(tape, index);
+}
+
+Interval::I Evaluator::pushBase(const Eigen::Vector3f& lower,
+                                const Eigen::Vector3f& upper)
+{
+    // Evaluate the region with the base tape, then restore the current
+    // tape so that the pruned tape lands above it in the stack
+    auto prev_tape = tape;
+    tape = tapes.begin();
+    auto out = eval(lower, upper);
+    tape = prev_tape;
+
+    pushInterval(tapes.begin());
+    return out;
+}
+
+void Evaluator::resetMarks(std::list<Tape>::iterator src)
+{
+    // Pushing only reads entries for clauses in the source tape, their
+    // arguments (which are either in the tape too or are leaves, which
+    // are never remapped), and the root, so there's no need to reset
+    // entries for clauses that have already been pruned away.
+    for (const auto& c : src->t)
+    {
+        disabled[c.id] = true;
+        remap[c.id] = 0;
+    }
 
     // Mark the root node as active
-    disabled[tape->i] = false;
+    disabled[src->i] = false;
+}
 
-    for (const auto& c : tape->t)
+Evaluator::Choice Evaluator::choose(Opcode::Opcode op,
+                                   float a_lower, float a_upper,
+                                   float b_lower, float b_upper)
+{
+    // For min and max operations, we may only need to keep one branch
+    // active if it is decisively above or below the other branch.
+    if (a_lower > b_upper)
     {
-        if (!disabled[c.id])
+        return (op == Opcode::MAX) ? KEEP_A : KEEP_B;
+    }
+    else if (b_lower > a_upper)
+    {
+        return (op == Opcode::MAX) ? KEEP_B : KEEP_A;
+    }
+    return KEEP_BOTH;
+}
+
+template <typename F>
+void Evaluator::pushChoices(std::list<Tape>::iterator src, F choice)
+{
+    // The pruned tape only depends on the source tape and on the choices
+    // made by its min / max clauses, so those make the cache key (and
+    // finding them is cheap, since it doesn't touch the other clauses)
+    decisions.clear();
+    uint64_t key = src->hash;
+    for (auto j : src->branches)
+    {
+        const auto d = choice(src->t[j], j);
+        decisions.push_back(d);
+        key = mixHash(key, d);
+    }
+
+    if (tape_cache_size && pushCached(src, key))
+    {
+        cache_stats.hits++;
+        return;
+    }
+
+    // Since we'll be figuring out which clauses are disabled and
+    // which should be remapped, we reset those arrays here
+    resetMarks(src);
+
+    auto d = decisions.begin();
+    for (const auto& c : src->t)
+    {
+        if (c.op == Opcode::MAX || c.op == Opcode::MIN)
         {
-            // For min and max operations, we may only need to keep one branch
-            // active if it is decisively above or below the other branch.
-            if (c.op == Opcode::MAX)
-            {
-                if (result->i[c.a].lower() > result->i[c.b].upper())
-                {
-                    disabled[c.a] = false;
-                    remap[c.id] = c.a;
-                }
-                else if (result->i[c.b].lower() > result->i[c.a].upper())
-                {
-                    disabled[c.b] = false;
-                    remap[c.id] = c.b;
-                }
-            }
-            else if (c.op == Opcode::MIN)
+            if (!disabled[c.id])
             {
-                if (result->i[c.a].lower() > result->i[c.b].upper())
-                {
-                    disabled[c.b] = false;
-                    remap[c.id] = c.b;
-                }
-                else if (result->i[c.b].lower() > result->i[c.a].upper())
+                switch (*d)
                 {
-                    disabled[c.a] = false;
-                    remap[c.id] = c.a;
+                    case KEEP_A:
+                        disabled[c.a] = false;
+                        remap[c.id] = c.a;
+                        break;
+                    case KEEP_B:
+                        disabled[c.b] = false;
+                        remap[c.id] = c.b;
+                        break;
+                    case KEEP_BOTH:
+                        break;
                 }
             }
+            ++d;
+        }
+        if (!disabled[c.id])
+        {
             if (!remap[c.id])
             {
                 disabled[c.a] = false;
@@ -274,21 +509,128 @@ void Evaluator::push()
         }
     }
 
-    pushTape(Tape::INTERVAL);
+    pushTape(Tape::INTERVAL, src);
+    if (tape_cache_size)
+    {
+        // Most pruned tapes are never seen again, so a tape is only copied
+        // into the cache the second time that its key comes up
+        auto& seen = tape_seen[key % tape_seen.size()];
+        if (seen == key)
+        {
+            storeCached(src, key);
+        }
+        seen = key;
+        cache_stats.misses++;
+    }
+}
+
+bool Evaluator::pushCached(std::list<Tape>::iterator src, uint64_t key)
+{
+    auto found = tape_index.find(key);
+    if (found == tape_index.end())
+    {
+        return false;
+    }
+
+    // Guard against collisions by checking the full key
+    auto entry = found->second;
+    if (entry->src != src->hash || entry->choices != decisions)
+    {
+        return false;
+    }
+    tape_cache.splice(tape_cache.begin(), tape_cache, entry);
+
+    // Copying reuses the storage of the tape on the stack, and the
+    // compiled steps point into our own result arrays, so they're valid
+    nextTape();
+    copyClauses(entry->tape.t, tape->t);
+    tape->p = entry->tape.p;
+    tape->i = entry->tape.i;
+    tape->hash = entry->tape.hash;
+    tape->vars = entry->tape.vars;
+    tape->branches = entry->tape.branches;
+    tape->type = Tape::INTERVAL;
+    return true;
+}
+
+void Evaluator::storeCached(std::list<Tape>::iterator src, uint64_t key)
+{
+    // Re-use the least recently used entry (and its storage) if the
+    // cache is full, or if it already holds a colliding tape
+    auto found = tape_index.find(key);
+    std::list<CachedTape>::iterator entry;
+    if (found != tape_index.end())
+    {
+        entry = found->second;
+        tape_cache.splice(tape_cache.begin(), tape_cache, entry);
+    }
+    else if (tape_cache.size() >= tape_cache_size)
+    {
+        entry = std::prev(tape_cache.end());
+        tape_index.erase(entry->key);
+        tape_cache.splice(tape_cache.begin(), tape_cache, entry);
+    }
+    else
+    {
+        entry = tape_cache.insert(tape_cache.begin(), CachedTape());
+    }
+
+    entry->key = key;
+    entry->src = src->hash;
+    entry->choices = decisions;
+    copyClauses(tape->t, entry->tape.t);
+    entry->tape.p = tape->p;
+    entry->tape.i = tape->i;
+    entry->tape.hash = tape->hash;
+    entry->tape.vars = tape->vars;
+    entry->tape.branches = tape->branches;
+    tape_index[key] = entry;
+}
+
+void Evaluator::setTapeCacheSize(size_t size)
+{
+    tape_cache_size = size;
+    while (tape_cache.size() > size)
+    {
+        tape_index.erase(tape_cache.back().key);
+        tape_cache.pop_back();
+    }
+}
+
+void Evaluator::pushInterval(std::list<Tape>::iterator src)
+{
+    pushChoices(src, [&](const Clause& c, size_t)
+        {
+            return choose(c.op,
+                result->i[c.slot_a].lower(), result->i[c.slot_a].upper(),
+                result->i[c.slot_b].lower(), result->i[c.slot_b].upper());
+        });
+
     tape->X = result->i[X];
     tape->Y = result->i[Y];
     tape->Z = result->i[Z];
 }
 
+void Evaluator::pushInterval(std::list<Tape>::iterator src,
+                             Result::Index box)
+{
+    assert(box < src->results.size());
+    const uint8_t* choices = &src->choices[box];
+    const auto count = src->results.size();
+    pushChoices(src, [&](const Clause&, size_t j)
+        { return static_cast<Choice>(choices[j * count]); });
+
+    const auto& r = src->regions[box];
+    tape->X = r[0];
+    tape->Y = r[1];
+    tape->Z = r[2];
+}
+
 Feature Evaluator::push(const Feature& f)
 {
     // Since we'll be figuring out which clauses are disabled and
     // which should be remapped, we reset those arrays here
-    std::fill(disabled.begin(), disabled.end(), true);
-    std::fill(remap.begin(), remap.end(), 0);
-
-    // Mark the root node as active
-    disabled[tape->i] = false;
+    resetMarks(tape);
 
     Feature out;
     out.deriv = f.deriv;
@@ -299,7 +641,7 @@ Feature Evaluator::push(const Feature& f)
     for (const auto& c : tape->t)
     {
         const bool match = ((c.op == Opcode::MAX || c.op == Opcode::MIN) &&
-                            (result->f(c.a, 0) == result->f(c.b, 0) || c.a == c.b) &&
+                            (result->f(c.slot_a, 0) == result->f(c.slot_b, 0) || c.a == c.b) &&
                             itr != choices.end() && itr->id == c.id);
 
         if (!disabled[c.id])
@@ -358,11 +700,7 @@ void Evaluator::specialize(const Eigen::Vector3f& p)
     eval(p);
 
     // The same logic as push, but using float instead of interval comparisons
-    std::fill(disabled.begin(), disabled.end(), true);
-    std::fill(remap.begin(), remap.end(), 0);
-
-    // Mark the root node as active
-    disabled[tape->i] = false;
+    resetMarks(tape);
 
     for (const auto& c : tape->t)
     {
@@ -372,12 +710,12 @@ void Evaluator::specialize(const Eigen::Vector3f& p)
             // active if it is decisively above or below the other branch.
             if (c.op == Opcode::MAX)
             {
-                if (result->f(c.a, 0) > result->f(c.b, 0))
+                if (result->f(c.slot_a, 0) > result->f(c.slot_b, 0))
                 {
                     disabled[c.a] = false;
                     remap[c.id] = c.a;
                 }
-                else if (result->f(c.b, 0) > result->f(c.a, 0))
+                else if (result->f(c.slot_b, 0) > result->f(c.slot_a, 0))
                 {
                     disabled[c.b] = false;
                     remap[c.id] = c.b;
@@ -385,12 +723,12 @@ void Evaluator::specialize(const Eigen::Vector3f& p)
             }
             else if (c.op == Opcode::MIN)
             {
-                if (result->f(c.a, 0) > result->f(c.b, 0))
+                if (result->f(c.slot_a, 0) > result->f(c.slot_b, 0))
                 {
                     disabled[c.b] = false;
                     remap[c.id] = c.b;
                 }
-                else if (result->f(c.b, 0) > result->f(c.a, 0))
+                else if (result->f(c.slot_b, 0) > result->f(c.slot_a, 0))
                 {
                     disabled[c.a] = false;
                     remap[c.id] = c.a;
@@ -507,13 +845,13 @@ std::list<Feature> Evaluator::featuresAt(const Eigen::Vector3f& p)
                     ambiguous = true;
                 }
                 // Check for ambiguity here
-                else if (result->f(itr->a, 0) == result->f(itr->b, 0))
+                else if (result->f(itr->slot_a, 0) == result->f(itr->slot_b, 0))
                 {
                     // Check both branches of the ambiguity
                     const Eigen::Vector3d rhs(
-                            result->d(itr->b).col(0).template cast<double>());
+                            result->d(itr->slot_b).col(0).template cast<double>());
                     const Eigen::Vector3d lhs(
-                            result->d(itr->a).col(0).template cast<double>());
+                            result->d(itr->slot_a).col(0).template cast<double>());
                     const auto epsilon = (itr->op == Opcode::MIN) ? (rhs - lhs)
                                                                   : (lhs - rhs);
 
@@ -562,7 +900,7 @@ bool Evaluator::isAmbiguous()
     for (const auto& c : tape->t)
     {
         if ((c.op == Opcode::MIN || c.op == Opcode::MAX) &&
-            result->f(c.a, 0) == result->f(c.b, 0))
+            result->f(c.slot_a, 0) == result->f(c.slot_b, 0))
         {
             return true;
         }
@@ -579,8 +917,8 @@ const Eigen::Array<bool, Result::N, 1>& Evaluator::getAmbiguous(Result::Index i)
         if (c.op == Opcode::MIN || c.op == Opcode::MAX)
         {
             result->ambig.head(i) = result->ambig.head(i) ||
-                (result->f.block(c.a, 0, 1, i) ==
-                 result->f.block(c.b, 0, 1, i)).transpose();
+                (result->f.block(c.slot_a, 0, 1, i) ==
+                 result->f.block(c.slot_b, 0, 1, i)).transpose();
         }
     }
     return result->ambig;
@@ -594,7 +932,9 @@ void Evaluator::pop()
 
 ////////////////////////////////////////////////////////////////////////////////
 
-Interval::I Evaluator::eval_clause_interval(
+namespace {
+
+inline Interval::I intervalOp(
         Opcode::Opcode op, const Interval::I& a, const Interval::I& b)
 {
     switch (op) {
@@ -603,46 +943,46 @@ Interval::I Evaluator::eval_clause_interval(
         case Opcode::MUL:
             return a * b;
         case Opcode::MIN:
-            return boost::numeric::min(a, b);
+            return Interval::min(a, b);
         case Opcode::MAX:
-            return boost::numeric::max(a, b);
+            return Interval::max(a, b);
         case Opcode::SUB:
             return a - b;
         case Opcode::DIV:
             return a / b;
         case Opcode::ATAN2:
-            return atan2(a, b);
+            return Interval::atan2(a, b);
         case Opcode::POW:
-            return boost::numeric::pow(a, b.lower());
+            return Interval::pow(a, b.lower());
         case Opcode::NTH_ROOT:
-            return boost::numeric::nth_root(a, b.lower());
+            return Interval::nth_root(a, b.lower());
         case Opcode::MOD:
             return Interval::I(0.0f, b.upper()); // YOLO
         case Opcode::NANFILL:
             return (std::isnan(a.lower()) || std::isnan(a.upper())) ? b : a;
 
         case Opcode::SQUARE:
-            return boost::numeric::square(a);
+            return Interval::square(a);
         case Opcode::SQRT:
-            return boost::numeric::sqrt(a);
+            return Interval::sqrt(a);
         case Opcode::NEG:
             return -a;
         case Opcode::SIN:
-            return boost::numeric::sin(a);
+            return Interval::sin(a);
         case Opcode::COS:
-            return boost::numeric::cos(a);
+            return Interval::cos(a);
         case Opcode::TAN:
-            return boost::numeric::tan(a);
+            return Interval::tan(a);
         case Opcode::ASIN:
-            return boost::numeric::asin(a);
+            return Interval::asin(a);
         case Opcode::ACOS:
-            return boost::numeric::acos(a);
+            return Interval::acos(a);
         case Opcode::ATAN:
-            return boost::numeric::atan(a);
+            return Interval::atan(a);
         case Opcode::EXP:
-            return boost::numeric::exp(a);
+            return Interval::exp(a);
         case Opcode::ABS:
-            return boost::numeric::abs(a);
+            return Interval::abs(a);
         case Opcode::RECIP:
             return Interval::I(1,1) / a;
 
@@ -660,133 +1000,424 @@ Interval::I Evaluator::eval_clause_interval(
     return Interval::I();
 }
 
-////////////////////////////////////////////////////////////////////////////////
-
-const float* Evaluator::values(Result::Index count)
+/*
+ *  Evaluates a single opcode over a batch of count intervals, stored as
+ *  rows of lower and upper bounds.  Like opKernel (below), the switch is
+ *  resolved at compile time, so the loop runs without any dispatch.
+ */
+template <Opcode::Opcode OP>
+void intervalKernel(float* lo, float* hi,
+                    const float* a_lo, const float* a_hi,
+                    const float* b_lo, const float* b_hi,
+                    Result::Index count)
 {
-    for (auto itr = tape->t.rbegin(); itr != tape->t.rend(); ++itr)
+    for (Result::Index k=0; k < count; ++k)
     {
-#define out result->f.row(itr->id).head(count)
-#define a result->f.row(itr->a).head(count)
-#define b result->f.row(itr->b).head(count)
-        switch (itr->op) {
-            case Opcode::ADD:
-                out = a + b;
-                break;
-            case Opcode::MUL:
-                out = a * b;
-                break;
-            case Opcode::MIN:
-                out = a.cwiseMin(b);
-                break;
-            case Opcode::MAX:
-                out = a.cwiseMax(b);
-                break;
-            case Opcode::SUB:
-                out = a - b;
-                break;
-            case Opcode::DIV:
-                out = a / b;
-                break;
-            case Opcode::ATAN2:
-                for (auto i=0; i < a.size(); ++i)
-                {
-                    out(i) = atan2(a(i), b(i));
-                }
-                break;
-            case Opcode::POW:
-                out = a.pow(b);
-                break;
-            case Opcode::NTH_ROOT:
-                out = pow(a, 1.0f/b);
-                break;
-            case Opcode::MOD:
-                for (auto i=0; i < a.size(); ++i)
-                {
-                    out(i) = std::fmod(a(i), b(i));
-                    while (out(i) < 0)
-                    {
-                        out(i) += b(i);
-                    }
-                }
-                break;
-            case Opcode::NANFILL:
-                out = a.isNaN().select(b, a);
-                break;
+        const auto out = intervalOp(OP, Interval::I::bounds(a_lo[k], a_hi[k]),
+                                        Interval::I::bounds(b_lo[k], b_hi[k]));
+        lo[k] = out.lower();
+        hi[k] = out.upper();
+    }
+}
 
-            case Opcode::SQUARE:
-                out = a * a;
-                break;
-            case Opcode::SQRT:
-                out = sqrt(a);
-                break;
-            case Opcode::NEG:
-                out = -a;
-                break;
-            case Opcode::SIN:
-                out = sin(a);
-                break;
-            case Opcode::COS:
-                out = cos(a);
-                break;
-            case Opcode::TAN:
-                out = tan(a);
-                break;
-            case Opcode::ASIN:
-                out = asin(a);
-                break;
-            case Opcode::ACOS:
-                out = acos(a);
-                break;
-            case Opcode::ATAN:
-                out = atan(a);
-                break;
-            case Opcode::EXP:
-                out = exp(a);
-                break;
-            case Opcode::ABS:
-                out = abs(a);
-                break;
-            case Opcode::RECIP:
-                out = 1 / a;
-                break;
+}   // anonymous namespace
 
-            case Opcode::CONST_VAR:
-                out = a;
-                break;
+Interval::I Evaluator::eval_clause_interval(
+        Opcode::Opcode op, const Interval::I& a, const Interval::I& b)
+{
+    return intervalOp(op, a, b);
+}
 
-            case Opcode::INVALID:
-            case Opcode::CONST:
-            case Opcode::VAR_X:
-            case Opcode::VAR_Y:
-            case Opcode::VAR_Z:
-            case Opcode::VAR:
-            case Opcode::LAST_OP: assert(false);
+Affine::A Evaluator::eval_clause_affine(
+        Opcode::Opcode op, const Affine::A& a, const Affine::A& b,
+        const Interval::I& ia, const Interval::I& ib, const Interval::I& i)
+{
+    switch (op) {
+        case Opcode::ADD:
+            return a + b;
+        case Opcode::SUB:
+            return a - b;
+        case Opcode::MUL:
+            return a * b;
+        case Opcode::NEG:
+            return -a;
+        case Opcode::SQUARE:
+            return Affine::square(a);
+        case Opcode::CONST_VAR:
+            return a;
+
+        // Dividing by a constant is a scaling
+        case Opcode::DIV:
+            if (b.radius() == 0 && b.c != 0)
+            {
+                return Affine::scale(a, 1 / b.c);
+            }
+            break;
+
+        // If one branch is decisively selected, then use its form
+        case Opcode::MIN:
+            if (ia.upper() < ib.lower())
+            {
+                return a;
+            }
+            else if (ib.upper() < ia.lower())
+            {
+                return b;
+            }
+            break;
+        case Opcode::MAX:
+            if (ia.lower() > ib.upper())
+            {
+                return a;
+            }
+            else if (ib.lower() > ia.upper())
+            {
+                return b;
+            }
+            break;
+
+        // Absolute value is linear if the sign is known
+        case Opcode::ABS:
+            if (ia.lower() >= 0)
+            {
+                return a;
+            }
+            else if (ia.upper() <= 0)
+            {
+                return -a;
+            }
+            break;
+
+        default:
+            break;
+    }
+
+    // Otherwise, the form loses its correlation with the inputs
+    return Affine::A::fromInterval(i);
+}
+
+std::array<Interval::I, 3> Evaluator::eval_clause_gradient(
+        Opcode::Opcode op, const Interval::I& a, const Interval::I& b,
+        const std::array<Interval::I, 3>& ga,
+        const std::array<Interval::I, 3>& gb, const Interval::I& i)
+{
+    using Interval::I;
+    std::array<I, 3> out;
+
+    // Chain rule, given the partial derivatives with respect to the
+    // arguments (unary clauses ignore b, which may be anything)
+    auto unary = [&](const I& da)
+    {
+        for (unsigned k=0; k < 3; ++k)
+        {
+            out[k] = da * ga[k];
+        }
+        return out;
+    };
+    auto binary = [&](const I& da, const I& db)
+    {
+        for (unsigned k=0; k < 3; ++k)
+        {
+            out[k] = da * ga[k] + db * gb[k];
+        }
+        return out;
+    };
+
+    // Min, max, and abs aren't differentiable where their branches meet,
+    // but the mean value theorem still holds with the hull of the gradients
+    auto hull = [&](const std::array<I, 3>& p, const std::array<I, 3>& q)
+    {
+        for (unsigned k=0; k < 3; ++k)
+        {
+            out[k] = (p[k].isNaN() || q[k].isNaN()) ? I::empty()
+                : I::bounds(std::min(p[k].lower(), q[k].lower()),
+                            std::max(p[k].upper(), q[k].upper()));
+        }
+        return out;
+    };
+
+    switch (op) {
+        case Opcode::ADD:
+            return binary(1, 1);
+        case Opcode::MUL:
+            return binary(b, a);
+        case Opcode::MIN:
+            return (a.upper() < b.lower()) ? ga
+                 : (b.upper() < a.lower()) ? gb : hull(ga, gb);
+        case Opcode::MAX:
+            return (a.lower() > b.upper()) ? ga
+                 : (b.lower() > a.upper()) ? gb : hull(ga, gb);
+        case Opcode::SUB:
+            return binary(1, -1);
+        case Opcode::DIV:
+            return binary(I(1) / b, -a / Interval::square(b));
+        case Opcode::ATAN2:
+        {
+            const auto r = Interval::square(a) + Interval::square(b);
+            return binary(b / r, -a / r);
         }
+        case Opcode::POW:
+            return unary(I(b.lower()) *
+                         Interval::pow(a, b.lower() - 1));
 
-#undef out
-#undef a
-#undef b
+        case Opcode::SQUARE:
+            return unary(I(2) * a);
+        case Opcode::SQRT:
+            return unary(I(0.5) / i);
+        case Opcode::NEG:
+            return unary(-1);
+        case Opcode::SIN:
+            return unary(Interval::cos(a));
+        case Opcode::COS:
+            return unary(-Interval::sin(a));
+        case Opcode::TAN:
+            return unary(I(1) + Interval::square(i));
+        case Opcode::ASIN:
+            return unary(I(1) / Interval::sqrt(I(1) - Interval::square(a)));
+        case Opcode::ACOS:
+            return unary(I(-1) / Interval::sqrt(I(1) - Interval::square(a)));
+        case Opcode::ATAN:
+            return unary(I(1) / (I(1) + Interval::square(a)));
+        case Opcode::EXP:
+            return unary(i);
+        case Opcode::ABS:
+            return (a.lower() >= 0) ? ga
+                 : (a.upper() <= 0) ? unary(-1) : unary(I(-1, 1));
+        case Opcode::RECIP:
+            return unary(I(-1) / Interval::square(a));
+
+        // CONST_VAR hides its argument's derivatives from the solver, but
+        // its value still changes over the region
+        case Opcode::CONST_VAR:
+            return ga;
+
+        // These have unbounded (or no) derivatives
+        case Opcode::NTH_ROOT:
+        case Opcode::MOD:
+        case Opcode::NANFILL:
+            out.fill(I::whole());
+            return out;
+
+        case Opcode::INVALID:
+        case Opcode::CONST:
+        case Opcode::VAR_X:
+        case Opcode::VAR_Y:
+        case Opcode::VAR_Z:
+        case Opcode::VAR:
+        case Opcode::LAST_OP: assert(false);
     }
+    return out;
+}
 
-    return &result->f(tape->i, 0);
+Evaluator::Step::IntervalFn Evaluator::intervalsKernel(Opcode::Opcode op)
+{
+    switch (op)
+    {
+#define OPCODE(s, i) case Opcode::s: return intervalKernel<Opcode::s>;
+        OPCODES
+#undef OPCODE
+        case Opcode::LAST_OP: break;
+    }
+    assert(false);
+    return nullptr;
 }
 
-Evaluator::Derivs Evaluator::derivs(Result::Index count)
+////////////////////////////////////////////////////////////////////////////////
+
+namespace {
+
+typedef Eigen::Map<Eigen::Array<float, 1, Eigen::Dynamic>> RowOut;
+typedef Eigen::Map<const Eigen::Array<float, 1, Eigen::Dynamic>> RowIn;
+
+/*
+ *  Evaluates a single opcode over count values.  The switch is resolved at
+ *  compile time, so each instantiation is a straight-line kernel.
+ */
+template <Opcode::Opcode OP>
+void opKernel(float* out_, const float* a_, const float* b_,
+              Result::Index count)
 {
-    values(count);
+    RowOut out(out_, count);
+    const RowIn a(a_, count);
+    const RowIn b(b_, count);
 
-    for (auto itr = tape->t.rbegin(); itr != tape->t.rend(); ++itr)
+    switch (OP) {
+        case Opcode::ADD:
+            out = a + b;
+            break;
+        case Opcode::MUL:
+            out = a * b;
+            break;
+        case Opcode::MIN:
+            out = a.cwiseMin(b);
+            break;
+        case Opcode::MAX:
+            out = a.cwiseMax(b);
+            break;
+        case Opcode::SUB:
+            out = a - b;
+            break;
+        case Opcode::DIV:
+            out = a / b;
+            break;
+        case Opcode::ATAN2:
+            for (auto i=0; i < a.size(); ++i)
+            {
+                out(i) = atan2(a(i), b(i));
+            }
+            break;
+        case Opcode::POW:
+            out = a.pow(b);
+            break;
+        case Opcode::NTH_ROOT:
+            out = pow(a, 1.0f/b);
+            break;
+        case Opcode::MOD:
+            for (auto i=0; i < a.size(); ++i)
+            {
+                out(i) = std::fmod(a(i), b(i));
+                while (out(i) < 0)
+                {
+                    out(i) += b(i);
+                }
+            }
+            break;
+        case Opcode::NANFILL:
+            out = a.isNaN().select(b, a);
+            break;
+
+        case Opcode::SQUARE:
+            out = a * a;
+            break;
+        case Opcode::SQRT:
+            out = sqrt(a);
+            break;
+        case Opcode::NEG:
+            out = -a;
+            break;
+        case Opcode::SIN:
+            out = sin(a);
+            break;
+        case Opcode::COS:
+            out = cos(a);
+            break;
+        case Opcode::TAN:
+            out = tan(a);
+            break;
+        case Opcode::ASIN:
+            out = asin(a);
+            break;
+        case Opcode::ACOS:
+            out = acos(a);
+            break;
+        case Opcode::ATAN:
+            out = atan(a);
+            break;
+        case Opcode::EXP:
+            out = exp(a);
+            break;
+        case Opcode::ABS:
+            out = abs(a);
+            break;
+        case Opcode::RECIP:
+            out = 1 / a;
+            break;
+
+        case Opcode::CONST_VAR:
+            out = a;
+            break;
+
+        case Opcode::INVALID:
+        case Opcode::CONST:
+        case Opcode::VAR_X:
+        case Opcode::VAR_Y:
+        case Opcode::VAR_Z:
+        case Opcode::VAR:
+        case Opcode::LAST_OP: assert(false);
+    }
+}
+
+}   // anonymous namespace
+
+Evaluator::Step::Fn Evaluator::valuesKernel(Opcode::Opcode op)
+{
+    // Prefer a hand-written SIMD kernel for this CPU, if there is one
+    if (auto k = Simd::kernel(op))
+    {
+        return k;
+    }
+
+    switch (op)
     {
+#define OPCODE(s, i) case Opcode::s: return opKernel<Opcode::s>;
+        OPCODES
+#undef OPCODE
+        case Opcode::LAST_OP: break;
+    }
+    assert(false);
+    return nullptr;
+}
 
-#define ov result->f.row(itr->id).head(count)
-#define od result->d(itr->id).leftCols(count)
+void Evaluator::compile(Tape& t)
+{
+    // Mix each clause's opcode and (remapped) arguments into the hash
+    auto mix = mixHash;
+
+    const auto& bits = program->var_bits;
+    t.hash = mix(0xcbf29ce484222325ULL, t.i);
+    t.vars = bits[program->slots[t.i]];
+
+    t.branches.clear();
+    for (size_t j=0; j < t.t.size(); ++j)
+    {
+        if (t.t[j].op == Opcode::MIN || t.t[j].op == Opcode::MAX)
+        {
+            t.branches.push_back(j);
+        }
+    }
+
+    t.p.clear();
+    for (auto itr = t.t.rbegin(); itr != t.t.rend(); ++itr)
+    {
+        t.p.push_back({valuesKernel(itr->op),
+                       &result->f(itr->slot, 0),
+                       &result->f(itr->slot_a, 0),
+                       &result->f(itr->slot_b, 0),
+                       intervalsKernel(itr->op)});
+
+        t.hash = mix(mix(t.hash, itr->op), itr->id);
+        t.hash = mix(mix(t.hash, itr->a), itr->b);
+        t.vars |= bits[itr->slot_a] | bits[itr->slot_b];
+    }
+}
+
+const float* Evaluator::values(Result::Index count)
+{
+    for (const auto& s : tape->p)
+    {
+        s.fn(s.out, s.a, s.b, count);
+    }
+
+    return &result->f(program->slots[tape->i], 0);
+}
+
+Evaluator::Derivs Evaluator::derivs(Result::Index count)
+{
+    auto s = tape->p.begin();
+    for (auto itr = tape->t.rbegin(); itr != tape->t.rend(); ++itr, ++s)
+    {
+        // Values and derivatives are found in the same pass, because an
+        // argument's slot may be re-used once the clause has been evaluated
+        s->fn(s->out, s->a, s->b, count);
 
-#define av result->f.row(itr->a).head(count)
-#define ad result->d(itr->a).leftCols(count)
+#define ov result->f.row(itr->slot).head(count)
+#define od result->d(itr->slot).leftCols(count)
 
-#define bv result->f.row(itr->b).head(count)
-#define bd result->d(itr->b).leftCols(count)
+#define av result->f.row(itr->slot_a).head(count)
+#define ad result->d(itr->slot_a).leftCols(count)
+
+#define bv result->f.row(itr->slot_b).head(count)
+#define bd result->d(itr->slot_b).leftCols(count)
 
         switch (itr->op) {
             case Opcode::ADD:
@@ -896,107 +1527,140 @@ Evaluator::Derivs Evaluator::derivs(Result::Index count)
 #undef bv
 #undef bd
     }
-    return { &result->f(tape->i, 0),  result->d(tape->i) };
+    const auto root = program->slots[tape->i];
+    return { &result->f(root, 0),  result->d(root) };
 }
 
 std::map<Tree::Id, float> Evaluator::gradient(const Eigen::Vector3f& p)
 {
-    // Fill the values before solving for jacobians
     set(p, 0);
-    values(1);
 
-    for (auto itr = tape->t.rbegin(); itr != tape->t.rend(); ++itr)
+    // Forward pass:  evaluate every clause, saving its arguments' values
+    // (since their slots may be re-used before the reverse pass needs them)
+    auto& vals = result->vals;
+    vals.resize(tape->p.size());
     {
+        auto v = vals.begin();
+        for (const auto& s : tape->p)
+        {
+            *v++ = {{*s.a, *s.b}};
+            s.fn(s.out, s.a, s.b, 1);
+        }
+    }
 
-#define ov result->f.row(itr->id)(0)
-#define av result->f.row(itr->a)(0)
-#define bv result->f.row(itr->b)(0)
+    // Reverse pass:  walk back down the tape, accumulating adjoints into
+    // each clause's arguments.  Adjoints live in the same slots as values;
+    // a clause's slot is cleared once it has been read, since an earlier
+    // clause may re-use it.
+    auto& adj = result->adj;
+    adj.assign(result->f.rows(), 0);
+    adj[program->slots[tape->i]] = 1;
+
+    auto v = vals.rbegin();
+    for (auto itr = tape->t.begin(); itr != tape->t.end(); ++itr, ++v)
+    {
+        const float g = adj[itr->slot];
+        adj[itr->slot] = 0;
+        if (g == 0)
+        {
+            continue;
+        }
 
-#define oj result->j.row(itr->id)
-#define aj result->j.row(itr->a)
-#define bj result->j.row(itr->b)
+#define av (*v)[0]
+#define bv (*v)[1]
+#define aj adj[itr->slot_a]
+#define bj adj[itr->slot_b]
 
         switch (itr->op) {
             case Opcode::ADD:
-                oj = aj + bj;
+                aj += g;
+                bj += g;
                 break;
             case Opcode::MUL:
-                oj = av * bj + bv * aj;
+                aj += g * bv;
+                bj += g * av;
                 break;
             case Opcode::MIN:
-                oj = (av < bv) ? aj : bj;
+                if (av < bv)    aj += g;
+                else            bj += g;
                 break;
             case Opcode::MAX:
-                oj = (av < bv) ? bj : aj;
+                if (av < bv)    bj += g;
+                else            aj += g;
                 break;
             case Opcode::SUB:
-                oj = aj - bj;
+                aj += g;
+                bj -= g;
                 break;
             case Opcode::DIV:
-                oj = (bv*aj - av*bj) / pow(bv, 2);
+                aj += g / bv;
+                bj -= g * av / pow(bv, 2);
                 break;
             case Opcode::ATAN2:
-                oj = (aj*bv - av*bj) / (pow(av, 2) + pow(bv, 2));
+            {
+                const float d = pow(av, 2) + pow(bv, 2);
+                aj += g * bv / d;
+                bj -= g * av / d;
                 break;
+            }
             case Opcode::POW:
                 // The full form of the derivative is
                 // oj = m * (bv * aj + av * log(av) * bj))
                 // However, log(av) is often NaN and bj is always zero,
                 // (since it must be CONST), so we skip that part.
-                oj = pow(av, bv - 1) * (bv * aj);
+                aj += g * pow(av, bv - 1) * bv;
                 break;
             case Opcode::NTH_ROOT:
-                oj = pow(av, 1.0f/bv - 1) * (1.0f/bv * aj);
+                aj += g * pow(av, 1.0f/bv - 1) / bv;
                 break;
             case Opcode::MOD:
                 // This isn't quite how partial derivatives of mod work,
                 // but close enough normals rendering.
-                oj = aj;
+                aj += g;
                 break;
             case Opcode::NANFILL:
-                oj = std::isnan(av) ? bj : aj;
+                if (std::isnan(av)) bj += g;
+                else                aj += g;
                 break;
 
             case Opcode::SQUARE:
-                oj = 2 * av * aj;
+                aj += g * 2 * av;
                 break;
             case Opcode::SQRT:
-                if (av < 0) oj = 0.0;
-                else        oj = (aj / (2 * sqrt(av)));
+                if (av >= 0) aj += g / (2 * sqrt(av));
                 break;
             case Opcode::NEG:
-                oj = -aj;
+                aj -= g;
                 break;
             case Opcode::SIN:
-                oj = aj * cos(av);
+                aj += g * cos(av);
                 break;
             case Opcode::COS:
-                oj = aj * -sin(av);
+                aj -= g * sin(av);
                 break;
             case Opcode::TAN:
-                oj = aj * pow(1/cos(av), 2);
+                aj += g * pow(1/cos(av), 2);
                 break;
             case Opcode::ASIN:
-                oj = aj / sqrt(1 - pow(av, 2));
+                aj += g / sqrt(1 - pow(av, 2));
                 break;
             case Opcode::ACOS:
-                oj = aj / -sqrt(1 - pow(av, 2));
+                aj -= g / sqrt(1 - pow(av, 2));
                 break;
             case Opcode::ATAN:
-                oj = aj / (pow(av, 2) + 1);
+                aj += g / (pow(av, 2) + 1);
                 break;
             case Opcode::EXP:
-                oj = exp(av) * aj;
+                aj += g * exp(av);
                 break;
             case Opcode::ABS:
-                oj = (av > 0 ? 1 : -1) * aj;
+                aj += (av > 0 ? 1 : -1) * g;
                 break;
             case Opcode::RECIP:
-                oj = -aj / pow(av, 2);
+                aj -= g / pow(av, 2);
                 break;
 
             case Opcode::CONST_VAR:
-                oj = 0;
                 break;
 
             case Opcode::INVALID:
@@ -1007,10 +1671,8 @@ std::map<Tree::Id, float> Evaluator::gradient(const Eigen::Vector3f& p)
             case Opcode::VAR:
             case Opcode::LAST_OP: assert(false);
         }
-#undef ov
 #undef av
 #undef bv
-#undef oj
 #undef aj
 #undef bj
     }
@@ -1018,11 +1680,9 @@ std::map<Tree::Id, float> Evaluator::gradient(const Eigen::Vector3f& p)
     std::map<Tree::Id, float> out;
     {   // Unpack from flat array into map
         // (to allow correlating back to VARs in Tree)
-        const auto ti = tape->i;
-        size_t index = 0;
-        for (auto v : vars.left)
+        for (auto v : program->vars.left)
         {
-            out[v.second] = result->j(ti, index++);
+            out[v.second] = adj[v.first];
         }
     }
     return out;
@@ -1030,12 +1690,183 @@ std::map<Tree::Id, float> Evaluator::gradient(const Eigen::Vector3f& p)
 
 Interval::I Evaluator::interval()
 {
+    switch (range_mode)
+    {
+        case AFFINE:        return affine();
+        case MEAN_VALUE:    return meanValue();
+        case INTERVAL:      break;
+    }
+
     for (auto itr = tape->t.rbegin(); itr != tape->t.rend(); ++itr)
     {
-        result->i[itr->id] = eval_clause_interval(itr->op,
-                result->i[itr->a], result->i[itr->b]);
+        result->i[itr->slot] = eval_clause_interval(itr->op,
+                result->i[itr->slot_a], result->i[itr->slot_b]);
     }
-    return result->i[tape->i];
+    return result->i[program->slots[tape->i]];
+}
+
+Interval::I Evaluator::affine()
+{
+    auto& i = result->i;
+    auto& a = result->a;
+    a[X] = Affine::A::input(i[X], 0);
+    a[Y] = Affine::A::input(i[Y], 1);
+    a[Z] = Affine::A::input(i[Z], 2);
+
+    for (auto itr = tape->t.rbegin(); itr != tape->t.rend(); ++itr)
+    {
+        const auto& ia = i[itr->slot_a];
+        const auto& ib = i[itr->slot_b];
+        const auto r = eval_clause_interval(itr->op, ia, ib);
+        const auto f = eval_clause_affine(itr->op, a[itr->slot_a],
+                                          a[itr->slot_b], ia, ib, r);
+
+        // Keep the tighter of the two bounds, and fall back to the interval
+        // if the affine form has blown up (e.g. from a division by zero)
+        const auto q = f.range();
+        const bool finite = std::isfinite(f.c) && std::isfinite(f.radius());
+        i[itr->slot] = r.isNaN() ? r : Interval::I::bounds(
+                std::max(r.lower(), q.lower()),
+                std::min(r.upper(), q.upper()));
+        a[itr->slot] = finite ? f : Affine::A::fromInterval(i[itr->slot]);
+    }
+    return i[program->slots[tape->i]];
+}
+
+Interval::I Evaluator::meanValue()
+{
+    auto& i = result->i;
+    auto& ic = result->ic;
+    auto& ig = result->ig;
+
+    // Pick a center point within the region (which must be inside, so that
+    // the gradient over the region holds between it and any other point),
+    // then find the offsets from it to the region's bounds
+    const Clause::Id axes[3] = {X, Y, Z};
+    std::array<Interval::I, 3> offset;
+    for (unsigned k=0; k < 3; ++k)
+    {
+        const auto& r = i[axes[k]];
+        const float c = std::min(std::max(
+                r.lower() + (r.upper() - r.lower()) / 2, r.lower()),
+                r.upper());
+        ic[axes[k]] = Interval::I(c);
+        offset[k] = r - Interval::I(c);
+        ig[axes[k]] = {{0, 0, 0}};
+        ig[axes[k]][k] = 1;
+    }
+
+    for (auto itr = tape->t.rbegin(); itr != tape->t.rend(); ++itr)
+    {
+        const auto& ia = i[itr->slot_a];
+        const auto& ib = i[itr->slot_b];
+        const auto r = eval_clause_interval(itr->op, ia, ib);
+        const auto c = eval_clause_interval(itr->op, ic[itr->slot_a],
+                                            ic[itr->slot_b]);
+        const auto g = eval_clause_gradient(itr->op, ia, ib,
+                                            ig[itr->slot_a],
+                                            ig[itr->slot_b], r);
+
+        // f(region) is within f(center) + gradient * (region - center),
+        // so keep the tighter of that and the plain interval
+        auto m = c;
+        for (unsigned k=0; k < 3; ++k)
+        {
+            m = m + g[k] * offset[k];
+        }
+        i[itr->slot] = (r.isNaN() || m.isNaN()) ? r : Interval::I::bounds(
+                std::max(r.lower(), m.lower()),
+                std::min(r.upper(), m.upper()));
+        ic[itr->slot] = c;
+        ig[itr->slot] = g;
+    }
+    return i[program->slots[tape->i]];
+}
+
+const Interval::I* Evaluator::intervals(Result::Index count)
+{
+    assert(count <= Result::K);
+    auto& lo = result->lo;
+    auto& hi = result->hi;
+
+    // Alongside each min and max clause, we store which branches push(index)
+    // should keep for each box, since the result arrays will be overwritten
+    // by evaluations of deeper tapes.
+    const auto n = tape->t.size();
+    tape->choices.resize(count * n);
+    tape->results.resize(count);
+
+    if (range_mode != INTERVAL)
+    {
+        // Affine forms and gradients don't fit into lanes, so each box is
+        // evaluated in turn
+        for (Result::Index k=0; k < count; ++k)
+        {
+            result->i[X] = {lo(X, k), hi(X, k)};
+            result->i[Y] = {lo(Y, k), hi(Y, k)};
+            result->i[Z] = {lo(Z, k), hi(Z, k)};
+            tape->results[k] = interval();
+
+            for (size_t j=0; j < n; ++j)
+            {
+                const auto& c = tape->t[j];
+                if (c.op == Opcode::MIN || c.op == Opcode::MAX)
+                {
+                    const auto& a = result->i[c.slot_a];
+                    const auto& b = result->i[c.slot_b];
+                    tape->choices[j * count + k] = choose(c.op,
+                            a.lower(), a.upper(), b.lower(), b.upper());
+                }
+            }
+        }
+    }
+    else
+    {
+        auto s = tape->p.begin();
+        size_t j = n;
+        for (auto itr = tape->t.rbegin(); itr != tape->t.rend(); ++itr, ++s)
+        {
+            const float* a_lo = &lo(itr->slot_a, 0);
+            const float* a_hi = &hi(itr->slot_a, 0);
+            const float* b_lo = &lo(itr->slot_b, 0);
+            const float* b_hi = &hi(itr->slot_b, 0);
+            s->ifn(&lo(itr->slot, 0), &hi(itr->slot, 0),
+                   a_lo, a_hi, b_lo, b_hi, count);
+
+            // Choices are found with a branch-free loop over the argument
+            // rows, which are still in cache (a box can't be decisively
+            // above and below the other branch at the same time)
+            --j;
+            if (itr->op == Opcode::MIN || itr->op == Opcode::MAX)
+            {
+                const unsigned sa = (itr->op == Opcode::MAX) ? 0 : 1;
+                const unsigned sb = 1 - sa;
+                uint8_t out[Result::K];
+                for (Result::Index k=0; k < count; ++k)
+                {
+                    out[k] = ((a_lo[k] > b_hi[k]) << sa) |
+                             ((b_lo[k] > a_hi[k]) << sb);
+                }
+                std::copy(out, out + count, &tape->choices[j * count]);
+            }
+        }
+
+        const auto root = program->slots[tape->i];
+        for (Result::Index k=0; k < count; ++k)
+        {
+            tape->results[k] = Interval::I::bounds(lo(root, k), hi(root, k));
+        }
+    }
+
+    tape->regions.resize(count);
+    for (Result::Index k=0; k < count; ++k)
+    {
+        tape->regions[k] = {{Interval::I(lo(X, k), hi(X, k)),
+                             Interval::I(lo(Y, k), hi(Y, k)),
+                             Interval::I(lo(Z, k), hi(Z, k))}};
+    }
+
+    return tape->results.data();
 }
 
 ////////////////////////////////////////////////////////////////////////////////
@@ -1047,18 +1878,32 @@ double Evaluator::utilization() const
 
 void Evaluator::setVar(Tree::Id var, float value)
 {
-    auto r = vars.right.find(var);
-    if (r != vars.right.end())
+    auto r = program->vars.right.find(var);
+    if (r != program->vars.right.end())
     {
         result->setValue(value, r->second);
     }
 }
 
+uint64_t Evaluator::varMask(const std::set<Tree::Id>& vars) const
+{
+    uint64_t out = 0;
+    for (auto v : vars)
+    {
+        auto r = program->vars.right.find(v);
+        if (r != program->vars.right.end())
+        {
+            out |= program->var_bits[r->second];
+        }
+    }
+    return out;
+}
+
 std::map<Tree::Id, float> Evaluator::varValues() const
 {
     std::map<Tree::Id, float> out;
 
-    for (auto v : vars.left)
+    for (auto v : program->vars.left)
     {
         out[v.second] = result->f(v.first, 0);
     }
@@ -1068,7 +1913,7 @@ std::map<Tree::Id, float> Evaluator::varValues() const
 bool Evaluator::updateVars(const std::map<Kernel::Tree::Id, float>& vars_)
 {
     bool changed = false;
-    for (const auto& v : vars.left)
+    for (const auto& v : program->vars.left)
     {
         auto val = vars_.at(v.second);
         if (val != result->f(v.first, 0))
@@ -0,0 +1,341 @@
+#include "ao/eval/interval.hpp"
+
+namespace Kernel {
+namespace Interval {
+
+/*
+ *  Raises a non-negative float to a positive power by repeated squaring,
+ *  rounding each step down (or up)
+ */
+static float powDown(float x, int p)
+{
+    float y = (p & 1) ? x : 1;
+    for (p >>= 1; p > 0; p >>= 1)
+    {
+        x = mulDown(x, x);
+        if (p & 1)
+        {
+            y = mulDown(x, y);
+        }
+    }
+    return y;
+}
+
+static float powUp(float x, int p)
+{
+    float y = (p & 1) ? x : 1;
+    for (p >>= 1; p > 0; p >>= 1)
+    {
+        x = mulUp(x, x);
+        if (p & 1)
+        {
+            y = mulUp(x, y);
+        }
+    }
+    return y;
+}
+
+I pow(const I& x, int p)
+{
+    if (x.isNaN())
+    {
+        return I::empty();
+    }
+    else if (p == 0)
+    {
+        return (x.lower() == 0 && x.upper() == 0) ? I::empty() : I(1);
+    }
+    else if (p < 0)
+    {
+        return I(1) / pow(x, -p);
+    }
+
+    if (x.upper() < 0)
+    {
+        const float yl = powDown(-x.upper(), p);
+        const float yu = powUp(-x.lower(), p);
+        return (p & 1) ? I::bounds(-yu, -yl) : I::bounds(yl, yu);
+    }
+    else if (x.lower() < 0)
+    {
+        return (p & 1)
+            ? I::bounds(-powUp(-x.lower(), p), powUp(x.upper(), p))
+            : I::bounds(0, powUp(std::max(-x.lower(), x.upper()), p));
+    }
+    else
+    {
+        return I::bounds(powDown(x.lower(), p), powUp(x.upper(), p));
+    }
+}
+
+/*
+ *  libm's transcendental functions (and std::pow with an exponent of 1/n)
+ *  aren't correctly rounded, unlike the operations that down and up
+ *  expect, so their results are widened by an extra ulp in each direction
+ *  (infinite results are left alone)
+ */
+static float libmDown(double d)
+{
+    const float f = down(d);
+    return std::isinf(f) ? f : nextDown(f);
+}
+
+static float libmUp(double d)
+{
+    const float f = up(d);
+    return std::isinf(f) ? f : nextUp(f);
+}
+
+static float rootDown(float x, int n)
+{
+    return libmDown(std::pow(double(x), 1.0 / n));
+}
+
+static float rootUp(float x, int n)
+{
+    return libmUp(std::pow(double(x), 1.0 / n));
+}
+
+I nth_root(const I& x, int n)
+{
+    if (x.isNaN())
+    {
+        return I::empty();
+    }
+    else if (n == 1)
+    {
+        return x;
+    }
+    else if (n == 2)
+    {
+        return sqrt(x);
+    }
+
+    // Even roots are only defined for the non-negative part of x,
+    // and odd roots are symmetric about zero
+    if (x.upper() <= 0)
+    {
+        if (x.upper() == 0)
+        {
+            return (!(n & 1) || x.lower() == 0)
+                ? I::bounds(0, 0)
+                : I::bounds(-rootUp(-x.lower(), n), 0);
+        }
+        else if (!(n & 1))
+        {
+            return I::empty();
+        }
+        return I::bounds(-rootUp(-x.lower(), n), -rootDown(-x.upper(), n));
+    }
+
+    const float u = rootUp(x.upper(), n);
+    if (x.lower() <= 0)
+    {
+        return (!(n & 1) || x.lower() == 0)
+            ? I::bounds(0, u)
+            : I::bounds(-rootUp(-x.lower(), n), u);
+    }
+    return I::bounds(std::max(0.0f, rootDown(x.lower(), n)), u);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+/*
+ *  Bounds a function with period 2π over [l, u], given its values at
+ *  each end.  The function must have its maxima at x = phase + 2kπ and
+ *  its minima at x = phase + (2k + 1)π (like cos(x - phase)).
+ */
+static I periodic(double l, double u, double phase, double fl, double fu)
+{
+    const double tau = 2 * M_PI;
+    if (!(u - l < tau))
+    {
+        return I(-1, 1);
+    }
+
+    bool has_max = false;
+    bool has_min = false;
+
+    // Single points never contain an extremum; skipping them also keeps
+    // huge arguments (where the reduction below loses precision) exact
+    if (u > l)
+    {
+        // Shift so that the lower bound is in [0, 2π)
+        const double a = l - phase - std::floor((l - phase) / tau) * tau;
+        const double b = a + (u - l);
+        has_max = b >= tau;
+        has_min = (a <= M_PI && b >= M_PI) || b >= 3 * M_PI;
+    }
+
+    return I::bounds(
+            has_min ? -1 : std::max(-1.0f, libmDown(std::min(fl, fu))),
+            has_max ?  1 : std::min(1.0f, libmUp(std::max(fl, fu))));
+}
+
+I cos(const I& x)
+{
+    if (x.isNaN())
+    {
+        return I::empty();
+    }
+    const double l = x.lower();
+    const double u = x.upper();
+    return periodic(l, u, 0, std::cos(l), std::cos(u));
+}
+
+I sin(const I& x)
+{
+    if (x.isNaN())
+    {
+        return I::empty();
+    }
+    const double l = x.lower();
+    const double u = x.upper();
+    return periodic(l, u, M_PI / 2, std::sin(l), std::sin(u));
+}
+
+I tan(const I& x)
+{
+    if (x.isNaN())
+    {
+        return I::empty();
+    }
+    const double l = x.lower();
+    const double u = x.upper();
+    if (!(u - l < M_PI))
+    {
+        return I::whole();
+    }
+
+    // Check whether the interval crosses one of the poles at π/2 + kπ
+    if (u > l)
+    {
+        const double a = l + M_PI / 2 -
+                         std::floor((l + M_PI / 2) / M_PI) * M_PI;
+        if (a <= 0 || a + (u - l) >= M_PI)
+        {
+            return I::whole();
+        }
+    }
+    return I::bounds(libmDown(std::tan(l)), libmUp(std::tan(u)));
+}
+
+I asin(const I& x)
+{
+    if (x.isNaN() || x.upper() < -1 || x.lower() > 1)
+    {
+        return I::empty();
+    }
+    return I::bounds(
+            (x.lower() <= -1) ? down(-M_PI / 2)
+                              : libmDown(std::asin(double(x.lower()))),
+            (x.upper() >= 1)  ? up(M_PI / 2)
+                              : libmUp(std::asin(double(x.upper()))));
+}
+
+I acos(const I& x)
+{
+    if (x.isNaN() || x.upper() < -1 || x.lower() > 1)
+    {
+        return I::empty();
+    }
+    return I::bounds(
+            (x.upper() >= 1)  ? 0 : libmDown(std::acos(double(x.upper()))),
+            (x.lower() <= -1) ? up(M_PI)
+                              : libmUp(std::acos(double(x.lower()))));
+}
+
+I atan(const I& x)
+{
+    if (x.isNaN())
+    {
+        return I::empty();
+    }
+    return I::bounds(libmDown(std::atan(double(x.lower()))),
+                     libmUp(std::atan(double(x.upper()))));
+}
+
+I exp(const I& x)
+{
+    if (x.isNaN())
+    {
+        return I::empty();
+    }
+    return I::bounds(std::max(0.0f, libmDown(std::exp(double(x.lower())))),
+                     libmUp(std::exp(double(x.upper()))));
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+/*
+ *  Returns atan2 of the corners (y0, x0) and (y1, x1), rounded outwards
+ */
+static I atan2(float y0, float x0, float y1, float x1)
+{
+    return I::bounds(libmDown(std::atan2(double(y0), double(x0))),
+                     libmUp(std::atan2(double(y1), double(x1))));
+}
+
+I atan2(const I& y, const I& x)
+{
+    if (x.isNaN() || y.isNaN())
+    {
+        return I::empty();
+    }
+
+    // There are 9 possible cases for interval atan2:
+    // - Completely within a quadrant (4 cases)
+    // - Completely within two quadrants (4 cases)
+    // - Containing the origin (1 case)
+
+    if (x.lower() > 0)
+    {   // Right half of the plane
+        if (y.lower() > 0)
+        {   // 1st quadrant
+            return atan2(y.lower(), x.upper(), y.upper(), x.lower());
+        }
+        else if (y.upper() < 0)
+        {   // 4th quadrant
+            return atan2(y.lower(), x.lower(), y.upper(), x.upper());
+        }
+        else
+        {   // Crossing the X axis
+            return atan2(y.lower(), x.lower(), y.upper(), x.lower());
+        }
+    }
+    else if (x.upper() < 0)
+    {   // Left half of the plane
+        if (y.lower() > 0)
+        {   // 2nd quadrant
+            return atan2(y.upper(), x.upper(), y.lower(), x.lower());
+        }
+        else if (y.upper() < 0)
+        {   // 3rd quadrant
+            return atan2(y.upper(), x.lower(), y.lower(), x.upper());
+        }
+        else
+        {   // Branch cut
+            return I::bounds(down(-M_PI), up(M_PI));
+        }
+    }
+    else
+    {  // Both sides of the plane
+        if (y.lower() > 0)
+        {   // Top half of the plane
+            return atan2(y.lower(), x.upper(), y.lower(), x.lower());
+        }
+        else if (y.upper() < 0)
+        {
+            // Bottom half of the plane
+            return atan2(y.upper(), x.lower(), y.upper(), x.upper());
+        }
+        else
+        {
+            // Contains the origin
+            return I::bounds(down(-M_PI), up(M_PI));
+        }
+    }
+}
+
+}   // namespace Interval
+}   // namespace Kernel
@@ -3,21 +3,21 @@
 namespace Kernel {
 
 constexpr Result::Index Result::N;
+constexpr Result::Index Result::K;
 
-Result::Result(Index clauses, Index vars)
-    : f(clauses, N), d(clauses, 1), j(clauses, vars)
+Result::Result(Index slots)
+    : f(slots, N), d(slots, 1), lo(slots, K), hi(slots, K)
 {
-    i.resize(clauses);
-    j = 0;
+    i.resize(slots);
+    a.resize(slots);
+    ic.resize(slots);
+    ig.resize(slots);
 }
 
 void Result::fill(float v, Index clause)
 {
     // Load a constant into the value row
     setValue(v, clause);
-
-    // Fill the Gradient row with zeros
-    j.row(clause) = 0;
 }
 
 void Result::setValue(float v, Index clause)
@@ -29,12 +29,11 @@ void Result::setValue(float v, Index clause)
     }
 
     i[clause] = Interval::I(v, v);
-}
-
-void Result::setGradient(Index clause, Index var)
-{
-    // Drop a 1 in the Jacobian row at the var index
-    j(clause, var) = 1;
+    a[clause] = Affine::A(v);
+    ic[clause] = Interval::I(v, v);
+    ig[clause] = {{0, 0, 0}};
+    lo.row(clause) = v;
+    hi.row(clause) = v;
 }
 
 void Result::setDeriv(Eigen::Vector3f deriv, Index clause)
@@ -0,0 +1,410 @@
+#include <cmath>
+
+#include "ao/eval/simd.hpp"
+
+#if defined(__x86_64__) && defined(__GNUC__)
+#define AO_SIMD_AVX2
+#include <immintrin.h>
+#endif
+
+namespace Kernel {
+
+namespace Simd
+{
+
+#ifdef AO_SIMD_AVX2
+
+// Everything in this block is compiled for AVX2 + FMA, regardless of the
+// flags used for the rest of the kernel; it's only called after checking
+// (with CPUID) that the running machine supports those instructions.
+#ifdef __clang__
+#pragma clang attribute push (__attribute__((target("avx2,fma"))), \
+                              apply_to=function)
+#else
+#pragma GCC push_options
+#pragma GCC target("avx2,fma")
+#endif
+
+namespace {
+
+inline __m256 set1(float f) { return _mm256_set1_ps(f); }
+
+inline __m256 signMask() { return _mm256_set1_ps(-0.0f); }
+
+/*
+ *  Returns a mask of lanes where the sign bit is set (including -0)
+ */
+inline __m256 signBitSet(__m256 x)
+{
+    return _mm256_castsi256_ps(_mm256_srai_epi32(_mm256_castps_si256(x), 31));
+}
+
+/*
+ *  Computes sin and cos together (they share their range reduction),
+ *  following Cephes' sinf / cosf.  Only valid for |x| <= 8192.
+ */
+inline void sincos(__m256 x, __m256* s, __m256* c)
+{
+    __m256 sign_sin = _mm256_and_ps(x, signMask());
+    x = _mm256_andnot_ps(signMask(), x);
+
+    // Find the octant, rounding up to an even number
+    __m256i j = _mm256_cvttps_epi32(_mm256_mul_ps(x, set1(1.27323954473516f)));
+    j = _mm256_add_epi32(j, _mm256_set1_epi32(1));
+    j = _mm256_and_si256(j, _mm256_set1_epi32(~1));
+    const __m256 y = _mm256_cvtepi32_ps(j);
+
+    // Pick per-lane sign flips and which polynomial gives which result
+    const __m256 swap_sin = _mm256_castsi256_ps(_mm256_slli_epi32(
+            _mm256_and_si256(j, _mm256_set1_epi32(4)), 29));
+    const __m256 sign_cos = _mm256_castsi256_ps(_mm256_slli_epi32(
+            _mm256_andnot_si256(_mm256_sub_epi32(j, _mm256_set1_epi32(2)),
+                                _mm256_set1_epi32(4)), 29));
+    const __m256 use_sin = _mm256_castsi256_ps(_mm256_cmpeq_epi32(
+            _mm256_and_si256(j, _mm256_set1_epi32(2)),
+            _mm256_setzero_si256()));
+    sign_sin = _mm256_xor_ps(sign_sin, swap_sin);
+
+    // Extended-precision modular arithmetic:  x - y * (pi / 4)
+    x = _mm256_fnmadd_ps(y, set1(0.78515625f), x);
+    x = _mm256_fnmadd_ps(y, set1(2.4187564849853515625e-4f), x);
+    x = _mm256_fnmadd_ps(y, set1(3.77489497744594108e-8f), x);
+    const __m256 z = _mm256_mul_ps(x, x);
+
+    __m256 pc = _mm256_fmadd_ps(set1(2.443315711809948e-5f), z,
+                                set1(-1.388731625493765e-3f));
+    pc = _mm256_fmadd_ps(pc, z, set1(4.166664568298827e-2f));
+    pc = _mm256_mul_ps(_mm256_mul_ps(pc, z), z);
+    pc = _mm256_fnmadd_ps(set1(0.5f), z, pc);
+    pc = _mm256_add_ps(pc, set1(1.0f));
+
+    __m256 ps = _mm256_fmadd_ps(set1(-1.9515295891e-4f), z,
+                                set1(8.3321608736e-3f));
+    ps = _mm256_fmadd_ps(ps, z, set1(-1.6666654611e-1f));
+    ps = _mm256_mul_ps(ps, z);
+    ps = _mm256_fmadd_ps(ps, x, x);
+
+    *s = _mm256_xor_ps(_mm256_blendv_ps(pc, ps, use_sin), sign_sin);
+    *c = _mm256_xor_ps(_mm256_blendv_ps(ps, pc, use_sin), sign_cos);
+}
+
+/*
+ *  Returns true if any lane is outside of the range where sincos is valid
+ *  (including infinities, but not NaNs, which propagate correctly)
+ */
+inline bool sincosOutOfRange(__m256 x)
+{
+    return _mm256_movemask_ps(_mm256_cmp_ps(
+                _mm256_andnot_ps(signMask(), x), set1(8192.0f),
+                _CMP_GT_OQ));
+}
+
+/*
+ *  Exponential, following Cephes' expf
+ */
+inline __m256 exp(__m256 x)
+{
+    // Clamp to a range where the result saturates to 0 or infinity
+    // (max_ps / min_ps would turn a NaN into the bound, so remember them)
+    const __m256 is_nan = _mm256_cmp_ps(x, x, _CMP_UNORD_Q);
+    const __m256 xc = _mm256_min_ps(_mm256_max_ps(x, set1(-104.0f)),
+                                    set1(89.0f));
+
+    // exp(x) = 2^n * exp(r), with |r| <= ln(2) / 2
+    const __m256 n = _mm256_floor_ps(
+            _mm256_fmadd_ps(xc, set1(1.44269504088896341f), set1(0.5f)));
+    __m256 r = _mm256_fnmadd_ps(n, set1(0.693359375f), xc);
+    r = _mm256_fnmadd_ps(n, set1(-2.12194440e-4f), r);
+
+    __m256 p = set1(1.9875691500e-4f);
+    p = _mm256_fmadd_ps(p, r, set1(1.3981999507e-3f));
+    p = _mm256_fmadd_ps(p, r, set1(8.3334519073e-3f));
+    p = _mm256_fmadd_ps(p, r, set1(4.1665795894e-2f));
+    p = _mm256_fmadd_ps(p, r, set1(1.6666665459e-1f));
+    p = _mm256_fmadd_ps(p, r, set1(5.0000001201e-1f));
+    p = _mm256_fmadd_ps(p, _mm256_mul_ps(r, r), r);
+    p = _mm256_add_ps(p, set1(1.0f));
+
+    // Scale by 2^n in two steps, so that each factor is a normal float and
+    // the final multiplication produces infinities and denormals properly
+    const __m256i ni = _mm256_cvtps_epi32(n);
+    const __m256i lo = _mm256_srai_epi32(ni, 1);
+    const __m256i hi = _mm256_sub_epi32(ni, lo);
+    const __m256i bias = _mm256_set1_epi32(127);
+    p = _mm256_mul_ps(p, _mm256_castsi256_ps(
+                _mm256_slli_epi32(_mm256_add_epi32(lo, bias), 23)));
+    p = _mm256_mul_ps(p, _mm256_castsi256_ps(
+                _mm256_slli_epi32(_mm256_add_epi32(hi, bias), 23)));
+
+    return _mm256_blendv_ps(p, x, is_nan);
+}
+
+/*
+ *  Arctangent, following Cephes' atanf
+ */
+inline __m256 atan(__m256 x)
+{
+    const __m256 sign = _mm256_and_ps(x, signMask());
+    x = _mm256_andnot_ps(signMask(), x);
+
+    // Reduce the argument into [0, tan(pi / 8)]
+    const __m256 big = _mm256_cmp_ps(x, set1(2.414213562373095f), _CMP_GT_OQ);
+    const __m256 mid = _mm256_cmp_ps(x, set1(0.4142135623730950f),
+                                     _CMP_GT_OQ);
+    const __m256 one = set1(1.0f);
+
+    __m256 xr = _mm256_blendv_ps(x, _mm256_div_ps(_mm256_sub_ps(x, one),
+                                                  _mm256_add_ps(x, one)), mid);
+    xr = _mm256_blendv_ps(xr, _mm256_div_ps(set1(-1.0f), x), big);
+
+    __m256 y = _mm256_and_ps(mid, set1(0.78539816339744830962f));
+    y = _mm256_blendv_ps(y, set1(1.57079632679489661923f), big);
+
+    const __m256 z = _mm256_mul_ps(xr, xr);
+    __m256 p = _mm256_fmadd_ps(set1(8.05374449538e-2f), z,
+                               set1(-1.38776856032e-1f));
+    p = _mm256_fmadd_ps(p, z, set1(1.99777106478e-1f));
+    p = _mm256_fmadd_ps(p, z, set1(-3.33329491539e-1f));
+    p = _mm256_mul_ps(p, z);
+    p = _mm256_fmadd_ps(p, xr, xr);
+
+    return _mm256_xor_ps(_mm256_add_ps(y, p), sign);
+}
+
+/*
+ *  Two-argument arctangent, matching std::atan2 for finite inputs
+ *  (including signed zeros)
+ */
+inline __m256 atan2(__m256 y, __m256 x)
+{
+    __m256 r = atan(_mm256_div_ps(y, x));
+
+    // atan2(+/-0, +/-0) is +/-0 before the quadrant correction below
+    const __m256 zero = _mm256_setzero_ps();
+    const __m256 both = _mm256_and_ps(_mm256_cmp_ps(x, zero, _CMP_EQ_OQ),
+                                      _mm256_cmp_ps(y, zero, _CMP_EQ_OQ));
+    r = _mm256_blendv_ps(r, y, both);
+
+    // Add +/- pi when x is negative (or -0)
+    const __m256 pi = _mm256_or_ps(set1(3.14159265358979323846f),
+                                   _mm256_and_ps(y, signMask()));
+    return _mm256_blendv_ps(r, _mm256_add_ps(r, pi), signBitSet(x));
+}
+
+/*
+ *  Matches the portable MOD implementation for a single value
+ */
+inline float mod(float a, float b)
+{
+    float out = std::fmod(a, b);
+    while (out < 0)
+    {
+        out += b;
+    }
+    return out;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+struct Add { static __m256 apply(__m256 a, __m256 b)
+    { return _mm256_add_ps(a, b); } };
+struct Mul { static __m256 apply(__m256 a, __m256 b)
+    { return _mm256_mul_ps(a, b); } };
+struct Sub { static __m256 apply(__m256 a, __m256 b)
+    { return _mm256_sub_ps(a, b); } };
+struct Div { static __m256 apply(__m256 a, __m256 b)
+    { return _mm256_div_ps(a, b); } };
+
+// Argument order matches std::min / std::max when one value is NaN
+struct Min { static __m256 apply(__m256 a, __m256 b)
+    { return _mm256_min_ps(b, a); } };
+struct Max { static __m256 apply(__m256 a, __m256 b)
+    { return _mm256_max_ps(b, a); } };
+
+struct NanFill { static __m256 apply(__m256 a, __m256 b)
+    { return _mm256_blendv_ps(a, b, _mm256_cmp_ps(a, a, _CMP_UNORD_Q)); } };
+struct Atan2 { static __m256 apply(__m256 a, __m256 b)
+    { return atan2(a, b); } };
+
+struct Square { static __m256 apply(__m256 a)
+    { return _mm256_mul_ps(a, a); } };
+struct Sqrt { static __m256 apply(__m256 a)
+    { return _mm256_sqrt_ps(a); } };
+struct Neg { static __m256 apply(__m256 a)
+    { return _mm256_xor_ps(a, signMask()); } };
+struct Abs { static __m256 apply(__m256 a)
+    { return _mm256_andnot_ps(signMask(), a); } };
+struct Recip { static __m256 apply(__m256 a)
+    { return _mm256_div_ps(set1(1.0f), a); } };
+struct Copy { static __m256 apply(__m256 a)
+    { return a; } };
+struct Exp { static __m256 apply(__m256 a)
+    { return exp(a); } };
+struct Atan { static __m256 apply(__m256 a)
+    { return atan(a); } };
+
+template <typename Op>
+void binary(float* out, const float* a, const float* b, uint32_t count)
+{
+    for (uint32_t i=0; i < count; i += 8)
+    {
+        _mm256_storeu_ps(out + i, Op::apply(_mm256_loadu_ps(a + i),
+                                            _mm256_loadu_ps(b + i)));
+    }
+}
+
+template <typename Op>
+void unary(float* out, const float* a, const float*, uint32_t count)
+{
+    for (uint32_t i=0; i < count; i += 8)
+    {
+        _mm256_storeu_ps(out + i, Op::apply(_mm256_loadu_ps(a + i)));
+    }
+}
+
+template <bool SIN>
+void trig(float* out, const float* a, const float*, uint32_t count)
+{
+    for (uint32_t i=0; i < count; i += 8)
+    {
+        const __m256 x = _mm256_loadu_ps(a + i);
+        if (sincosOutOfRange(x))
+        {
+            for (uint32_t j=i; j < i + 8; ++j)
+            {
+                out[j] = SIN ? std::sin(a[j]) : std::cos(a[j]);
+            }
+        }
+        else
+        {
+            __m256 s, c;
+            sincos(x, &s, &c);
+            _mm256_storeu_ps(out + i, SIN ? s : c);
+        }
+    }
+}
+
+void mod(float* out, const float* a, const float* b, uint32_t count)
+{
+    for (uint32_t i=0; i < count; i += 8)
+    {
+        const __m256 va = _mm256_loadu_ps(a + i);
+        const __m256 vb = _mm256_loadu_ps(b + i);
+        const __m256 q = _mm256_floor_ps(_mm256_div_ps(va, vb));
+
+        // The fast path requires a positive divisor and a quotient that's
+        // small enough to be exact (which also catches NaN and infinity)
+        const __m256 ok = _mm256_and_ps(
+                _mm256_cmp_ps(vb, _mm256_setzero_ps(), _CMP_GT_OQ),
+                _mm256_cmp_ps(_mm256_andnot_ps(signMask(), q),
+                              set1(8388608.0f), _CMP_LT_OQ));
+        if (_mm256_movemask_ps(ok) != 0xff)
+        {
+            for (uint32_t j=i; j < i + 8; ++j)
+            {
+                out[j] = mod(a[j], b[j]);
+            }
+            continue;
+        }
+
+        // a - q * b is exact (with FMA) when q is the true floor; if the
+        // division rounded q off by one, then nudge it back into [0, b)
+        __m256 r = _mm256_fnmadd_ps(q, vb, va);
+        r = _mm256_add_ps(r, _mm256_and_ps(vb,
+                    _mm256_cmp_ps(r, _mm256_setzero_ps(), _CMP_LT_OQ)));
+        r = _mm256_sub_ps(r, _mm256_and_ps(vb,
+                    _mm256_cmp_ps(r, vb, _CMP_GE_OQ)));
+        _mm256_storeu_ps(out + i, r);
+    }
+}
+
+Fn avx2(Opcode::Opcode op)
+{
+    switch (op)
+    {
+        case Opcode::ADD:       return binary<Add>;
+        case Opcode::MUL:       return binary<Mul>;
+        case Opcode::MIN:       return binary<Min>;
+        case Opcode::MAX:       return binary<Max>;
+        case Opcode::SUB:       return binary<Sub>;
+        case Opcode::DIV:       return binary<Div>;
+        case Opcode::ATAN2:     return binary<Atan2>;
+        case Opcode::MOD:       return mod;
+        case Opcode::NANFILL:   return binary<NanFill>;
+
+        case Opcode::SQUARE:    return unary<Square>;
+        case Opcode::SQRT:      return unary<Sqrt>;
+        case Opcode::NEG:       return unary<Neg>;
+        case Opcode::SIN:       return trig<true>;
+        case Opcode::COS:       return trig<false>;
+        case Opcode::ATAN:      return unary<Atan>;
+        case Opcode::EXP:       return unary<Exp>;
+        case Opcode::ABS:       return unary<Abs>;
+        case Opcode::RECIP:     return unary<Recip>;
+        case Opcode::CONST_VAR: return unary<Copy>;
+
+        // These are rare in practice, so they use the portable kernels
+        case Opcode::TAN:
+        case Opcode::ASIN:
+        case Opcode::ACOS:
+        case Opcode::POW:
+        case Opcode::NTH_ROOT:
+            return nullptr;
+
+        case Opcode::INVALID:
+        case Opcode::CONST:
+        case Opcode::VAR_X:
+        case Opcode::VAR_Y:
+        case Opcode::VAR_Z:
+        case Opcode::VAR:
+        case Opcode::LAST_OP:
+            return nullptr;
+    }
+    return nullptr;
+}
+
+}   // anonymous namespace
+
+#ifdef __clang__
+#pragma clang attribute pop
+#else
+#pragma GCC pop_options
+#endif
+
+static bool hasAvx2()
+{
+    static const bool out = []{
+        __builtin_cpu_init();
+        return __builtin_cpu_supports("avx2") &&
+               __builtin_cpu_supports("fma");
+    }();
+    return out;
+}
+
+Fn kernel(Opcode::Opcode op)
+{
+    return hasAvx2() ? avx2(op) : nullptr;
+}
+
+const char* isa()
+{
+    return hasAvx2() ? "avx2" : "none";
+}
+
+#else   // AO_SIMD_AVX2
+
+Fn kernel(Opcode::Opcode)
+{
+    return nullptr;
+}
+
+const char* isa()
+{
+    return "none";
+}
+
+#endif  // AO_SIMD_AVX2
+
+}   // namespace Simd
+
+}   // namespace Kernel
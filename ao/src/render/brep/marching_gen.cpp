@@ -0,0 +1,89 @@
+/*
+ *  Build-time tool that runs Marching::buildTable and writes the results
+ *  out as constant-initialized tables, so that the library doesn't need
+ *  to build them at runtime.
+ *
+ *  Usage: ao-marching-gen <output.cpp>
+ */
+#include <fstream>
+#include <iostream>
+
+#include "ao/render/brep/marching.hpp"
+
+using namespace Kernel;
+
+static void emit(std::ostream& out, int i)
+{
+    out << i;
+}
+
+static void emit(std::ostream& out, const Marching::Edge& e)
+{
+    out << "{" << e.first << "," << e.second << "}";
+}
+
+/*  Arrays are written fully braced, since brace elision can't reach
+ *  through the std::pair constructors  */
+template <typename T, size_t S>
+static void emit(std::ostream& out, const std::array<T, S>& a)
+{
+    out << "{{";
+    for (unsigned i=0; i < S; ++i)
+    {
+        if (i)
+        {
+            out << ",";
+        }
+        emit(out, a[i]);
+    }
+    out << "}}";
+}
+
+template <unsigned N>
+static void emit(std::ostream& out, const char* name)
+{
+    auto t = Marching::buildTable<N>();
+
+    out << "const MarchingTable<" << N << "> " << name << " = {\n";
+
+    // One line per corner mask, to keep the output readable
+    out << "{{\n";
+    for (unsigned i=0; i < t->v.size(); ++i)
+    {
+        emit(out, t->v[i]);
+        out << (i + 1 < t->v.size() ? ",\n" : "\n");
+    }
+    out << "}},\n";
+
+    emit(out, t->e);
+    out << ",\n";
+
+    out << "{{\n";
+    for (unsigned i=0; i < t->p.size(); ++i)
+    {
+        emit(out, t->p[i]);
+        out << (i + 1 < t->p.size() ? ",\n" : "\n");
+    }
+    out << "}}\n};\n\n";
+}
+
+int main(int argc, char** argv)
+{
+    if (argc != 2)
+    {
+        std::cerr << "Usage: " << argv[0] << " <output.cpp>\n";
+        return 1;
+    }
+
+    std::ofstream out(argv[1]);
+    out << "// Generated by ao-marching-gen; do not edit\n"
+        << "#include \"ao/render/brep/marching.hpp\"\n\n"
+        << "namespace Kernel {\n"
+        << "namespace Marching {\n\n";
+    emit<2>(out, "TABLE2");
+    emit<3>(out, "TABLE3");
+    out << "}   // namespace Marching\n"
+        << "}   // namespace Kernel\n";
+
+    return out.good() ? 0 : 1;
+}
@@ -1,5 +1,11 @@
+#include <algorithm>
+#include <cassert>
+#include <cstring>
+#include <cstdio>
 #include <numeric>
 #include <fstream>
+#include <functional>
+#include <thread>
 #include <boost/algorithm/string/predicate.hpp>
 
 #include "ao/render/brep/mesh.hpp"
@@ -8,8 +14,8 @@
 
 namespace Kernel {
 
-template <Axis::Axis A, bool D>
-void Mesh::load(const std::array<const XTree<3>*, 4>& ts)
+template <Axis::Axis A, bool D, typename Out>
+void Mesh::loadQuad(const std::array<const XTree<3>*, 4>& ts, Out& out)
 {
     int es[4];
     {   // Unpack edge vertex pairs into edge indices
@@ -29,6 +35,7 @@ void Mesh::load(const std::array<const XTree<3>*, 4>& ts)
     }
 
     uint32_t vs[4];
+    Eigen::Vector3f ps[4];
     for (unsigned i=0; i < ts.size(); ++i)
     {
         // Load either a patch-specific vertex (if this is a lowest-level,
@@ -41,19 +48,19 @@ void Mesh::load(const std::array<const XTree<3>*, 4>& ts)
         // Sanity-checking manifoldness of collapsed cells
         assert(ts[i]->level == 0 || ts[i]->vertex_count == 1);
 
-        if (ts[i]->index[vi] == 0)
+        ps[i] = ts[i]->vert(vi).template cast<float>();
+        if (ts[i]->leaf->index[vi] == 0)
         {
-            ts[i]->index[vi] = verts.size();
-
-            verts.push_back(ts[i]->vert(vi).template cast<float>());
+            ts[i]->leaf->index[vi] = out.vertex(ts[i], vi, ps[i]);
         }
-        vs[i] = ts[i]->index[vi];
+        vs[i] = ts[i]->leaf->index[vi];
     }
 
     // Handle polarity-based windings
     if (!D)
     {
         std::swap(vs[1], vs[2]);
+        std::swap(ps[1], ps[2]);
     }
 
     // Pick a triangulation that prevents triangles from folding back
@@ -61,21 +68,40 @@ void Mesh::load(const std::array<const XTree<3>*, 4>& ts)
     std::array<Eigen::Vector3f, 4> norms;
     for (unsigned i=0; i < norms.size(); ++i)
     {
-        norms[i] = (verts[vs[(i + 3) % 4]] - verts[vs[i]]).cross
-                   (verts[vs[(i + 1) % 4]] - verts[vs[i]]).normalized();
+        norms[i] = (ps[(i + 3) % 4] - ps[i]).cross
+                   (ps[(i + 1) % 4] - ps[i]).normalized();
     }
     if (norms[0].dot(norms[3]) > norms[1].dot(norms[2]))
     {
-        branes.push_back({vs[0], vs[1], vs[2]});
-        branes.push_back({vs[2], vs[1], vs[3]});
+        out.triangle({vs[0], vs[1], vs[2]}, {{ps[0], ps[1], ps[2]}});
+        out.triangle({vs[2], vs[1], vs[3]}, {{ps[2], ps[1], ps[3]}});
     }
     else
     {
-        branes.push_back({vs[0], vs[1], vs[3]});
-        branes.push_back({vs[0], vs[3], vs[2]});
+        out.triangle({vs[0], vs[1], vs[3]}, {{ps[0], ps[1], ps[3]}});
+        out.triangle({vs[0], vs[3], vs[2]}, {{ps[0], ps[3], ps[2]}});
     }
 }
 
+template <Axis::Axis A, bool D>
+void Mesh::load(const std::array<const XTree<3>*, 4>& ts)
+{
+    loadQuad<A, D>(ts, *this);
+}
+
+uint32_t Mesh::vertex(const XTree<3>* t, unsigned vi, const Eigen::Vector3f& v)
+{
+    claimed.push_back({t, vi});
+    verts.push_back(v);
+    return verts.size() - 1;
+}
+
+void Mesh::triangle(const Eigen::Matrix<uint32_t, 3, 1>& t,
+                    const std::array<Eigen::Vector3f, 3>&)
+{
+    branes.push_back(t);
+}
+
 ////////////////////////////////////////////////////////////////////////////////
 
 std::unique_ptr<Mesh> Mesh::render(const Tree t, const Region<3>& r,
@@ -89,24 +115,48 @@ std::unique_ptr<Mesh> Mesh::render(const Tree t, const Region<3>& r,
 std::unique_ptr<Mesh> Mesh::render(
             const Tree t, const std::map<Tree::Id, float>& vars,
             const Region<3>& r, double min_feature, double max_err,
-            std::atomic_bool& cancel)
+            std::atomic_bool& cancel, unsigned workers)
 {
     // Create the octree (multithreaded and cancellable)
-    return mesh(XTree<3>::build(
-            t, vars, r, min_feature, max_err, true, cancel), cancel);
+    auto xtree = XTree<3>::build(
+            t, vars, r, min_feature, max_err, workers, cancel);
+    return mesh(xtree.get(), cancel, workers);
 }
 
 std::unique_ptr<Mesh> Mesh::render(
-        Evaluator* es,
+        const std::vector<Evaluator*>& es,
         const Region<3>& r, double min_feature, double max_err,
         std::atomic_bool& cancel)
 {
-    return mesh(XTree<3>::build(es, r, min_feature, max_err, true, cancel),
-                cancel);
+    auto xtree = XTree<3>::build(es, r, min_feature, max_err, cancel);
+    return mesh(xtree.get(), cancel, es.size());
+}
+
+std::unique_ptr<Mesh> Mesh::render(
+        const std::vector<Evaluator*>& es,
+        const Region<3>& r, double min_feature, double max_err,
+        std::atomic_bool& cancel, std::unique_ptr<const XTree<3>>& xtree,
+        const std::set<Tree::Id>& changed)
+{
+    // The dual walk still covers the whole tree, since vertex numbering
+    // is global, but it doesn't evaluate anything
+    xtree = XTree<3>::rebuild(es, r, min_feature, max_err, cancel,
+                              std::move(xtree), changed);
+    return mesh(xtree.get(), cancel, es.size());
+}
+
+std::unique_ptr<Mesh> Mesh::refine(
+        const std::vector<Evaluator*>& es,
+        const Region<3>& r, double min_feature, double max_err,
+        std::atomic_bool& cancel, std::unique_ptr<const XTree<3>>& xtree)
+{
+    xtree = XTree<3>::refine(es, r, min_feature, max_err, cancel,
+                             std::move(xtree));
+    return mesh(xtree.get(), cancel, es.size());
 }
 
-std::unique_ptr<Mesh> Mesh::mesh(std::unique_ptr<const XTree<3>> xtree,
-                                 std::atomic_bool& cancel)
+std::unique_ptr<Mesh> Mesh::mesh(const XTree<3>* xtree,
+                                 std::atomic_bool& cancel, unsigned workers)
 {
     // Perform marching squares
     auto m = std::unique_ptr<Mesh>(new Mesh());
@@ -117,18 +167,18 @@ std::unique_ptr<Mesh> Mesh::mesh(std::unique_ptr<const XTree<3>> xtree,
     }
     else
     {
-        Dual<3>::walk(xtree.get(), *m);
+        m->walk(xtree, workers);
 
 #if DEBUG_OCTREE_CELLS
         // Store octree cells as lines
-        std::list<const XTree<3>*> todo = {xtree.get()};
+        std::list<const XTree<3>*> todo = {xtree};
         while (todo.size())
         {
             auto t = todo.front();
             todo.pop_front();
             if (t->isBranch())
-                for (auto& c : t->children)
-                    todo.push_back(c.get());
+                for (auto& c : *t->children)
+                    todo.push_back(&c);
 
             static const std::vector<std::pair<uint8_t, uint8_t>> es =
                 {{0, Axis::X}, {0, Axis::Y}, {0, Axis::Z},
@@ -147,6 +197,267 @@ std::unique_ptr<Mesh> Mesh::mesh(std::unique_ptr<const XTree<3>> xtree,
     }
 }
 
+/*
+ *  Visitor for the streaming dual walk, which passes vertices and triangles
+ *  straight to a sink and prunes the octree as it goes
+ */
+class Mesh::Stream
+{
+public:
+    Stream(MeshSink& sink) : sink(sink) {}
+
+    template <Axis::Axis A, bool D>
+    void load(const std::array<const XTree<3>*, 4>& ts)
+    {
+        loadQuad<A, D>(ts, *this);
+    }
+
+    uint32_t vertex(const XTree<3>*, unsigned, const Eigen::Vector3f& v)
+    {
+        sink.vertex(v);
+        return ++count;
+    }
+
+    void triangle(const Eigen::Matrix<uint32_t, 3, 1>& t,
+                  const std::array<Eigen::Vector3f, 3>& pos)
+    {
+        sink.triangle(t, pos);
+    }
+
+    /*
+     *  Equivalent to Dual<3>::walk, but releases cells after they're done
+     */
+    void walk(const XTree<3>* t)
+    {
+        if (t->isBranch())
+        {
+            for (auto& c : *t->children)
+            {
+                walk(&c);
+            }
+            Dual<3>::seams(t, *this);
+
+            // Later seams only reach into t along its boundary, so any
+            // cell that doesn't touch the boundary is finished with
+            prune(t, t->region);
+        }
+    }
+
+    /*
+     *  Builds and walks a tree over the region r, whose top levels are
+     *  split evenly into tiles.  Each tile is built with the given function
+     *  (which returns nullptr if cancelled), walked, and pruned before the
+     *  next tile is built.  Returns nullptr if cancelled.
+     */
+    std::unique_ptr<const XTree<3>> walkTiles(
+            const Region<3>& r, unsigned levels,
+            std::function<std::unique_ptr<const XTree<3>>(const Region<3>&)>
+                build)
+    {
+        if (levels == 0)
+        {
+            auto t = build(r);
+            if (t)
+            {
+                walk(t.get());
+            }
+            return t;
+        }
+
+        auto b = XTree<3>::branch(r);
+        auto rs = r.subdivide();
+        for (unsigned i=0; i < b->children->size(); ++i)
+        {
+            auto t = walkTiles(rs[i], levels - 1, build);
+            if (!t)
+            {
+                return nullptr;
+            }
+            b->setChild(i, std::move(t));
+        }
+
+        Dual<3>::seams(b.get(), *this);
+        prune(b.get(), r);
+        return b;
+    }
+
+protected:
+    /*
+     *  Collapses every cell below t that doesn't touch the boundary of r
+     *  (these cells are kept as leaves, since their parents still need to
+     *  be branches, but their subtrees are released)
+     */
+    static void prune(const XTree<3>* t, const Region<3>& r)
+    {
+        for (auto& c : *t->children)
+        {
+            if (!c.isBranch())
+            {
+                continue;
+            }
+            else if ((c.region.lower == r.lower).any() ||
+                     (c.region.upper == r.upper).any())
+            {
+                prune(&c, r);
+            }
+            else
+            {
+                // The tree is owned by stream, and was built non-const,
+                // so it's safe to modify it here
+                const_cast<XTree<3>&>(c).children.reset();
+            }
+        }
+    }
+
+    MeshSink& sink;
+    uint32_t count=0;
+};
+
+bool Mesh::render(const Tree t, const std::map<Tree::Id, float>& vars,
+                  const Region<3>& r, double min_feature, double max_err,
+                  std::atomic_bool& cancel, MeshSink& sink, unsigned workers)
+{
+    // The octree is built in full before streaming begins, so this only
+    // saves the Mesh's storage (renderTiled builds and walks together)
+    auto xtree = XTree<3>::build(t, vars, r, min_feature, max_err,
+                                 workers, cancel);
+    if (cancel.load())
+    {
+        return false;
+    }
+    stream(std::move(xtree), sink);
+    return true;
+}
+
+void Mesh::stream(std::unique_ptr<const XTree<3>> xtree, MeshSink& sink)
+{
+    Stream s(sink);
+    s.walk(xtree.get());
+}
+
+bool Mesh::renderTiled(const Tree t, const std::map<Tree::Id, float>& vars,
+                       const Region<3>& r, double min_feature, double max_err,
+                       std::atomic_bool& cancel, MeshSink& sink,
+                       unsigned tile_levels, unsigned workers)
+{
+    // Build one set of evaluators, shared by every tile
+    std::vector<Evaluator*> es = {new Evaluator(t, vars)};
+    for (unsigned i=1; i < std::max(workers, 1u); ++i)
+    {
+        es.push_back(new Evaluator(*es.front()));
+    }
+
+    Stream s(sink);
+    auto root = s.walkTiles(r, tile_levels,
+            [&](const Region<3>& tile)
+            {
+                return XTree<3>::build(es, tile, min_feature, max_err, cancel);
+            });
+
+    for (auto e : es)
+    {
+        delete e;
+    }
+    return root != nullptr;
+}
+
+void Mesh::walk(const XTree<3>* t, unsigned workers)
+{
+    if (workers <= 1)
+    {
+        Dual<3>::walk(t, *this);
+    }
+    else
+    {
+        // Split the top SPLIT_LEVELS of the tree into a sequence of jobs,
+        // in the order that a serial walk would visit them.  A subtree job
+        // is a full walk of that subtree; a seam job is the face and edge
+        // procedures across a branch's children.  Each job only touches
+        // cells within its own subtree.
+        const unsigned SPLIT_LEVELS = 2;
+        std::vector<std::pair<const XTree<3>*, bool>> jobs;
+        std::vector<const XTree<3>*> subtrees;
+        std::function<void(const XTree<3>*, unsigned)> split =
+            [&](const XTree<3>* c, unsigned depth)
+            {
+                if (depth < SPLIT_LEVELS && c->isBranch())
+                {
+                    for (auto& child : *c->children)
+                    {
+                        split(&child, depth + 1);
+                    }
+                    jobs.push_back({c, true});
+                }
+                else
+                {
+                    jobs.push_back({c, false});
+                    subtrees.push_back(c);
+                }
+            };
+        split(t, 0);
+
+        // Walk subtrees in parallel, each into its own Mesh.  Vertex indices
+        // stamped into cells are local to that Mesh until it is absorbed.
+        std::vector<Mesh> meshes(subtrees.size());
+        std::atomic_uint next(0);
+        auto run = [&]()
+        {
+            for (unsigned i=next++; i < subtrees.size(); i=next++)
+            {
+                Dual<3>::walk(subtrees[i], meshes[i]);
+            }
+        };
+        std::vector<std::thread> threads;
+        for (unsigned i=1; i < workers; ++i)
+        {
+            threads.emplace_back(run);
+        }
+        run();
+        for (auto& th : threads)
+        {
+            th.join();
+        }
+
+        // Then merge in serial order, running seam jobs as we go (seams
+        // read indices stamped by earlier jobs, so they must come after
+        // those jobs have been absorbed).
+        unsigned i = 0;
+        for (auto& j : jobs)
+        {
+            if (j.second)
+            {
+                Dual<3>::seams(j.first, *this);
+            }
+            else
+            {
+                absorb(meshes[i++]);
+            }
+        }
+    }
+
+    // This list is only needed while merging
+    claimed.clear();
+    claimed.shrink_to_fit();
+}
+
+void Mesh::absorb(const Mesh& m)
+{
+    // Both meshes reserve vertex 0 as a marker, so vertex i in m
+    // becomes vertex i + offset here
+    const uint32_t offset = verts.size() - 1;
+
+    verts.insert(verts.end(), m.verts.begin() + 1, m.verts.end());
+    branes.reserve(branes.size() + m.branes.size());
+    for (const auto& b : m.branes)
+    {
+        branes.push_back((b.array() + offset).matrix());
+    }
+    for (const auto& c : m.claimed)
+    {
+        c.first->leaf->index[c.second] += offset;
+    }
+}
+
 void Mesh::line(Eigen::Vector3f a, Eigen::Vector3f b)
 {
     auto a_ = verts.size();
@@ -159,61 +470,289 @@ void Mesh::line(Eigen::Vector3f a, Eigen::Vector3f b)
 
 ////////////////////////////////////////////////////////////////////////////////
 
-bool Mesh::saveSTL(const std::string& filename,
-                   const std::list<const Mesh*>& meshes)
+/*
+ *  Accumulates output into large blocks before handing it to the stream,
+ *  rather than making a separate write call for every number
+ */
+class BlockWriter
 {
-    if (!boost::algorithm::iends_with(filename, ".stl"))
+public:
+    BlockWriter(std::ofstream& file) : file(file), buf(1 << 20), used(0) {}
+    ~BlockWriter() { flush(); }
+
+    void write(const void* data, size_t size)
     {
-        std::cerr << "Mesh::saveSTL: filename \"" << filename
-                  << "\" does not end in .stl" << std::endl;
+        if (used + size > buf.size())
+        {
+            flush();
+        }
+        memcpy(&buf[used], data, size);
+        used += size;
     }
-    std::ofstream file;
-    file.open(filename, std::ios::out);
+
+    template <typename T>
+    void put(const T& t) { write(&t, sizeof(t)); }
+
+    /*  Formats text into the buffer (lines must be under 128 chars)  */
+    template <typename... Args>
+    void print(const char* fmt, Args... args)
+    {
+        if (used + 128 > buf.size())
+        {
+            flush();
+        }
+        // snprintf returns the untruncated length, so clamp it to what
+        // was actually written (dropping the tail of an overlong line)
+        const int n = snprintf(&buf[used], 128, fmt, args...);
+        assert(n >= 0 && n < 128);
+        used += std::max(0, std::min(n, 127));
+    }
+
+    void flush()
+    {
+        file.write(buf.data(), used);
+        used = 0;
+    }
+
+protected:
+    std::ofstream& file;
+    std::vector<char> buf;
+    size_t used;
+};
+
+/*
+ *  Opens a file for a mesh writer, warning if the extension is unexpected
+ */
+static bool openMeshFile(std::ofstream& file, const std::string& filename,
+                         const std::string& ext, const std::string& caller)
+{
+    if (!boost::algorithm::iends_with(filename, ext))
+    {
+        std::cerr << caller << ": filename \"" << filename
+                  << "\" does not end in " << ext << std::endl;
+    }
+    file.open(filename, std::ios::out | std::ios::binary);
     if (!file.is_open())
     {
-        std::cout << "Mesh::saveSTL: could not open " << filename
+        std::cout << caller << ": could not open " << filename
                   << std::endl;
         return false;
     }
+    return true;
+}
+
+STLSink::STLSink(const std::string& filename)
+{
+    if (openMeshFile(file, filename, ".stl", "STLSink"))
+    {
+        out.reset(new BlockWriter(file));
+
+        // Write the header, with a placeholder triangle count
+        std::string header = "This is a binary STL exported from Ao.";
+        header.resize(80, ' ');
+        out->write(header.data(), header.size());
+        out->put(count);
+    }
+}
+
+STLSink::~STLSink()
+{
+    close();
+}
+
+void STLSink::triangle(const Eigen::Matrix<uint32_t, 3, 1>&,
+                       const std::array<Eigen::Vector3f, 3>& pos)
+{
+    if (out)
+    {
+        float record[12] = {0, 0, 0};
+        for (unsigned i=0; i < 3; ++i)
+        {
+            for (unsigned j=0; j < 3; ++j)
+            {
+                record[3 + i*3 + j] = pos[i][j];
+            }
+        }
+        out->write(record, sizeof(record));
+        out->put((uint16_t)0);
+        count++;
+    }
+}
+
+bool STLSink::close()
+{
+    if (!out)
+    {
+        return false;
+    }
+    out.reset();
 
-    // File header (giving human-readable info about file type)
-    std::string header = "This is a binary STL exported from Ao.";
-    file.write(header.c_str(), header.length());
+    // Go back and fill in the triangle count
+    file.seekp(80);
+    file.write(reinterpret_cast<const char*>(&count), sizeof(count));
+    file.close();
+    return !file.fail();
+}
 
-    // Pad the rest of the header to 80 bytes
-    for (int i=header.length(); i < 80; ++i)
+bool Mesh::saveSTL(const std::string& filename,
+                   const std::list<const Mesh*>& meshes)
+{
+    std::ofstream file;
+    if (!openMeshFile(file, filename, ".stl", "Mesh::saveSTL"))
     {
-        file.put(' ');
+        return false;
     }
 
-    // Write the triangle count to the file
-    uint32_t num = std::accumulate(meshes.begin(), meshes.end(), (uint32_t)0,
-            [](uint32_t i, const Mesh* m){ return i + m->branes.size(); });
-    file.write(reinterpret_cast<char*>(&num), sizeof(num));
+    {
+        BlockWriter out(file);
 
+        // File header (giving human-readable info about file type),
+        // padded to 80 bytes
+        std::string header = "This is a binary STL exported from Ao.";
+        header.resize(80, ' ');
+        out.write(header.data(), header.size());
+
+        // Write the triangle count to the file
+        uint32_t num = std::accumulate(meshes.begin(), meshes.end(), (uint32_t)0,
+                [](uint32_t i, const Mesh* m){ return i + m->branes.size(); });
+        out.put(num);
+
+        for (const auto& m : meshes)
+        {
+            for (const auto& t : m->branes)
+            {
+                // Each record is a normal vector (all zeros), three vertices
+                // (which are indices into the verts list), and an attribute
+                float record[12] = {0, 0, 0};
+                for (unsigned i=0; i < 3; ++i)
+                {
+                    const auto& v = m->verts[t[i]];
+                    for (unsigned j=0; j < 3; ++j)
+                    {
+                        record[3 + i*3 + j] = v[j];
+                    }
+                }
+                out.write(record, sizeof(record));
+                out.put((uint16_t)0);
+            }
+        }
+    }
+
+    return file.good();
+}
+
+bool Mesh::savePLY(const std::string& filename,
+                   const std::list<const Mesh*>& meshes)
+{
+    std::ofstream file;
+    if (!openMeshFile(file, filename, ".ply", "Mesh::savePLY"))
+    {
+        return false;
+    }
+
+    // Vertex 0 of each mesh is a marker, so it's skipped
+    size_t vert_count = 0;
+    size_t tri_count = 0;
     for (const auto& m : meshes)
     {
-        for (const auto& t : m->branes)
+        vert_count += m->verts.size() - 1;
+        tri_count += m->branes.size();
+    }
+
+    {
+        BlockWriter out(file);
+        out.print("ply\n"
+                  "format binary_little_endian 1.0\n"
+                  "comment Exported from Ao\n");
+        out.print("element vertex %zu\n", vert_count);
+        out.print("property float x\n"
+                  "property float y\n"
+                  "property float z\n");
+        out.print("element face %zu\n", tri_count);
+        out.print("property list uchar uint vertex_indices\n"
+                  "end_header\n");
+
+        for (const auto& m : meshes)
         {
-            // Write out the normal vector for this face (all zeros)
-            float norm[3] = {0, 0, 0};
-            file.write(reinterpret_cast<char*>(&norm), sizeof(norm));
+            for (auto v = m->verts.begin() + 1; v != m->verts.end(); ++v)
+            {
+                float xyz[3] = {v->x(), v->y(), v->z()};
+                out.write(xyz, sizeof(xyz));
+            }
+        }
 
-            // Iterate over vertices (which are indices into the verts list)
-            for (unsigned i=0; i < 3; ++i)
+        // Shift indices by 1 (for the marker) then by the mesh's offset
+        int64_t offset = -1;
+        for (const auto& m : meshes)
+        {
+            for (const auto& t : m->branes)
             {
-                auto v = m->verts[t[i]];
-                float vert[3] = {v.x(), v.y(), v.z()};
-                file.write(reinterpret_cast<char*>(&vert), sizeof(vert));
+                uint32_t face[3] = {uint32_t(t[0] + offset),
+                                    uint32_t(t[1] + offset),
+                                    uint32_t(t[2] + offset)};
+                out.put((uint8_t)3);
+                out.write(face, sizeof(face));
             }
+            offset += m->verts.size() - 1;
+        }
+    }
+
+    return file.good();
+}
 
-            // Write out this face's attribute short
-            uint16_t attrib = 0;
-            file.write(reinterpret_cast<char*>(&attrib), sizeof(attrib));
+bool Mesh::saveOBJ(const std::string& filename,
+                   const std::list<const Mesh*>& meshes)
+{
+    std::ofstream file;
+    if (!openMeshFile(file, filename, ".obj", "Mesh::saveOBJ"))
+    {
+        return false;
+    }
+
+    {
+        BlockWriter out(file);
+        out.print("# Exported from Ao\n");
+
+        // OBJ indices are 1-based, which lines up with skipping our marker
+        // vertex; for later meshes, they're shifted by the earlier ones
+        for (const auto& m : meshes)
+        {
+            for (auto v = m->verts.begin() + 1; v != m->verts.end(); ++v)
+            {
+                out.print("v %.9g %.9g %.9g\n", v->x(), v->y(), v->z());
+            }
+        }
+
+        size_t offset = 0;
+        for (const auto& m : meshes)
+        {
+            for (const auto& t : m->branes)
+            {
+                out.print("f %zu %zu %zu\n", t[0] + offset,
+                          t[1] + offset, t[2] + offset);
+            }
+            offset += m->verts.size() - 1;
         }
     }
 
-    return true;
+    return file.good();
+}
+
+bool Mesh::save(const std::string& filename,
+                const std::list<const Mesh*>& meshes)
+{
+    if (boost::algorithm::iends_with(filename, ".ply"))
+    {
+        return savePLY(filename, meshes);
+    }
+    else if (boost::algorithm::iends_with(filename, ".obj"))
+    {
+        return saveOBJ(filename, meshes);
+    }
+    else
+    {
+        return saveSTL(filename, meshes);
+    }
 }
 
 bool Mesh::saveSTL(const std::string& filename)
@@ -221,4 +760,19 @@ bool Mesh::saveSTL(const std::string& filename)
     return saveSTL(filename, {this});
 }
 
+bool Mesh::savePLY(const std::string& filename)
+{
+    return savePLY(filename, {this});
+}
+
+bool Mesh::saveOBJ(const std::string& filename)
+{
+    return saveOBJ(filename, {this});
+}
+
+bool Mesh::save(const std::string& filename)
+{
+    return save(filename, {this});
+}
+
 }   // namespace Kernel
@@ -1,5 +1,5 @@
-#include <future>
 #include <numeric>
+#include <thread>
 #include <functional>
 #include <limits>
 
@@ -13,9 +13,11 @@ namespace Kernel {
 //  Here's our cutoff value (with a value set in the header)
 template <unsigned N> constexpr double XTree<N>::EIGENVALUE_CUTOFF;
 
-//  Allocating static var for marching cubes table
-template <unsigned N>
-std::unique_ptr<const Marching::MarchingTable<N>> XTree<N>::mt;
+//  Pointers to the precomputed marching squares / cubes tables
+template <>
+const Marching::MarchingTable<2>* const XTree<2>::mt = &Marching::TABLE2;
+template <>
+const Marching::MarchingTable<3>* const XTree<3>::mt = &Marching::TABLE3;
 
 ////////////////////////////////////////////////////////////////////////////////
 
@@ -26,65 +28,209 @@ std::unique_ptr<const XTree<N>> XTree<N>::build(
 {
     std::atomic_bool cancel(false);
     const std::map<Tree::Id, float> vars;
-    return build(t, vars, region, min_feature, max_err, multithread, cancel);
+    const unsigned workers = multithread
+        ? std::max(std::thread::hardware_concurrency(), 1u) : 1;
+    return build(t, vars, region, min_feature, max_err, workers, cancel);
 }
 
 template <unsigned N>
 std::unique_ptr<const XTree<N>> XTree<N>::build(
             Tree t, const std::map<Tree::Id, float>& vars,
             Region<N> region, double min_feature,
-            double max_err, bool multithread,
-            std::atomic_bool& cancel)
+            double max_err, unsigned workers,
+            std::atomic_bool& cancel, Evaluator::RangeMode range)
 {
-    if (multithread)
+    // Fixing the perpendicular coordinates leaves a shorter tape
+    // to evaluate at every sample
+    t = specialize(t, region);
+
+    // Build one evaluator, then clone it for the other workers
+    // (which is much cheaper than building each from the tree)
+    std::vector<Evaluator*> es = {new Evaluator(t, vars)};
+    es.front()->setRangeMode(range);
+    for (unsigned i=1; i < std::max(workers, 1u); ++i)
     {
-        std::vector<Evaluator, Eigen::aligned_allocator<Evaluator>> es;
-        es.reserve(1 << N);
-        for (unsigned i=0; i < (1 << N); ++i)
-        {
-            es.emplace_back(Evaluator(t, vars));
-        }
-        return build(es.data(), region, min_feature, max_err, true, cancel);
+        es.push_back(new Evaluator(*es.front()));
     }
-    else
+
+    auto out = build(es, region, min_feature, max_err, cancel);
+
+    for (auto e : es)
+    {
+        delete e;
+    }
+    return out;
+}
+
+template <unsigned N>
+Tree XTree<N>::specialize(Tree t, const Region<N>& region)
+{
+    if (N == 3)
     {
-        Evaluator e(t, vars);
-        return build(&e, region, min_feature, max_err, false, cancel);
+        return t;
     }
+
+    Tree axes[3] = {Tree::X(), Tree::Y(), Tree::Z()};
+    for (unsigned i=N; i < 3; ++i)
+    {
+        axes[i] = Tree(static_cast<float>(region.perp(i - N)));
+    }
+    return t.remap(axes[0], axes[1], axes[2]);
+}
+
+template <unsigned N>
+std::unique_ptr<const XTree<N>> XTree<N>::build(
+        const std::vector<Evaluator*>& es,
+        Region<N> region, double min_feature,
+        double max_err, std::atomic_bool& cancel)
+{
+    return build(es, region, min_feature, max_err, cancel, nullptr,
+                 {0, false});
+}
+
+template <unsigned N>
+std::unique_ptr<const XTree<N>> XTree<N>::rebuild(
+        const std::vector<Evaluator*>& es,
+        Region<N> region, double min_feature,
+        double max_err, std::atomic_bool& cancel,
+        std::unique_ptr<const XTree<N>> prev,
+        const std::set<Tree::Id>& changed)
+{
+    // Every evaluator shares a program, so they agree on variable masks
+    return build(es, region, min_feature, max_err, cancel, std::move(prev),
+                 {es.front()->varMask(changed), false});
+}
+
+template <unsigned N>
+std::unique_ptr<const XTree<N>> XTree<N>::refine(
+        const std::vector<Evaluator*>& es,
+        Region<N> region, double min_feature,
+        double max_err, std::atomic_bool& cancel,
+        std::unique_ptr<const XTree<N>> prev)
+{
+    return build(es, region, min_feature, max_err, cancel, std::move(prev),
+                 {0, true});
 }
 
 template <unsigned N>
 std::unique_ptr<const XTree<N>> XTree<N>::build(
-        Evaluator* es,
+        const std::vector<Evaluator*>& es,
         Region<N> region, double min_feature,
-        double max_err, bool multithread,
-        std::atomic_bool& cancel)
+        double max_err, std::atomic_bool& cancel,
+        std::unique_ptr<const XTree<N>> prev, Reuse reuse)
 {
-    // Lazy initialization of marching squares / cubes table
-    if (mt.get() == nullptr)
+    // The previous tree is taken apart as the new one is built, then
+    // released when we return
+    auto p = const_cast<XTree<N>*>(prev.get());
+    auto mem = XTree<N>::operator new(sizeof(XTree<N>));
+
+    std::unique_ptr<const XTree<N>> out;
+    if (es.size() > 1)
     {
-        mt = Marching::buildTable<N>();
+        WorkPool pool(es);
+        pool.run([&](unsigned w){
+            out.reset(make(mem, pool.eval(w), region, min_feature, max_err,
+                           &pool, w, cancel, p, reuse)); });
+    }
+    else
+    {
+        out.reset(make(mem, es.front(), region, min_feature, max_err,
+                       nullptr, 0, cancel, p, reuse));
     }
-
-    auto out = new XTree(es, region, min_feature, max_err, multithread, cancel);
 
     // Return an empty XTree when cancelled
     // (to avoid potentially ambiguous or mal-constructed trees situations)
     if (cancel.load())
     {
-        delete out;
-        out = nullptr;
+        out.reset();
+    }
+    // If the root is itself a leaf, then it's left for us to finish
+    else if (out->type == Interval::UNKNOWN)
+    {
+        finishLeaves(es.front(), {const_cast<XTree<N>*>(out.get())});
     }
 
-    return std::unique_ptr<const XTree<N>>(out);
+    return out;
+}
+
+template <unsigned N>
+XTree<N>* XTree<N>::make(void* out,
+        Evaluator* eval, Region<N> region,
+        double min_feature, double max_err,
+        WorkPool* pool, unsigned worker,
+        std::atomic_bool& cancel,
+        XTree<N>* p, Reuse reuse,
+        const Interval::I* batch, unsigned box)
+{
+    if (p && !cancel.load())
+    {
+        bool same;
+        if (reuse.refine)
+        {
+            // Nothing but min_feature has changed, so there's no need to
+            // evaluate anything: exact states hold at any resolution
+            same = p->exact;
+        }
+        else
+        {
+            if (batch)
+            {
+                eval->push(box);
+            }
+            else
+            {
+                eval->eval(region.lower3().template cast<float>(),
+                           region.upper3().template cast<float>());
+                eval->push();
+            }
+            same = eval->tapeHash() == p->tape &&
+                   !(eval->varMask() & reuse.changed);
+            eval->pop();
+        }
+
+        if (same)
+        {
+            p->resetIndices();
+            return new (out) XTree<N>(std::move(*p));
+        }
+    }
+
+    return new (out) XTree<N>(eval, region, min_feature, max_err,
+                              pool, worker, cancel, p, reuse, batch, box);
+}
+
+template <unsigned N>
+std::unique_ptr<XTree<N>> XTree<N>::branch(Region<N> region)
+{
+    return std::unique_ptr<XTree<N>>(new XTree(region));
 }
 
 ////////////////////////////////////////////////////////////////////////////////
 
+template <unsigned N>
+void XTree<N>::setChild(unsigned i, std::unique_ptr<const XTree<N>> t)
+{
+    // The old root's storage is released when t goes out of scope
+    new (children->slot(i)) XTree<N>(std::move(*const_cast<XTree<N>*>(t.get())));
+    children->markBuilt(i);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+template <unsigned N>
+XTree<N>::XTree(Region<N> region)
+    : region(region), children(new Children), type(Interval::AMBIGUOUS)
+{
+    // Nothing to do here
+}
+
 template <unsigned N>
 XTree<N>::XTree(Evaluator* eval, Region<N> region,
-                double min_feature, double max_err, bool multithread,
-                std::atomic_bool& cancel)
+                double min_feature, double max_err,
+                WorkPool* pool, unsigned worker,
+                std::atomic_bool& cancel,
+                XTree* prev, Reuse reuse,
+                const Interval::I* batch, unsigned box)
     : region(region)
 {
     if (cancel.load())
@@ -92,62 +238,108 @@ XTree<N>::XTree(Evaluator* eval, Region<N> region,
         return;
     }
 
-    // Clear all indices
-    std::fill(index.begin(), index.end(), 0);
+    // Do a preliminary evaluation to prune the tree, unless our parent
+    // already did so while evaluating all of its children
+    Interval::I i;
+    if (batch)
+    {
+        i = batch[box];
+        eval->push(box);
+    }
+    else
+    {
+        i = eval->eval(region.lower3().template cast<float>(),
+                       region.upper3().template cast<float>());
+        eval->push();
+    }
+    tape = eval->tapeHash();
 
-    // Do a preliminary evaluation to prune the tree
-    auto i = eval->eval(region.lower3().template cast<float>(),
-                        region.upper3().template cast<float>());
+    // Children of the previous cell (if any) are offered up for re-use
+    auto prev_child = [&](unsigned c)
+    {
+        return (prev && prev->isBranch()) ? &(*prev->children)[c] : nullptr;
+    };
 
-    eval->push();
     if (Interval::isFilled(i))
     {
         type = Interval::FILLED;
+        exact = true;
     }
     else if (Interval::isEmpty(i))
     {
         type = Interval::EMPTY;
+        exact = true;
     }
     // If the cell wasn't empty or filled, attempt to subdivide and recurse
     else
     {
         bool all_empty = true;
         bool all_full  = true;
+        bool all_exact = true;
 
         // Recurse until volume is too small
         if (((region.upper - region.lower) > min_feature).any())
         {
             auto rs = region.subdivide();
+            children.reset(new Children);
 
-            if (multithread)
+            // Builds the ith child with the given evaluator and worker,
+            // using batched interval results if they're available
+            auto build = [&](unsigned i, Evaluator* e, unsigned w,
+                             const Interval::I* batch)
             {
-                // Evaluate every child in a separate thread
-                std::array<std::future<XTree<N>*>, 1 << N> futures;
-
-                assert(children.size() == futures.size());
-
-                for (unsigned i=0; i < children.size(); ++i)
-                {
-                    futures[i] = std::async(std::launch::async,
-                        [&eval, &rs, i, min_feature, max_err, &cancel]()
-                        { return new XTree(
-                                eval + i, rs[i], min_feature, max_err,
-                                false, cancel); });
-                }
-                for (unsigned i=0; i < children.size(); ++i)
+                make(children->slot(i), e, rs[i], min_feature, max_err,
+                     pool, w, cancel, prev_child(i), reuse, batch, i);
+                children->markBuilt(i);
+            };
+
+            // If other workers are idle (and the children will subdivide
+            // further, so that there's enough work to be worth sharing),
+            // then queue all but the first child as separate tasks.
+            //
+            // Whichever worker picks up a task doesn't have our tape on its
+            // stack, so it starts with a push from its own base tape.
+            if (pool && pool->hungry() &&
+                ((rs[0].upper - rs[0].lower) > min_feature).any())
+            {
+                std::atomic_uint pending(children->size() - 1);
+                for (unsigned i=1; i < children->size(); ++i)
                 {
-                    children[i].reset(futures[i].get());
+                    pool->spawn(worker,
+                        [&, i](unsigned w)
+                        {
+                            auto e = pool->eval(w);
+                            e->pushBase(rs[i].lower3().template cast<float>(),
+                                        rs[i].upper3().template cast<float>());
+                            build(i, e, w, nullptr);
+                            e->pop();
+                            pending--;
+                        });
                 }
+
+                build(0, eval, worker, nullptr);
+
+                // Run queued tasks (including our own children, if they
+                // haven't been stolen) until every child is finished
+                pool->wait(worker, pending);
             }
             // Single-threaded recursive construction
             else
             {
-                for (uint8_t i=0; i < children.size(); ++i)
+                // Evaluate every child in a single pass over our tape
+                static_assert((1 << N) <= Result::K,
+                              "Children must fit in one interval batch");
+                for (uint8_t i=0; i < children->size(); ++i)
+                {
+                    eval->set(rs[i].lower3().template cast<float>(),
+                              rs[i].upper3().template cast<float>(), i);
+                }
+                auto batch = eval->intervals(children->size());
+
+                for (uint8_t i=0; i < children->size(); ++i)
                 {
                     // Populate child recursively
-                    children[i].reset(new XTree<N>(
-                                eval, rs[i], min_feature, max_err,
-                                false, cancel));
+                    build(i, eval, worker, batch);
                 }
             }
 
@@ -159,62 +351,40 @@ XTree<N>::XTree(Evaluator* eval, Region<N> region,
                 return;
             }
 
-            // Update corner and filled / empty state from children
-            for (uint8_t i=0; i < children.size(); ++i)
-            {
-                // Grab corner values from children
-                corners[i] = children[i]->corners[i];
-
-                all_empty &= children[i]->type == Interval::EMPTY;
-                all_full  &= children[i]->type == Interval::FILLED;
-            }
-        }
-        // Terminate recursion here
-        else
-        {
-            // Pack corners into evaluator
-            std::array<Eigen::Vector3f, 1 << N> pos;
-            for (uint8_t i=0; i < children.size(); ++i)
-            {
-                pos[i] << cornerPos(i).template cast<float>(),
-                          region.perp.template cast<float>();
-                eval->set(pos[i], i);
-            }
-
-            // Evaluate the region's corners and check their states
-            auto ds = eval->derivs(children.size());
-            auto ambig = eval->getAmbiguous(children.size());
-            for (uint8_t i=0; i < children.size(); ++i)
+            // Finish any leaves among the children under this cell's tape,
+            // so that their evaluations share batches
+            std::vector<XTree<N>*> leaves;
+            for (uint8_t i=0; i < children->size(); ++i)
             {
-                // Handle inside, outside, and (non-ambiguous) on-boundary
-                if (ds.v[i] < 0)      { corners[i] = Interval::FILLED; }
-                else if (ds.v[i] > 0) { corners[i] = Interval::EMPTY; }
-                else if (!ambig(i))
+                if ((*children)[i].type == Interval::UNKNOWN)
                 {
-                    // Optimization for non-ambiguous features
-                    // (see explanation in Evaluator::isInside)
-                    corners[i] = (ds.d.col(i) != 0).any()
-                        ? Interval::FILLED : Interval::EMPTY;
+                    leaves.push_back(&(*children)[i]);
                 }
             }
+            finishLeaves(eval, leaves);
 
-            // Separate pass for handling ambiguous corners
-            for (uint8_t i=0; i < children.size(); ++i)
+            // Update corner and filled / empty state from children
+            for (uint8_t i=0; i < children->size(); ++i)
             {
-                if (ds.v[i] == 0 && ambig(i))
-                {
-                    corners[i] = eval->isInside(pos[i])
-                        ? Interval::FILLED : Interval::EMPTY;
-                }
-            }
+                const auto& c = (*children)[i];
 
-            // Pack corners into filled / empty arrays
-            for (uint8_t i=0; i < children.size(); ++i)
-            {
-                all_full  &=  corners[i];
-                all_empty &= !corners[i];
+                // Grab corner values from children
+                corner_mask |= c.corner_mask & (1 << i);
+
+                all_empty &= c.type == Interval::EMPTY;
+                all_full  &= c.type == Interval::FILLED;
+                all_exact &= c.exact;
             }
         }
+        // Terminate recursion here, leaving the cell's type as UNKNOWN:
+        // leaves are sampled and searched by their parent (or by build,
+        // for a lone root), which batches them together in finishLeaves
+        else
+        {
+            eval->pop();
+            return;
+        }
+        exact = all_exact && (all_empty || all_full);
         type = all_empty ? Interval::EMPTY
              : all_full  ? Interval::FILLED : Interval::AMBIGUOUS;
     }
@@ -223,61 +393,61 @@ XTree<N>::XTree(Evaluator* eval, Region<N> region,
     // forget all its branches; these may be no-ops, but they're idempotent
     if (type == Interval::FILLED || type == Interval::EMPTY)
     {
-        std::fill(corners.begin(), corners.end(), type);
-        std::for_each(children.begin(), children.end(),
-            [](std::unique_ptr<const XTree<N>>& o) { o.reset(); });
+        corner_mask = (type == Interval::FILLED) ? (1 << (1 << N)) - 1 : 0;
+        children.reset();
         manifold = true;
     }
 
-    // Build and store the corner mask
-    for (unsigned i=0; i < children.size(); ++i)
-    {
-        corner_mask |= (corners[i] == Interval::FILLED) << i;
-    }
-
     // Branch checking and simplifications
     if (isBranch())
     {
         // Store this tree's depth as a function of its children
-        level = std::accumulate(children.begin(), children.end(), (unsigned)0,
-            [](const unsigned& a, const std::unique_ptr<const XTree<N>>& b)
-            { return std::max(a, b->level);} ) + 1;
+        level = std::accumulate(children->begin(), children->end(),
+            (unsigned)0, [](unsigned a, const XTree<N>& b)
+            { return std::max(a, b.level);} ) + 1;
 
         // If all children are non-branches, then we could collapse
-        if (std::all_of(children.begin(), children.end(),
-                        [](const std::unique_ptr<const XTree<N>>& o)
-                        { return !o->isBranch(); }))
+        if (std::all_of(children->begin(), children->end(),
+                        [](const XTree<N>& o) { return !o.isBranch(); }))
         {
             //  This conditional implements the three checks described in
             //  [Ju et al, 2002] in the section titled
             //      "Simplification with topology safety"
             manifold = cornersAreManifold() &&
-                std::all_of(children.begin(), children.end(),
-                        [](const std::unique_ptr<const XTree<N>>& o)
-                        { return o->manifold; }) &&
+                std::all_of(children->begin(), children->end(),
+                        [](const XTree<N>& o) { return o.manifold; }) &&
                 leafsAreManifold();
 
             // Attempt to collapse this tree by positioning the vertex
             // in the summed QEF and checking to see if the error is small
             if (manifold)
             {
+                leaf.reset(new Leaf);
+
                 // Populate the feature rank as the maximum of all children
                 // feature ranks (as seen in DC: The Secret Sauce)
-                rank = std::accumulate(
-                        children.begin(), children.end(), (unsigned)0,
-                        [](unsigned a, const std::unique_ptr<const XTree<N>>& b)
-                            { return std::max(a, b->rank);} );
+                // (children without vertices have nothing to contribute)
+                for (const auto& c : *children)
+                {
+                    if (c.leaf)
+                    {
+                        leaf->rank = std::max(leaf->rank, c.leaf->rank);
+                    }
+                }
 
                 // Accumulate the mass point and QEF matrices
-                for (const auto& c : children)
+                for (const auto& c : *children)
                 {
-                    if (c->rank == rank)
+                    if (c.leaf)
                     {
-                        _mass_point += c->_mass_point;
+                        if (c.leaf->rank == leaf->rank)
+                        {
+                            leaf->mass_point += c.leaf->mass_point;
+                        }
+                        leaf->AtA += c.leaf->AtA;
+                        leaf->AtB += c.leaf->AtB;
+                        leaf->BtB += c.leaf->BtB;
                     }
-                    AtA += c->AtA;
-                    AtB += c->AtB;
-                    BtB += c->BtB;
                 }
                 assert(region.contains(massPoint()));
 
@@ -288,258 +458,379 @@ XTree<N>::XTree(Evaluator* eval, Region<N> region,
                     fabs(eval->baseEval(vert3().template cast<float>())) <
                         max_err)
                 {
-                    std::for_each(children.begin(), children.end(),
-                        [](std::unique_ptr<const XTree<N>>& o) { o.reset(); });
+                    children.reset();
                 }
                 else
                 {
                     vertex_count = 0;
+                    leaf.reset();
                 }
             }
         }
     }
-    else if (type == Interval::AMBIGUOUS)
+
+    // ...and we're done.
+    eval->pop();
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+template <unsigned N>
+void XTree<N>::finishLeaves(Evaluator* eval,
+                            const std::vector<XTree<N>*>& leaves)
+{
+    constexpr unsigned CORNERS = 1 << N;
+    static_assert(CORNERS <= Result::N, "Too many corners");
+
+    // Loads a position into the evaluator (which requires a Vector3f,
+    // so the leaf's perpendicular coordinates are filled in), returning it
+    auto set = [&](const Vec& v, const XTree<N>* cell, Result::Index i){
+        Eigen::Vector3f pos;
+        pos << v.template cast<float>(),
+               cell->region.perp.template cast<float>();
+        eval->set(pos, i);
+        return pos;
+    };
+
+    // Evaluate every leaf's corners, packing as many leaves as will fit
+    // into each call to the evaluator
+    for (unsigned start=0; start < leaves.size(); start += Result::N / CORNERS)
     {
-        // Figure out if the leaf is manifold
-        manifold = cornersAreManifold();
-
-        // Here, we'll prepare to store position, {normal, value} pairs
-        // for every crossing and feature
-        typedef std::pair<Vec, Eigen::Matrix<double, N + 1, 1>> Intersection;
-        std::vector<Intersection, Eigen::aligned_allocator<Intersection>>
-            intersections;
-
-        // RAM is cheap, so reserve a bunch of space here to avoid
-        // the need for re-allocating later on
-        intersections.reserve(_edges(N) * 2);
-
-        // We'll use this vector anytime we need to pass something
-        // into the evaluator (which requires a Vector3f)
-        Eigen::Vector3f _pos;
-        _pos.template tail<3 - N>() = region.perp.template cast<float>();
-        auto set = [&](const Vec& v, Result::Index i){
-            _pos.template head<N>() = v.template cast<float>();
-            eval->set(_pos, i);
-        };
+        const unsigned count = std::min<unsigned>(
+                Result::N / CORNERS, leaves.size() - start) * CORNERS;
+
+        std::array<Eigen::Vector3f, Result::N> pos;
+        for (unsigned i=0; i < count; ++i)
+        {
+            const auto cell = leaves[start + i / CORNERS];
+            pos[i] = set(cell->cornerPos(i % CORNERS).matrix(), cell, i);
+        }
+
+        // Evaluate the corners and check their states.  The ambiguity
+        // flags are copied out, since isInside clobbers the evaluator.
+        std::array<Interval::State, Result::N> corners;
+        auto ds = eval->derivs(count);
+        const Eigen::Array<bool, Result::N, 1> ambig =
+            eval->getAmbiguous(count);
+        for (unsigned i=0; i < count; ++i)
+        {
+            auto& corner = corners[i];
+
+            // Handle inside, outside, and (non-ambiguous) on-boundary
+            if (ds.v[i] < 0)      { corner = Interval::FILLED; }
+            else if (ds.v[i] > 0) { corner = Interval::EMPTY; }
+            else if (!ambig(i))
+            {
+                // Optimization for non-ambiguous features
+                // (see explanation in Evaluator::isInside)
+                corner = (ds.d.col(i) != 0).any()
+                    ? Interval::FILLED : Interval::EMPTY;
+            }
+            else
+            {
+                corner = Interval::UNKNOWN;
+            }
+        }
 
-        // Iterate over manifold patches for this corner case
-        const auto& ps = mt->v[corner_mask];
-        while (vertex_count < ps.size() && ps[vertex_count][0].first != -1)
+        // Separate pass for handling ambiguous corners
+        for (unsigned i=0; i < count; ++i)
         {
-            // Iterate over edges in this patch, storing [inside, outside]
-            unsigned target_count;
-            std::array<std::pair<Vec, Vec>, _edges(N)> targets;
-            for (target_count=0; target_count < ps[vertex_count].size() &&
-                          ps[vertex_count][target_count].first != -1; ++target_count)
+            if (corners[i] == Interval::UNKNOWN)
+            {
+                corners[i] = eval->isInside(pos[i])
+                    ? Interval::FILLED : Interval::EMPTY;
+            }
+        }
+
+        // Build and store the corner masks
+        for (unsigned i=0; i < count; ++i)
+        {
+            leaves[start + i / CORNERS]->corner_mask |=
+                (corners[i] == Interval::FILLED) << (i % CORNERS);
+        }
+    }
+
+    // Here's where we'll store [inside, outside] positions for every edge
+    // that we search, along with the patch that the edge belongs to
+    struct Target
+    {
+        Vec inside;
+        Vec outside;
+        unsigned patch;
+    };
+    std::vector<Target, Eigen::aligned_allocator<Target>> targets;
+
+    // Each patch owns a contiguous run of targets
+    struct Patch
+    {
+        XTree<N>* cell;
+        unsigned first;
+        unsigned count;
+    };
+    std::vector<Patch> patches;
+
+    for (auto cell : leaves)
+    {
+        // Sampling corners doesn't prove anything about the interior,
+        // so none of these states are exact
+        cell->type = (cell->corner_mask == 0) ? Interval::EMPTY
+                   : (cell->corner_mask == (1 << CORNERS) - 1)
+                        ? Interval::FILLED : Interval::AMBIGUOUS;
+
+        if (cell->type != Interval::AMBIGUOUS)
+        {
+            cell->manifold = true;
+            continue;
+        }
+
+        // Figure out if the leaf is manifold, and make room for vertices
+        cell->manifold = cell->cornersAreManifold();
+        cell->leaf.reset(new Leaf);
+
+        // Iterate over manifold patches for this corner case,
+        // storing every edge in each patch as a search target
+        const auto& ps = mt->v[cell->corner_mask];
+        for (unsigned p=0; p < ps.size() && ps[p][0].first != -1; ++p)
+        {
+            Patch patch = {cell, static_cast<unsigned>(targets.size()), 0};
+            for (; patch.count < ps[p].size() &&
+                   ps[p][patch.count].first != -1; ++patch.count)
             {
                 // Sanity-checking
-                assert(corners[ps[vertex_count][target_count].first]
+                assert(cell->cornerState(ps[p][patch.count].first)
                        == Interval::FILLED);
-                assert(corners[ps[vertex_count][target_count].second]
+                assert(cell->cornerState(ps[p][patch.count].second)
                        == Interval::EMPTY);
 
-                // Store inside / outside in targets array
-                targets[target_count] = {cornerPos(ps[vertex_count][target_count].first),
-                                  cornerPos(ps[vertex_count][target_count].second)};
+                targets.push_back({cell->cornerPos(ps[p][patch.count].first),
+                                   cell->cornerPos(ps[p][patch.count].second),
+                                   static_cast<unsigned>(patches.size())});
             }
+            patches.push_back(patch);
+        }
+    }
+
+    // We do an N-fold reduction at each stage, searching as many edges
+    // as will fit into each call to the evaluator
+    constexpr unsigned SEARCH_COUNT = 4;
+    constexpr unsigned POINTS_PER_SEARCH = 16;
+    constexpr unsigned SEARCHES_PER_BATCH = Result::N / POINTS_PER_SEARCH;
+    static_assert(SEARCHES_PER_BATCH > 0, "Too many points per search");
 
-            // We do an N-fold reduction at each stage
-            constexpr int SEARCH_COUNT = 4;
-            constexpr int POINTS_PER_SEARCH = 16;
-            static_assert(_edges(N) * POINTS_PER_SEARCH <= Result::N,
-                          "Potential overflow");
+    // Multi-stage binary search for intersection
+    for (unsigned s=0; s < SEARCH_COUNT; ++s)
+    {
+        for (unsigned start=0; start < targets.size();
+             start += SEARCHES_PER_BATCH)
+        {
+            const unsigned count = std::min<unsigned>(
+                    SEARCHES_PER_BATCH, targets.size() - start);
 
-            // Multi-stage binary search for intersection
-            for (int s=0; s < SEARCH_COUNT; ++s)
+            // Load search points into evaluator
+            Eigen::Array<double, N, Result::N> ps;
+            for (unsigned e=0; e < count; ++e)
             {
-                // Load search points into evaluator
-                Eigen::Array<double, N, POINTS_PER_SEARCH * _edges(N)> ps;
-                for (unsigned e=0; e < target_count; ++e)
+                const auto& t = targets[start + e];
+                for (unsigned j=0; j < POINTS_PER_SEARCH; ++j)
                 {
-                    for (int j=0; j < POINTS_PER_SEARCH; ++j)
-                    {
-                        const double frac = j / (POINTS_PER_SEARCH - 1.0);
-                        const unsigned i = j + e*POINTS_PER_SEARCH;
-                        ps.col(i) = (targets[e].first * (1 - frac)) +
-                                    (targets[e].second * frac);
-                        set(ps.col(i), i);
-                    }
+                    const double frac = j / (POINTS_PER_SEARCH - 1.0);
+                    const unsigned i = j + e*POINTS_PER_SEARCH;
+                    ps.col(i) = (t.inside.array() * (1 - frac)) +
+                                (t.outside.array() * frac);
+                    set(ps.col(i).matrix(), patches[t.patch].cell, i);
                 }
+            }
 
-                // Evaluate, then search for the first outside point
-                // and adjust inside / outside to their new positions
-                //
-                // We copy to a temporary array here to avoid invalidating
-                // out if we need to call eval->isInside (e.g. when out[i]
-                // is exactly 0 so we're not sure about the boundary)
-                std::array<float, POINTS_PER_SEARCH * _edges(N)> out;
-                std::copy_n(eval->values(POINTS_PER_SEARCH * target_count),
-                            POINTS_PER_SEARCH * target_count, out.data());
-
-                for (unsigned e=0; e < target_count; ++e)
+            // Evaluate, then search for the first outside point
+            // and adjust inside / outside to their new positions
+            //
+            // We copy to a temporary array here to avoid invalidating
+            // out if we need to call eval->isInside (e.g. when out[i]
+            // is exactly 0 so we're not sure about the boundary)
+            std::array<float, Result::N> out;
+            std::copy_n(eval->values(POINTS_PER_SEARCH * count),
+                        POINTS_PER_SEARCH * count, out.data());
+
+            for (unsigned e=0; e < count; ++e)
+            {
+                auto& t = targets[start + e];
+                for (unsigned j=1; j < POINTS_PER_SEARCH; ++j)
                 {
-                    for (unsigned j=0; j < POINTS_PER_SEARCH; ++j)
+                    const unsigned i = j + e*POINTS_PER_SEARCH;
+                    if (j == POINTS_PER_SEARCH - 1 || out[i] > 0 ||
+                        (out[i] == 0 && !eval->isInside(
+                            set(ps.col(i).matrix(), patches[t.patch].cell, 0))))
                     {
-                        const unsigned i = j + e*POINTS_PER_SEARCH;
-                        if (out[i] > 0)
-                        {
-                            targets[e] = {ps.col(i - 1), ps.col(i)};
-                            break;
-                        }
-                        else if (out[i] == 0)
-                        {
-                            Eigen::Vector3d pos;
-                            pos << ps.col(i), region.perp;
-                            if (!eval->isInside(pos.template cast<float>()))
-                            {
-                                targets[e] = {ps.col(i - 1), ps.col(i)};
-                                break;
-                            }
-                        }
+                        t.inside = ps.col(i - 1);
+                        t.outside = ps.col(i);
+                        break;
                     }
                 }
             }
+        }
+    }
 
-            // Reset mass point and intersections
-            _mass_point = _mass_point.Zero();
-            intersections.clear();
+    // Here, we'll store position, {normal, value} pairs for every crossing
+    // and feature, per patch.  Features found at ambiguous points are kept
+    // separately, then appended to the end of their patch's list.
+    typedef std::pair<Vec, Eigen::Matrix<double, N + 1, 1>> Intersection;
+    typedef std::vector<Intersection, Eigen::aligned_allocator<Intersection>>
+        Intersections;
+    std::vector<Intersections> intersections(patches.size());
+    std::vector<Intersections> features(patches.size());
+
+    // Finds normalized derivatives and distance value, skipping NaNs
+    auto store = [](Intersections& out, const Vec& pos,
+                    const Evaluator::Derivs& ds, unsigned i)
+    {
+        const Eigen::Array<double, N, 1> derivs = ds.d.col(i)
+            .template head<N>()
+            .template cast<double>();
+        const double norm = derivs.matrix().norm();
+
+        Eigen::Matrix<double, N + 1, 1> dv;
+        dv << derivs / norm, ds.v[i] / norm;
+        if (!dv.array().isNaN().any())
+        {
+            out.push_back({pos, dv});
+        }
+    };
 
-            // Store mass point and prepare for a bulk evaluation
-            static_assert(_edges(N) * 2 <= Result::N, "Too many results");
-            for (unsigned i=0; i < target_count; ++i)
-            {
-                // Accumulate this intersection in the mass point
-                Eigen::Matrix<double, N + 1, 1> mp;
-                mp << targets[i].first, 1;
-                _mass_point += mp;
-                mp << targets[i].second, 1;
-                _mass_point += mp;
-
-                set(targets[i].first, 2*i);
-                set(targets[i].second, 2*i + 1);
-            }
+    // Evaluate normals at both ends of every target in bulk
+    for (unsigned start=0; start < targets.size(); start += Result::N / 2)
+    {
+        const unsigned count = std::min<unsigned>(
+                Result::N / 2, targets.size() - start) * 2;
+        auto end = [&](unsigned i) -> const Vec&
+        {
+            const auto& t = targets[start + i/2];
+            return (i & 1) ? t.outside : t.inside;
+        };
+        auto patch = [&](unsigned i)
+        { return targets[start + i/2].patch; };
+
+        for (unsigned i=0; i < count; ++i)
+        {
+            set(end(i), patches[patch(i)].cell, i);
+        }
 
-            auto ds = eval->derivs(2 * target_count);
-            auto ambig = eval->getAmbiguous(2 * target_count);
+        auto ds = eval->derivs(count);
+        const Eigen::Array<bool, Result::N, 1> ambig =
+            eval->getAmbiguous(count);
 
-            // Handle unambiguous nodes first, which were evaluated in bulk
-            for (unsigned i=0; i < 2 * target_count; ++i)
+        // Handle unambiguous nodes first, which were evaluated in bulk
+        for (unsigned i=0; i < count; ++i)
+        {
+            if (!ambig(i))
             {
-                if (!ambig(i))
-                {
-                    const Eigen::Array<double, N, 1> derivs = ds.d.col(i)
-                        .template head<N>()
-                        .template cast<double>();
-                    const double norm = derivs.matrix().norm();
-
-                    // Find normalized derivatives and distance value
-                    Eigen::Matrix<double, N + 1, 1> dv;
-                    dv << derivs / norm, ds.v[i] / norm;
-                    if (!dv.array().isNaN().any())
-                    {
-                        intersections.push_back({
-                            (i & 1) ? targets[i/2].second : targets[i/2].first,
-                            dv});
-                    }
-                }
+                store(intersections[patch(i)], end(i), ds, i);
             }
+        }
 
-            // Special-case checking for ambiguous nodes
-            for (unsigned i=0; i < 2 * target_count; ++i)
+        // Special-case checking for ambiguous nodes
+        for (unsigned i=0; i < count; ++i)
+        {
+            if (ambig(i))
             {
-                if (ambig(i))
+                // Load the ambiguous position and find its features
+                const auto fs = eval->featuresAt(
+                        set(end(i), patches[patch(i)].cell, 0));
+                for (auto& f : fs)
                 {
-                    // Load the ambiguous position and find its features
-                    Eigen::Vector3d pos;
-                    pos << ((i & 1) ? targets[i/2].second : targets[i/2].first),
-                           region.perp;
-                    const auto fs = eval->featuresAt(pos.template cast<float>());
-
-                    for (auto& f : fs)
-                    {
-                        // Evaluate feature-specific distance and
-                        // derivatives value at this particular point
-                        eval->push(f);
-
-                        const auto ds = eval->derivs(1);
-
-                        // Unpack 3D derivatives into XTree-specific
-                        // dimensionality, and find normal.
-                        const Eigen::Array<double, N, 1> derivs = ds.d.col(0)
-                            .template head<N>()
-                            .template cast<double>();
-                        const double norm = derivs.matrix().norm();
-
-                        // Find normalized derivatives and distance value
-                        Eigen::Matrix<double, N + 1, 1> dv;
-                        dv << derivs / norm, ds.v[0] / norm;
-                        if (!dv.array().isNaN().any())
-                        {
-                            intersections.push_back({
-                                (i & 1) ? targets[i/2].second
-                                        : targets[i/2].first, dv});
-                        }
-                        eval->pop();
-                    }
+                    // Evaluate feature-specific distance and
+                    // derivatives value at this particular point
+                    eval->push(f);
+                    store(features[patch(i)], end(i), eval->derivs(1), 0);
+                    eval->pop();
                 }
             }
+        }
+    }
 
-            // Now, we'll unpack into A and b matrices
-            //
-            //  The A matrix is of the form
-            //  [n1x, n1y, n1z]
-            //  [n2x, n2y, n2z]
-            //  [n3x, n3y, n3z]
-            //  ...
-            //  (with one row for each sampled point's normal)
-            Eigen::Matrix<double, Eigen::Dynamic, N> A(intersections.size(), N);
-
-            //  The b matrix is of the form
-            //  [p1 . n1]
-            //  [p2 . n2]
-            //  [p3 . n3]
-            //  ...
-            //  (with one row for each sampled point)
-            Eigen::Matrix<double, Eigen::Dynamic, 1> b(intersections.size(), 1);
-
-            // Load samples into the QEF arrays
-            //
-            // Since we're deliberately sampling on either side of the
-            // intersection, we subtract out the distance-field value
-            // to make the math work out.
-            for (unsigned i=0; i < intersections.size(); ++i)
-            {
-                A.row(i) << intersections[i].second
-                                            .template head<N>()
-                                            .transpose();
-                b(i) = A.row(i).dot(intersections[i].first) -
-                       intersections[i].second(N);
-            }
+    for (unsigned p=0; p < patches.size(); ++p)
+    {
+        auto leaf = patches[p].cell->leaf.get();
 
-            // Save compact QEF matrices
-            auto At = A.transpose().eval();
-            AtA = At * A;
-            AtB = At * b;
-            BtB = b.transpose() * b;
+        // Reset and accumulate the mass point
+        leaf->mass_point = leaf->mass_point.Zero();
+        for (unsigned i=0; i < patches[p].count; ++i)
+        {
+            const auto& t = targets[patches[p].first + i];
+            Eigen::Matrix<double, N + 1, 1> mp;
+            mp << t.inside, 1;
+            leaf->mass_point += mp;
+            mp << t.outside, 1;
+            leaf->mass_point += mp;
+        }
 
-            // Find the vertex position, storing into the appropriate column
-            // of the vertex array and ignoring the error result (because
-            // this is the bottom of the recursion)
-            findVertex(vertex_count++);
+        auto& is = intersections[p];
+        is.insert(is.end(), features[p].begin(), features[p].end());
+
+        // Now, we'll unpack into A and b matrices
+        //
+        //  The A matrix is of the form
+        //  [n1x, n1y, n1z]
+        //  [n2x, n2y, n2z]
+        //  [n3x, n3y, n3z]
+        //  ...
+        //  (with one row for each sampled point's normal)
+        Eigen::Matrix<double, Eigen::Dynamic, N> A(is.size(), N);
+
+        //  The b matrix is of the form
+        //  [p1 . n1]
+        //  [p2 . n2]
+        //  [p3 . n3]
+        //  ...
+        //  (with one row for each sampled point)
+        Eigen::Matrix<double, Eigen::Dynamic, 1> b(is.size(), 1);
+
+        // Load samples into the QEF arrays
+        //
+        // Since we're deliberately sampling on either side of the
+        // intersection, we subtract out the distance-field value
+        // to make the math work out.
+        for (unsigned i=0; i < is.size(); ++i)
+        {
+            A.row(i) << is[i].second.template head<N>().transpose();
+            b(i) = A.row(i).dot(is[i].first) - is[i].second(N);
         }
-    }
 
-    // ...and we're done.
-    eval->pop();
+        // Save compact QEF matrices
+        auto At = A.transpose().eval();
+        leaf->AtA = At * A;
+        leaf->AtB = At * b;
+        leaf->BtB = b.transpose() * b;
+
+        // Find the vertex position, storing into the appropriate column
+        // of the vertex array and ignoring the error result (because
+        // this is the bottom of the recursion)
+        patches[p].cell->findVertex(patches[p].cell->vertex_count++);
+    }
 }
 
-////////////////////////////////////////////////////////////////////////////////
+template <unsigned N>
+void XTree<N>::resetIndices()
+{
+    if (leaf)
+    {
+        std::fill(leaf->index.begin(), leaf->index.end(), 0);
+    }
+    if (isBranch())
+    {
+        for (unsigned i=0; i < children->size(); ++i)
+        {
+            (*children)[i].resetIndices();
+        }
+    }
+}
 
 template <unsigned N>
 double XTree<N>::findVertex(unsigned index)
 {
+    const auto& AtA = leaf->AtA;
+    const auto& AtB = leaf->AtB;
     Eigen::EigenSolver<Eigen::Matrix<double, N, N>> es(AtA);
-    assert(_mass_point(N) > 0);
+    assert(leaf->mass_point(N) > 0);
 
     // We need to find the pseudo-inverse of AtA.
     auto eigenvalues = es.eigenvalues().real();
@@ -555,8 +846,8 @@ double XTree<N>::findVertex(unsigned index)
     // Get rank from eigenvalues
     if (!isBranch())
     {
-        assert(index > 0 || rank == 0);
-        rank = D.diagonal().count();
+        assert(index > 0 || leaf->rank == 0);
+        leaf->rank = D.diagonal().count();
     }
 
     // SVD matrices
@@ -570,10 +861,10 @@ double XTree<N>::findVertex(unsigned index)
     Vec v = AtAp * (AtB - (AtA * center)) + center;
 
     // Store this specific vertex in the verts matrix
-    verts.col(index) = v;
+    leaf->verts.col(index) = v;
 
     // Return the QEF error
-    return (v.transpose() * AtA * v - 2*v.transpose() * AtB)[0] + BtB;
+    return (v.transpose() * AtA * v - 2*v.transpose() * AtB)[0] + leaf->BtB;
 }
 
 ////////////////////////////////////////////////////////////////////////////////
@@ -589,7 +880,7 @@ Eigen::Vector3d XTree<N>::vert3(unsigned index) const
 template <unsigned N>
 typename XTree<N>::Vec XTree<N>::massPoint() const
 {
-    return _mass_point.template head<N>() / _mass_point(N);
+    return leaf->mass_point.template head<N>() / leaf->mass_point(N);
 }
 
 ////////////////////////////////////////////////////////////////////////////////
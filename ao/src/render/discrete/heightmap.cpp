@@ -180,7 +180,8 @@ void Heightmap::fill(Evaluator* e, const Voxels::View& r)
 * Returns true if finished, false if aborted
 */
 bool Heightmap::recurse(Evaluator* e, const Voxels::View& r,
-                        const std::atomic_bool& abort)
+                        const std::atomic_bool& abort,
+                        const Interval::I* batch, unsigned box)
 {
     // Stop rendering if the abort flag is set
     if (abort.load())
@@ -205,8 +206,8 @@ bool Heightmap::recurse(Evaluator* e, const Voxels::View& r,
         return true;
     }
 
-    // Do the interval evaluation
-    Interval::I out = e->eval(r.lower, r.upper);
+    // Do the interval evaluation (unless it was done by our parent)
+    Interval::I out = batch ? batch[box] : e->eval(r.lower, r.upper);
 
     // If strictly negative, fill up the block and return
     if (Interval::isFilled(out))
@@ -217,18 +218,35 @@ bool Heightmap::recurse(Evaluator* e, const Voxels::View& r,
     else if (!Interval::isEmpty(out))
     {
         // Disable inactive nodes in the tree
-        e->push();
+        if (batch)
+        {
+            e->push(box);
+        }
+        else
+        {
+            e->push();
+        }
 
         auto rs = r.split();
 
+        // Evaluate both halves in a single pass, unless they're small
+        // enough to be rendered pixel-by-pixel
+        const Interval::I* halves = nullptr;
+        if (rs.first.voxels() > Result::N || rs.second.voxels() > Result::N)
+        {
+            e->set(rs.second.lower, rs.second.upper, 0);
+            e->set(rs.first.lower, rs.first.upper, 1);
+            halves = e->intervals(2);
+        }
+
         // Since the higher Z region is in the second item of the
         // split, evaluate rs.second then rs.first
-        if (!recurse(e, rs.second, abort))
+        if (!recurse(e, rs.second, abort, halves, 0))
         {
             e->pop();
             return false;
         }
-        if (!recurse(e, rs.first, abort))
+        if (!recurse(e, rs.first, abort, halves, 1))
         {
             e->pop();
             return false;
@@ -250,12 +268,14 @@ Heightmap::Heightmap(unsigned rows, unsigned cols)
 
 std::unique_ptr<Heightmap> Heightmap::render(
     const Tree t, Voxels r, const std::atomic_bool& abort,
-    size_t workers)
+    size_t workers, Evaluator::RangeMode range)
 {
-    std::vector<Evaluator*> es;
-    for (size_t i=0; i < workers; ++i)
+    // Build one evaluator, then clone it for the other workers
+    std::vector<Evaluator*> es = {new Evaluator(t)};
+    es.front()->setRangeMode(range);
+    for (size_t i=1; i < workers; ++i)
     {
-        es.push_back(new Evaluator(t));
+        es.push_back(new Evaluator(*es.front()));
     }
 
     auto out = render(es, r, abort);
@@ -0,0 +1,166 @@
+#include <thread>
+
+#include "ao/render/pool.hpp"
+
+namespace Kernel {
+
+constexpr unsigned WorkPool::SPIN_LIMIT;
+
+WorkPool::WorkPool(const std::vector<Evaluator*>& es)
+    : es(es), workers(es.size()), idle(0), done(false), queued(0),
+      sleeping(0)
+{
+    assert(es.size() > 0);
+}
+
+void WorkPool::run(Task t)
+{
+    done.store(false);
+
+    // Worker 0 is the calling thread; the rest spin up here and look for
+    // work (by stealing) until the root task is finished.
+    std::vector<std::thread> threads;
+    for (unsigned i=1; i < workers.size(); ++i)
+    {
+        threads.push_back(std::thread([this, i](){
+            unsigned misses = 0;
+            while (!done.load())
+            {
+                if (runOne(i))
+                {
+                    misses = 0;
+                }
+                else
+                {
+                    rest(misses, [this](){ return done.load(); });
+                }
+            }
+            setIdle(i, false);
+        }));
+    }
+
+    t(0);
+
+    // Because tasks are fork-join, everything spawned by the root task
+    // has finished by the time that it returns.
+    done.store(true);
+    wake();
+    for (auto& t : threads)
+    {
+        t.join();
+    }
+    assert(idle.load() == 0);
+}
+
+void WorkPool::spawn(unsigned worker, Task t)
+{
+    {
+        std::lock_guard<std::mutex> lock(workers[worker].lock);
+        workers[worker].tasks.push_back(t);
+        queued++;
+    }
+    wake();
+}
+
+void WorkPool::wait(unsigned worker, const std::atomic_uint& pending)
+{
+    unsigned misses = 0;
+    while (pending.load())
+    {
+        if (runOne(worker))
+        {
+            misses = 0;
+        }
+        else
+        {
+            rest(misses, [&pending](){ return !pending.load(); });
+        }
+    }
+    setIdle(worker, false);
+}
+
+bool WorkPool::runOne(unsigned worker)
+{
+    Task t;
+
+    // Check our own deque first, taking the most recently pushed task
+    {
+        std::lock_guard<std::mutex> lock(workers[worker].lock);
+        if (workers[worker].tasks.size())
+        {
+            t = std::move(workers[worker].tasks.back());
+            workers[worker].tasks.pop_back();
+            queued--;
+        }
+    }
+
+    // Then, try to steal the oldest task from the other workers
+    for (unsigned i=1; !t && i < workers.size(); ++i)
+    {
+        auto& w = workers[(worker + i) % workers.size()];
+        std::lock_guard<std::mutex> lock(w.lock);
+        if (w.tasks.size())
+        {
+            t = std::move(w.tasks.front());
+            w.tasks.pop_front();
+            queued--;
+        }
+    }
+
+    setIdle(worker, !t);
+    if (t)
+    {
+        t(worker);
+
+        // Finishing a task may release a worker that's waiting on it
+        wake();
+    }
+    return bool(t);
+}
+
+template <typename F>
+void WorkPool::rest(unsigned& misses, F ready)
+{
+    if (++misses < SPIN_LIMIT)
+    {
+        std::this_thread::yield();
+        return;
+    }
+
+    // Anything that changes the predicate checks sleeping afterwards (in
+    // wake), so either it sees this worker or the predicate sees its change
+    std::unique_lock<std::mutex> lock(sleep_lock);
+    sleeping++;
+    sleep_cond.wait(lock, [&](){ return queued.load() || ready(); });
+    sleeping--;
+    misses = 0;
+}
+
+void WorkPool::wake()
+{
+    if (sleeping.load())
+    {
+        // Taking the lock makes sure that no sleeper is between checking
+        // its predicate and waiting, where it would miss the notification
+        std::lock_guard<std::mutex> lock(sleep_lock);
+        sleep_cond.notify_all();
+    }
+}
+
+void WorkPool::setIdle(unsigned worker, bool i)
+{
+    if (workers[worker].idle != i)
+    {
+        workers[worker].idle = i;
+        if (i)
+        {
+            idle++;
+        }
+        else
+        {
+            idle--;
+        }
+    }
+}
+
+}   // namespace Kernel
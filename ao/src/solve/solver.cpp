@@ -1,4 +1,6 @@
+#include <algorithm>
 #include <numeric>
+#include <vector>
 
 #include "ao/solve/solver.hpp"
 #include "ao/tree/tree.hpp"
@@ -43,10 +45,17 @@ static std::pair<float, Solution> findRoot(
             break;
         }
 
-        // Solve for step size using a backtracking line search
-        const float slope = std::accumulate(ds.begin(), ds.end(), 0.0f,
-                [](float v, const decltype(ds)::value_type& itr) {
-                    return v + pow(itr.second, 2); });
+        // Solve for step size using a backtracking line search.  The map
+        // is ordered by node address, so the squared gradients are sorted
+        // before summing to make the slope independent of that order
+        std::vector<double> squares;
+        for (const auto& d : ds)
+        {
+            squares.push_back(pow(d.second, 2));
+        }
+        std::sort(squares.begin(), squares.end());
+        const double slope = std::accumulate(squares.begin(), squares.end(),
+                                             0.0);
 
         for (float step = r / slope; true; step /= 2)
         {
@@ -0,0 +1,175 @@
+#include <atomic>
+#include <cstdint>
+#include <cstdlib>
+#include <mutex>
+#include <new>
+
+#include "ao/tree/arena.hpp"
+
+namespace Kernel {
+
+namespace Arena
+{
+/*  Number of blocks carved out of each chunk  */
+static const size_t CHUNK_BLOCKS = 1024;
+
+/*  A thread's free list is trimmed back to CHUNK_BLOCKS once it grows to
+ *  this size, so that blocks freed on one thread (e.g. a renderer dropping
+ *  trees) are recycled by threads that are allocating (e.g. a script
+ *  building them), rather than piling up  */
+static const size_t LOCAL_LIMIT = 2 * CHUNK_BLOCKS;
+
+/*  Free blocks are stored as an intrusive singly-linked list  */
+struct Block
+{
+    Block* next;
+};
+
+/*  Blocks handed over by other threads, protected by mut.
+ *
+ *  These are plain pointers (rather than containers) so that they stay
+ *  valid during static destruction, when global Trees may still be freed. */
+static std::mutex mut;
+static Block* spare = nullptr;
+static std::atomic<size_t> carved(0);
+
+/*  Per-thread free list and its length (trivially destructible, for the
+ *  same reason)  */
+static thread_local Block* local = nullptr;
+static thread_local size_t local_count = 0;
+
+/*
+ *  Splits up to count blocks off the front of a (non-empty) list, leaving
+ *  list pointing at the remainder.  Returns the number of blocks split off.
+ */
+static size_t detach(Block*& list, size_t count)
+{
+    Block* tail = list;
+    size_t detached = 1;
+    while (detached < count && tail->next)
+    {
+        tail = tail->next;
+        detached++;
+    }
+    list = tail->next;
+    tail->next = nullptr;
+    return detached;
+}
+
+/*
+ *  When a thread exits, its free list is handed over to the shared list
+ */
+struct Reaper
+{
+    ~Reaper()
+    {
+        if (local)
+        {
+            Block* tail = local;
+            while (tail->next)
+            {
+                tail = tail->next;
+            }
+            std::lock_guard<std::mutex> lock(mut);
+            tail->next = spare;
+            spare = local;
+            local = nullptr;
+            local_count = 0;
+        }
+    }
+};
+static thread_local Reaper reaper;
+
+/*
+ *  Refills this thread's free list, either with up to a chunk's worth of
+ *  blocks from the shared list or with a new chunk (which is threaded onto
+ *  the list in address order, so that consecutive allocations are adjacent
+ *  in memory)
+ */
+static void refill()
+{
+    (void)&reaper;  // Make sure this thread's Reaper is constructed
+
+    {
+        std::lock_guard<std::mutex> lock(mut);
+        if (spare)
+        {
+            local = spare;
+            local_count = detach(spare, CHUNK_BLOCKS);
+            return;
+        }
+    }
+
+    auto raw = static_cast<char*>(malloc((CHUNK_BLOCKS + 1) * BLOCK_SIZE));
+    if (raw == nullptr)
+    {
+        throw std::bad_alloc();
+    }
+
+    // Round up to a cache line
+    auto base = reinterpret_cast<char*>(
+            (reinterpret_cast<uintptr_t>(raw) + BLOCK_SIZE - 1) &
+            ~(uintptr_t)(BLOCK_SIZE - 1));
+
+    for (size_t i=0; i < CHUNK_BLOCKS; ++i)
+    {
+        reinterpret_cast<Block*>(base + i * BLOCK_SIZE)->next =
+            (i + 1 < CHUNK_BLOCKS)
+                ? reinterpret_cast<Block*>(base + (i + 1) * BLOCK_SIZE)
+                : nullptr;
+    }
+    local = reinterpret_cast<Block*>(base);
+    local_count = CHUNK_BLOCKS;
+    carved += CHUNK_BLOCKS;
+}
+
+void* alloc()
+{
+    if (local == nullptr)
+    {
+        refill();
+    }
+    auto out = local;
+    local = local->next;
+    local_count--;
+    return out;
+}
+
+void release(void* ptr)
+{
+    if (local == nullptr)
+    {
+        (void)&reaper;
+    }
+    auto b = static_cast<Block*>(ptr);
+    b->next = local;
+    local = b;
+
+    // Keep a chunk's worth of blocks and hand the rest over to the shared
+    // list (walking the list here is amortized over the releases that
+    // filled it)
+    if (++local_count >= LOCAL_LIMIT)
+    {
+        Block* rest = local;
+        local_count = detach(rest, CHUNK_BLOCKS);
+
+        Block* tail = rest;
+        while (tail->next)
+        {
+            tail = tail->next;
+        }
+
+        std::lock_guard<std::mutex> lock(mut);
+        tail->next = spare;
+        spare = rest;
+    }
+}
+
+size_t reserved()
+{
+    return carved.load();
+}
+
+}   // namespace Arena
+
+}   // namespace Kernel
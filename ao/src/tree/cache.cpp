@@ -1,34 +1,85 @@
 #include <cassert>
+#include <cstring>
 
 #include "ao/tree/cache.hpp"
+#include "ao/tree/arena.hpp"
 #include "ao/eval/evaluator.hpp"
 
 namespace Kernel {
 
 // Static class variables
-std::recursive_mutex Cache::mut;
 Cache Cache::_instance;
 
+/*
+ *  Bit-mixing finalizer (from splitmix64), used to spread keys out
+ *  across shards and hash buckets
+ */
+static size_t mix(uint64_t h)
+{
+    h = (h ^ (h >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    h = (h ^ (h >> 27)) * 0x94d049bb133111ebULL;
+    return h ^ (h >> 31);
+}
+
+size_t Cache::KeyHash::operator()(const Key& k) const
+{
+    return mix(reinterpret_cast<uintptr_t>(std::get<1>(k)) * 31 +
+               reinterpret_cast<uintptr_t>(std::get<2>(k)) * 0x9e3779b97f4a7c15ULL +
+               std::get<0>(k));
+}
+
+Cache::Shard& Cache::shard(const Key& k)
+{
+    // Use high bits, so that shard choice is independent of bucket choice
+    return shards[(KeyHash()(k) >> 16) % SHARDS];
+}
+
+Cache::Shard& Cache::shard(uint32_t bits)
+{
+    return shards[(mix(bits) >> 16) % SHARDS];
+}
+
+static uint32_t floatBits(float v)
+{
+    uint32_t bits;
+    memcpy(&bits, &v, sizeof(bits));
+    return bits;
+}
+
+/*
+ *  Allocates a node (and its reference counts) from the Arena
+ */
+template <typename... Args>
+static std::shared_ptr<Tree::Tree_> node(Args&&... args)
+{
+    return std::allocate_shared<Tree::Tree_>(
+            ArenaAllocator<Tree::Tree_>(), std::forward<Args>(args)...);
+}
+
 Cache::Node Cache::constant(float v)
 {
-    auto f = constants.find(v);
-    if (f == constants.end())
+    const auto bits = floatBits(v);
+    auto& s = shard(bits);
+    std::lock_guard<std::mutex> lock(s.mut);
+
+    // An entry may be present but expired if its node is being destroyed
+    // by another thread; in that case, we replace it here and the other
+    // thread's call to del leaves our new entry alone.
+    auto& e = s.constants[bits];
+    if (auto out = e.ptr.lock())
     {
-        Node out(new Tree::Tree_ {
-            Opcode::CONST,
-            Tree::FLAG_LOCATION_AGNOSTIC,
-            0, // rank
-            v, // value
-            nullptr,
-            nullptr });
-        constants.insert({v, out});
         return out;
     }
-    else
-    {
-        assert(!f->second.expired());
-        return f->second.lock();
-    }
+
+    auto out = node(
+        Opcode::CONST,
+        Tree::FLAG_LOCATION_AGNOSTIC,
+        0, // rank
+        v, // value
+        nullptr,
+        nullptr);
+    e = {out.get(), out};
+    return out;
 }
 
 Cache::Node Cache::operation(Opcode::Opcode op, Cache::Node lhs,
@@ -48,13 +99,9 @@ Cache::Node Cache::operation(Opcode::Opcode op, Cache::Node lhs,
         CHECK_RETURN(checkCommutative);
     }
 
-    Key k(op, lhs.get(), rhs.get());
-
-    auto found = ops.find(k);
-    if (found == ops.end())
-    {
-        // Construct a new operation node
-        Node out(new Tree::Tree_ {
+    // Constructs a new operation node
+    auto build = [&]() {
+        return node(
             op,
 
             // Flags
@@ -75,61 +122,83 @@ Cache::Node Cache::operation(Opcode::Opcode op, Cache::Node lhs,
 
             // Arguments
             lhs,
-            rhs });
+            rhs);
+    };
 
-        // Store a weak pointer to this new Node
-        ops.insert({k, out});
-
-        // If both sides of the operation are constant, then build up a
-        // temporary Evaluator in order to get a constant value out
-        // (out will be GC'd immediately when it goes out of scope)
-        if ((lhs.get() || rhs.get()) &&
-            (!lhs.get() || lhs->op == Opcode::CONST) &&
-            (!rhs.get() || rhs->op == Opcode::CONST))
-        {
-            // Here, we construct a Tree manually to avoid a recursive loop,
-            // then pass it immediately into a dummy Evaluator
-            Evaluator e((Tree(out)));
-            return constant(e.values(1)[0]);
-        }
-        else
-        {
-            return out;
-        }
+    // If both sides of the operation are constant, then build up a
+    // temporary Evaluator in order to get a constant value out.  The
+    // temporary node is never stored in the cache (so other threads can't
+    // pick it up) and is GC'd immediately when it goes out of scope.
+    if ((lhs.get() || rhs.get()) &&
+        (!lhs.get() || lhs->op == Opcode::CONST) &&
+        (!rhs.get() || rhs->op == Opcode::CONST))
+    {
+        // Here, we construct a Tree manually to avoid a recursive loop,
+        // then pass it immediately into a dummy Evaluator
+        Evaluator e((Tree(build())));
+        return constant(e.values(1)[0]);
     }
-    else
+
+    Key k(op, lhs.get(), rhs.get());
+    auto& s = shard(k);
+    std::lock_guard<std::mutex> lock(s.mut);
+
+    // As in constant, an expired entry is replaced rather than reused.
+    // No node is released while the lock is held, so del is never called
+    // re-entrantly on this shard.
+    auto& e = s.ops[k];
+    if (auto out = e.ptr.lock())
     {
-        assert(!found->second.expired());
-        return found->second.lock();
+        return out;
     }
+
+    auto out = build();
+
+    // Store a weak pointer to this new Node
+    e = {out.get(), out};
+    return out;
 }
 
 
 Cache::Node Cache::var()
 {
-    return Node(new Tree::Tree_ {
+    return node(
         Opcode::VAR,
         Tree::FLAG_LOCATION_AGNOSTIC,
         0, // rank
         std::nanf(""), // value
         nullptr,
-        nullptr});
+        nullptr);
 }
 
-void Cache::del(float v)
+void Cache::del(Tree::Id t)
 {
-    auto c = constants.find(v);
-    assert(c != constants.end());
-    assert(c->second.expired());
-    constants.erase(c);
-}
+    if (t->op == Opcode::CONST)
+    {
+        const auto bits = floatBits(t->value);
+        auto& s = shard(bits);
+        std::lock_guard<std::mutex> lock(s.mut);
 
-void Cache::del(Opcode::Opcode op, Node lhs, Node rhs)
-{
-    auto o = ops.find({op, lhs.get(), rhs.get()});
-    assert(o != ops.end());
-    assert(o->second.expired());
-    ops.erase(o);
+        // The entry may have been replaced (or replaced and removed) by
+        // another thread since this node's weak pointer expired
+        auto c = s.constants.find(bits);
+        if (c != s.constants.end() && c->second.raw == t)
+        {
+            s.constants.erase(c);
+        }
+    }
+    else
+    {
+        Key k(t->op, t->lhs.get(), t->rhs.get());
+        auto& s = shard(k);
+        std::lock_guard<std::mutex> lock(s.mut);
+
+        auto o = s.ops.find(k);
+        if (o != s.ops.end() && o->second.raw == t)
+        {
+            s.ops.erase(o);
+        }
+    }
 }
 
 Cache::Node Cache::checkIdentity(Opcode::Opcode op, Cache::Node a, Cache::Node b)
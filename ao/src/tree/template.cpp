@@ -1,4 +1,5 @@
 #include <iostream>
+#include <unordered_map>
 
 #include "ao/tree/template.hpp"
 
@@ -14,9 +15,11 @@ std::vector<uint8_t> Template::serialize() const
     serializeString(name, out);
     serializeString(doc, out);
 
-    std::map<Tree::Id, uint32_t> ids;
+    const auto flat = tree.ordered();
+    std::unordered_map<Tree::Id, uint32_t> ids;
+    ids.reserve(flat.size());
 
-    for (auto& n : tree.ordered())
+    for (auto& n : flat)
     {
         out.push_back(n->op);
         ids.insert({n.id(), ids.size()});
@@ -1,8 +1,6 @@
 #include <algorithm>
 #include <fstream>
 #include <iostream>
-#include <set>
-#include <list>
 #include <cmath>
 #include <cassert>
 
@@ -52,44 +50,157 @@ Tree Tree::var()
 
 Tree::Tree_::~Tree_()
 {
-    if (op == Opcode::CONST)
+    if (op != Opcode::VAR)
     {
-        Cache::instance()->del(value);
+        Cache::instance()->del(this);
     }
-    else if (op != Opcode::VAR)
+
+    // Constness doesn't apply to an object under destruction, so we're
+    // allowed to move the children out here
+    std::shared_ptr<Tree_>* children[2] = {
+        const_cast<std::shared_ptr<Tree_>*>(&lhs),
+        const_cast<std::shared_ptr<Tree_>*>(&rhs)};
+
+    // Children waiting to be released by the outermost ~Tree_ on this
+    // thread, and whether that destructor is running
+    static thread_local std::vector<std::shared_ptr<Tree_>> queue;
+    static thread_local bool releasing = false;
+
+    // Children that are shared elsewhere are released immediately;
+    // the rest are queued, so that their destructors don't recurse
+    for (auto c : children)
+    {
+        if (c->use_count() == 1)
+        {
+            queue.push_back(std::move(*c));
+        }
+        else
+        {
+            c->reset();
+        }
+    }
+
+    // The outermost destructor releases queued nodes in a loop, which may
+    // queue up their children in turn
+    if (!releasing)
     {
-        Cache::instance()->del(op, lhs, rhs);
+        releasing = true;
+        while (queue.size())
+        {
+            auto t = std::move(queue.back());
+            queue.pop_back();
+            t.reset();
+        }
+        releasing = false;
     }
 }
 
-std::list<Tree> Tree::ordered() const
+/*
+ *  Minimal open-addressing hash set of node addresses, used by ordered()
+ *  (much faster than std::unordered_set, which allocates per element)
+ */
+class NodeSet
 {
-    std::set<Id> found = {nullptr};
-    std::list<std::shared_ptr<Tree_>> todo = { ptr };
-    std::map<unsigned, std::list<std::shared_ptr<Tree_>>> ranks;
+public:
+    NodeSet() : slots(1024, nullptr), count(0) {}
 
-    while (todo.size())
+    /*  Returns true if the node wasn't already in the set  */
+    bool insert(Tree::Id t)
     {
-        auto t = todo.front();
-        todo.pop_front();
+        if ((count + 1) * 2 > slots.size())
+        {
+            std::vector<Tree::Id> prev(slots.size() * 2, nullptr);
+            std::swap(prev, slots);
+            count = 0;
+            for (auto p : prev)
+            {
+                if (p)
+                {
+                    insert(p);
+                }
+            }
+        }
 
-        if (found.find(t.get()) == found.end())
+        const size_t mask = slots.size() - 1;
+        for (size_t i=hash(t) & mask; ; i = (i + 1) & mask)
         {
-            todo.push_back(t->lhs);
-            todo.push_back(t->rhs);
-            found.insert(t.get());
-            ranks[t->rank].push_back(t);
+            if (slots[i] == t)
+            {
+                return false;
+            }
+            else if (slots[i] == nullptr)
+            {
+                slots[i] = t;
+                count++;
+                return true;
+            }
         }
     }
 
-    std::list<Tree> out;
-    for (auto& r : ranks)
+protected:
+    static size_t hash(Tree::Id t)
+    {
+        // Nodes live in 64-byte Arena blocks, so the low bits carry little
+        // information; drop them before mixing
+        return (reinterpret_cast<uintptr_t>(t) >> 6) * 0x9e3779b97f4a7c15ULL >> 20;
+    }
+
+    std::vector<Tree::Id> slots;
+    size_t count;
+};
+
+std::vector<Tree> Tree::ordered() const
+{
+    if (!ptr)
     {
-        for (auto& t : r.second)
+        return {};
+    }
+
+    // Collect every unique node with a breadth-first walk, using a vector
+    // as the work queue (each node is queued at most once per parent, so
+    // the queue holds at most 2n + 1 items)
+    std::vector<const std::shared_ptr<Tree_>*> nodes;
+    std::vector<const std::shared_ptr<Tree_>*> todo = {&ptr};
+    NodeSet found;
+
+    for (size_t i=0; i < todo.size(); ++i)
+    {
+        auto t = todo[i];
+        if (*t && found.insert(t->get()))
         {
-            out.push_back(Tree(t));
+            todo.push_back(&(*t)->lhs);
+            todo.push_back(&(*t)->rhs);
+            nodes.push_back(t);
         }
     }
+
+    // Then do a (stable) counting sort by rank.  Rank is bounded by tree
+    // depth, which is bounded by the number of nodes, so this is O(n).
+    // Every child has a lower rank than its parent, so the tree this
+    // is called on will be the last item in the list.
+    const unsigned max_rank = ptr->rank;
+    std::vector<size_t> start(max_rank + 2, 0);
+    for (auto t : nodes)
+    {
+        start[(*t)->rank + 1]++;
+    }
+    for (unsigned r=1; r < start.size(); ++r)
+    {
+        start[r] += start[r - 1];
+    }
+
+    std::vector<const std::shared_ptr<Tree_>*> sorted(nodes.size());
+    for (auto t : nodes)
+    {
+        sorted[start[(*t)->rank]++] = t;
+    }
+
+    std::vector<Tree> out;
+    out.reserve(sorted.size());
+    for (auto t : sorted)
+    {
+        out.push_back(Tree(*t));
+    }
     return out;
 }
 
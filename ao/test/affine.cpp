@@ -0,0 +1,82 @@
+#include "catch.hpp"
+
+#include "ao/eval/affine.hpp"
+
+using namespace Kernel;
+using Interval::I;
+using Affine::A;
+
+TEST_CASE("Affine::A: inputs")
+{
+    auto x = A::input(I(1, 3), 0);
+    REQUIRE(x.c == 2);
+    REQUIRE(x.d[0] == 1);
+    REQUIRE(x.e == 0);
+
+    auto r = x.range();
+    REQUIRE(r.lower() <= 1);
+    REQUIRE(r.lower() == Approx(1));
+    REQUIRE(r.upper() >= 3);
+    REQUIRE(r.upper() == Approx(3));
+}
+
+TEST_CASE("Affine::A: correlated terms")
+{
+    auto x = A::input(I(2, 3), 0);
+    auto y = A::input(I(1, 2), 1);
+
+    SECTION("Cancellation")
+    {
+        auto r = (x - x).range();
+        REQUIRE(r.lower() <= 0);
+        REQUIRE(r.upper() >= 0);
+        const float width = r.upper() - r.lower();
+        REQUIRE(width < 1e-6);
+    }
+
+    SECTION("Quadratic")
+    {
+        // (x - y)^2 ranges over [0, 4]; intervals give [-7, 9]
+        auto r = (square(x) - A(2) * x * y + square(y)).range();
+        auto i = square(I(2, 3)) - I(2) * I(2, 3) * I(1, 2) +
+                 square(I(1, 2));
+        REQUIRE(i.lower() == -7);
+        REQUIRE(i.upper() == 9);
+
+        CAPTURE(r.lower());
+        CAPTURE(r.upper());
+        REQUIRE(r.lower() <= 0);
+        REQUIRE(r.upper() >= 4);
+        REQUIRE(r.lower() > -2);
+        REQUIRE(r.upper() < 5);
+    }
+
+    SECTION("Rotation")
+    {
+        // A rotated coordinate, rotated back
+        const double c = std::cos(0.3), s = std::sin(0.3);
+        auto u = scale(x, c) - scale(y, s);
+        auto v = scale(x, s) + scale(y, c);
+        auto r = (scale(u, c) + scale(v, s)).range();
+        REQUIRE(r.lower() <= 2);
+        REQUIRE(r.lower() == Approx(2));
+        REQUIRE(r.upper() >= 3);
+        REQUIRE(r.upper() == Approx(3));
+    }
+}
+
+TEST_CASE("Affine::A: squares")
+{
+    auto x = A::input(I(-1, 2), 0);
+    auto r = square(x).range();
+    REQUIRE(r.lower() <= 0);
+    REQUIRE(r.upper() >= 4);
+}
+
+TEST_CASE("Affine::A: unbounded forms")
+{
+    auto a = A::fromInterval(I::whole());
+    auto r = (a * A(2)).range();
+    REQUIRE(r.lower() == -INFINITY);
+    REQUIRE(r.upper() == INFINITY);
+}
@@ -1,4 +1,8 @@
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
 #include <iostream>
+#include <string>
 #include "catch.hpp"
 
 #include "ao/tree/opcode.hpp"
@@ -124,8 +128,14 @@ TEST_CASE("ao_tree_save/load")
     auto b = ao_tree_y();
     auto c = ao_tree_binary(Opcode::DIV, a, b);
 
-    ao_tree_save(c, ".ao_tree.tmp");
-    auto c_ = ao_tree_load(".ao_tree.tmp");
+    // Write to the temporary directory so the test doesn't leave files
+    // behind in the working directory
+    auto dir = std::getenv("TMPDIR");
+    auto path = std::string(dir ? dir : "/tmp") + "/ao-test-tree.ao";
+
+    ao_tree_save(c, path.c_str());
+    auto c_ = ao_tree_load(path.c_str());
+    std::remove(path.c_str());
     REQUIRE(c_ != nullptr);
     REQUIRE(ao_tree_eq(c, c_));
 
@@ -156,3 +166,36 @@ TEST_CASE("ao_tree_render_pixels")
 
     REQUIRE(true); // No crash!
 }
+
+TEST_CASE("ao_tree_render_pixels (Z-dependent shape)")
+{
+    auto x = ao_tree_x();
+    auto y = ao_tree_y();
+    auto z = ao_tree_z();
+    auto x2 = ao_tree_unary(Opcode::SQUARE, x);
+    auto y2 = ao_tree_unary(Opcode::SQUARE, y);
+    auto z2 = ao_tree_unary(Opcode::SQUARE, z);
+    auto r_ = ao_tree_binary(Opcode::ADD, x2, y2);
+    auto r = ao_tree_binary(Opcode::ADD, r_, z2);
+    auto one = ao_tree_const(1.0f);
+    auto d = ao_tree_binary(Opcode::SUB, r, one);
+
+    // Z is folded into the tree before rendering, so the slice at z = 0.6
+    // should be a circle of radius 0.8
+    auto m = ao_tree_render_pixels(d, {{-1, 1}, {-1, 1}}, 0.6, 50);
+    REQUIRE(m->width == 100);
+
+    unsigned filled = 0;
+    for (unsigned i=0; i < m->width * m->height; ++i)
+    {
+        filled += m->pixels[i];
+    }
+    const double area = 4.0 * filled / (m->width * m->height);
+    REQUIRE(area == Approx(M_PI * 0.64).epsilon(0.02));
+
+    ao_pixels_delete(m);
+    for (auto t : {x, y, z, x2, y2, z2, r_, r, one, d})
+    {
+        ao_tree_delete(t);
+    }
+}
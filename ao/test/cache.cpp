@@ -1,3 +1,6 @@
+#include <thread>
+#include <vector>
+
 #include "catch.hpp"
 
 #include "ao/tree/cache.hpp"
@@ -137,3 +140,43 @@ TEST_CASE("Cache::checkCommutative")
         REQUIRE(b->rank == 2);
     }
 }
+
+TEST_CASE("Cache: multithreaded construction")
+{
+    // Each thread builds (and drops) the same set of trees, including
+    // constant-folded ones, so that threads race to create and delete
+    // identical nodes.
+    const unsigned THREADS = 8;
+    std::vector<std::vector<std::shared_ptr<Tree::Tree_>>> results(THREADS);
+    std::vector<std::thread> threads;
+    for (unsigned i=0; i < THREADS; ++i)
+    {
+        threads.emplace_back([&results, i]() {
+            auto t = Cache::instance();
+            for (int j=0; j < 2000; ++j)
+            {
+                auto a = t->operation(Opcode::MUL, t->X(), t->constant(j % 50));
+                auto b = t->operation(Opcode::ADD, t->constant(j % 7),
+                                                   t->constant(2));
+                if (j >= 1950)
+                {
+                    results[i].push_back(t->operation(Opcode::SUB, a, b));
+                }
+            }
+        });
+    }
+    for (auto& t : threads)
+    {
+        t.join();
+    }
+
+    for (unsigned i=1; i < THREADS; ++i)
+    {
+        REQUIRE(results[i] == results[0]);
+    }
+
+    auto t = Cache::instance();
+    auto f = t->operation(Opcode::ADD, t->constant(3), t->constant(2));
+    REQUIRE(f->op == Opcode::CONST);
+    REQUIRE(f->value == 5);
+}
@@ -73,3 +73,28 @@ TEST_CASE("Contours::render (menger, perp offset)")
     auto cs = Contours::render(m, r);
     REQUIRE(cs->contours.size() == 74);
 }
+
+TEST_CASE("Contours::render (Z-dependent shape)")
+{
+    // The radius only depends on Z, so it's folded into a constant
+    // (see the XTree<2>::specialize test)
+    auto t = sqrt(square(Tree::X()) + square(Tree::Y())) -
+             (0.5 + 0.25 * sin(Tree::Z()));
+    Region<2> r({-1, -1}, {1, 1}, Eigen::Array<double, 1, 1>(1));
+
+    const float expected = 0.5 + 0.25 * std::sin(1.0);
+
+    auto m = Contours::render(t, r);
+    REQUIRE(m->contours.size() == 1);
+
+    float min = 1;
+    float max = 0;
+    for (auto c : m->contours[0])
+    {
+        auto r = c.norm();
+        min = fmin(min, r);
+        max = fmax(max, r);
+    }
+    REQUIRE(max < expected + 0.01);
+    REQUIRE(min > expected - 0.01);
+}
@@ -1,3 +1,5 @@
+#include <chrono>
+
 #include <Eigen/Geometry>
 
 #include "catch.hpp"
@@ -81,6 +83,41 @@ TEST_CASE("Evaluator::gradient")
         REQUIRE(g.at(b.id()) == Approx(2.0f));
         REQUIRE(g.at(c.id()) == Approx(3.0f));
     }
+
+    SECTION("Shared subexpressions")
+    {
+        // Both vars are used several times, through min, square, and sin
+        auto a = Tree::var();
+        auto b = Tree::var();
+        auto s = square(a * Tree::X()) + sin(b);
+        Evaluator e(min(s, s + b) * a, {{a.id(), 2}, {b.id(), 0.5}});
+
+        // f = (a^2 x^2 + sin(b)) * a  (the min always picks s, as b > 0)
+        auto g = e.gradient({3, 0, 0});
+        REQUIRE(g.at(a.id()) == Approx(3 * 4 * 9 + sin(0.5f)));
+        REQUIRE(g.at(b.id()) == Approx(2 * cos(0.5f)));
+    }
+
+    SECTION("Many variables")
+    {
+        std::vector<Tree> vs;
+        std::map<Tree::Id, float> values;
+        Tree t(0);
+        for (int i=0; i < 200; ++i)
+        {
+            vs.push_back(Tree::var());
+            values[vs.back().id()] = i;
+            t = t + vs.back() * (float)(i + 1);
+        }
+        Evaluator e(t, values);
+
+        auto g = e.gradient({0, 0, 0});
+        REQUIRE(g.size() == vs.size());
+        for (int i=0; i < 200; ++i)
+        {
+            REQUIRE(g.at(vs[i].id()) == Approx(i + 1));
+        }
+    }
 }
 
 TEST_CASE("Evaluator::setVar")
@@ -122,6 +159,30 @@ TEST_CASE("Evaluator::varValues")
     }
 }
 
+TEST_CASE("Evaluator copy constructor")
+{
+    auto a = Tree::var();
+    Evaluator e(min(Tree::X() + a, Tree::Y()), {{a.id(), 1}});
+    e.setVar(a.id(), 2);
+
+    Evaluator c(e);
+    REQUIRE(c.eval({1, 5, 0}) == Approx(3));
+
+    // Variables and tapes are independent after cloning
+    c.setVar(a.id(), 3);
+    REQUIRE(c.eval({1, 5, 0}) == Approx(4));
+    REQUIRE(e.eval({1, 5, 0}) == Approx(3));
+
+    c.eval({-1, 4, 0}, {0, 5, 0});
+    c.push();
+    REQUIRE(c.utilization() < 1);
+    REQUIRE(e.utilization() == 1);
+    REQUIRE(c.eval({0, 5, 0}) == Approx(3));
+
+    auto g = c.gradient({0, 5, 0});
+    REQUIRE(g.at(a.id()) == Approx(1));
+}
+
 TEST_CASE("Float evaluation")
 {
     SECTION("X + 1")
@@ -170,6 +231,203 @@ TEST_CASE("Push / pop behavior")
     REQUIRE(e.eval({1.0f, 2.0f, 0.0f}) == 2);
 }
 
+TEST_CASE("Evaluator::tapeCacheStats")
+{
+    Evaluator e(min(Tree::X() + 1, Tree::Y() + 1));
+    REQUIRE(e.tapeCacheStats().hits == 0);
+    REQUIRE(e.tapeCacheStats().misses == 0);
+
+    // Tapes are cached the second time they're built, then re-used
+    std::vector<uint64_t> hashes;
+    for (int i=0; i < 3; ++i)
+    {
+        e.eval({-5, 8.0f + i, 0}, {-4, 9.0f + i, 0});
+        e.push();
+        hashes.push_back(e.tapeHash());
+        REQUIRE(e.utilization() < 1);
+        REQUIRE(e.eval({1.0f, 2.0f, 0.0f}) == 2);
+        e.pop();
+    }
+    REQUIRE(e.tapeCacheStats().hits == 1);
+    REQUIRE(e.tapeCacheStats().misses == 2);
+    REQUIRE(hashes[0] == hashes[2]);
+
+    SECTION("Different choices")
+    {
+        e.eval({8, -5, 0}, {9, -4, 0});
+        e.push();
+        REQUIRE(e.tapeHash() != hashes[0]);
+        REQUIRE(e.eval({1.0f, 2.0f, 0.0f}) == 3);
+        REQUIRE(e.tapeCacheStats().hits == 1);
+    }
+
+    SECTION("Disabled")
+    {
+        e.setTapeCacheSize(0);
+        e.eval({-5, 8, 0}, {-4, 9, 0});
+        e.push();
+        REQUIRE(e.eval({1.0f, 2.0f, 0.0f}) == 2);
+        REQUIRE(e.tapeCacheStats().hits == 1);
+        REQUIRE(e.tapeCacheStats().misses == 2);
+    }
+}
+
+TEST_CASE("Evaluator::intervals")
+{
+    Tree x = Tree::X(), y = Tree::Y(), z = Tree::Z();
+    auto t = min(menger(2), sin(x * 4) * cos(y * 4) + sin(z * 4) + 0.5);
+    Evaluator e(t);
+    Evaluator f(t);
+
+    // Split a cube into eight boxes, as for the children of an octree cell
+    std::vector<std::pair<Eigen::Vector3f, Eigen::Vector3f>> boxes;
+    for (unsigned i=0; i < 8; ++i)
+    {
+        const Eigen::Vector3f lower((i & 1) ? 0 : -1.2,
+                                    (i & 2) ? 0 : -1.2,
+                                    (i & 4) ? 0 : -1.2);
+        boxes.push_back({lower, lower + Eigen::Vector3f::Constant(1.2)});
+        e.set(boxes.back().first, boxes.back().second, i);
+    }
+    auto out = e.intervals(8);
+
+    SECTION("Results")
+    {
+        for (unsigned i=0; i < 8; ++i)
+        {
+            auto r = f.eval(boxes[i].first, boxes[i].second);
+            CAPTURE(i);
+            REQUIRE(out[i].lower() == r.lower());
+            REQUIRE(out[i].upper() == r.upper());
+        }
+    }
+
+    SECTION("Pushing")
+    {
+        // Push out of order, with deeper tapes pushed (and evaluated)
+        // in between, to check that the batch is kept with its tape
+        for (unsigned i : {5, 0, 7, 2, 1, 6, 3, 4})
+        {
+            e.push(i);
+            const auto outer = e.tapeHash();
+            e.set(boxes[i].first, boxes[i].second, 0);
+            e.intervals(1);
+            e.push(0);
+            const auto inner = e.tapeHash();
+            e.pop();
+            e.pop();
+
+            CAPTURE(i);
+            f.eval(boxes[i].first, boxes[i].second);
+            f.push();
+            REQUIRE(f.tapeHash() == outer);
+            f.eval(boxes[i].first, boxes[i].second);
+            f.push();
+            REQUIRE(f.tapeHash() == inner);
+            f.pop();
+            f.pop();
+        }
+    }
+}
+
+TEST_CASE("Evaluator::setRangeMode")
+{
+    Tree x = Tree::X(), y = Tree::Y();
+    auto t = square(x) - 2 * x * y + square(y) - 0.5;
+    Evaluator e(t);
+    const Eigen::Vector3f lower(2, 1, 0), upper(3, 2, 0);
+
+    auto i = e.eval(lower, upper);
+    REQUIRE(i.lower() == -7.5);
+    REQUIRE(i.upper() == 8.5);
+
+    e.setRangeMode(Evaluator::AFFINE);
+    auto a = e.eval(lower, upper);
+    REQUIRE(a.lower() <= -0.5);
+    REQUIRE(a.upper() >= 3.5);
+    REQUIRE(a.lower() > i.lower());
+    REQUIRE(a.upper() < i.upper());
+
+    SECTION("Clones")
+    {
+        Evaluator f(e);
+        REQUIRE(f.rangeMode() == Evaluator::AFFINE);
+    }
+
+    SECTION("Pruning")
+    {
+        // The affine range proves that the rhs of min is never chosen
+        Evaluator g(min(t, 5 - Tree::Z()));
+        g.setRangeMode(Evaluator::AFFINE);
+        g.eval(lower, upper);
+        g.push();
+        REQUIRE(g.utilization() < 1);
+        REQUIRE(g.eval({2.5, 1.5, 0}) == 0.5);
+    }
+
+    SECTION("Batches")
+    {
+        e.set(lower, upper, 0);
+        e.set(lower - Eigen::Vector3f::Ones(), lower, 1);
+        auto b = e.intervals(2);
+        REQUIRE(b[0].lower() == a.lower());
+        REQUIRE(b[0].upper() == a.upper());
+
+        auto c = e.eval(lower - Eigen::Vector3f::Ones(), lower);
+        REQUIRE(b[1].lower() == c.lower());
+        REQUIRE(b[1].upper() == c.upper());
+    }
+
+    SECTION("Mean value")
+    {
+        e.setRangeMode(Evaluator::MEAN_VALUE);
+        auto m = e.eval(lower, upper);
+        REQUIRE(m.lower() <= -0.5);
+        REQUIRE(m.upper() >= 3.5);
+        REQUIRE(m.lower() > i.lower());
+        REQUIRE(m.upper() < i.upper());
+
+        // The gradient of a single variable is exact
+        Evaluator f(Tree::X() * (1 - Tree::X()));
+        f.setRangeMode(Evaluator::MEAN_VALUE);
+        auto g = f.eval({0.4, 0, 0}, {0.6, 0, 0});
+        REQUIRE(g.lower() <= 0.24f);
+        REQUIRE(g.upper() >= 0.25f);
+        REQUIRE(g.lower() > 0.2f);
+        REQUIRE(g.upper() < 0.3f);
+    }
+}
+
+TEST_CASE("Evaluator::varMask")
+{
+    auto a = Tree::var();
+    auto b = Tree::var();
+    Evaluator e(min(Tree::X() + a, Tree::Y() + b), {{a.id(), 1}, {b.id(), 1}});
+
+    const auto ma = e.varMask({a.id()});
+    const auto mb = e.varMask({b.id()});
+    REQUIRE(ma != 0);
+    REQUIRE(mb != 0);
+    REQUIRE(ma != mb);
+    REQUIRE(e.varMask() == (ma | mb));
+    const auto base = e.tapeHash();
+
+    // Pushing into a region where the rhs is pruned drops b from the tape
+    e.eval({-5, 8, 0}, {-4, 9, 0});
+    e.push();
+    REQUIRE(e.varMask() == ma);
+    REQUIRE(e.tapeHash() != base);
+    const auto pruned = e.tapeHash();
+    e.pop();
+    REQUIRE(e.tapeHash() == base);
+
+    // A different region with the same pruning gives the same fingerprint
+    e.eval({-6, 10, 0}, {-5, 11, 0});
+    e.push();
+    REQUIRE(e.tapeHash() == pruned);
+    e.pop();
+}
+
 TEST_CASE("Evaluator::derivs")
 {
     SECTION("X")
@@ -222,6 +480,49 @@ TEST_CASE("Evaluator::derivs")
     }
 }
 
+TEST_CASE("Evaluator slot re-use")
+{
+    // Build a long chain of clauses, each of which is only used once,
+    // so that the evaluator can re-use result slots along the way
+    Tree t = Tree::X();
+    for (int i=0; i < 100; ++i)
+    {
+        t = (t + Tree::Y()) * 0.5f;
+    }
+    Evaluator e(min(t, Tree::Z() * 2));
+
+    SECTION("Values")
+    {
+        REQUIRE(e.eval({1, 1, 10}) == Approx(1));
+        REQUIRE(e.eval({1, 1, 0.25}) == Approx(0.5));
+    }
+
+    SECTION("Derivatives")
+    {
+        e.set({1, 1, 10}, 0);
+        e.set({1, 1, 0.25}, 1);
+        auto d = e.derivs(2);
+
+        REQUIRE(d.v[0] == Approx(1));
+        REQUIRE(d.v[1] == Approx(0.5));
+        REQUIRE(d.d.col(0).y() == Approx(1));
+        REQUIRE(d.d.col(1).z() == Approx(2));
+    }
+
+    SECTION("Push")
+    {
+        // Disable the long chain, then make sure the other branch
+        // still evaluates properly
+        auto i = e.eval({0, 0, -2}, {1, 1, -1});
+        REQUIRE(i.upper() == Approx(-2));
+        e.push();
+        REQUIRE(e.utilization() < 1);
+        REQUIRE(e.eval({1, 1, 0.25}) == Approx(0.5));
+        e.pop();
+        REQUIRE(e.eval({1, 1, 10}) == Approx(1));
+    }
+}
+
 TEST_CASE("Evaluator::specialize")
 {
     Evaluator e(min(Tree::X(), Tree::Y()));
@@ -400,6 +701,205 @@ TEST_CASE("Evaluator::getAmbiguous")
     REQUIRE(b(3) == 1);
 }
 
+TEST_CASE("Evaluator::push: Performance")
+{
+    // Build a union of many spheres, so that deeper pushes prune away
+    // most of the tape
+    Tree t = sphere(0.1);
+    for (int i=0; i < 20; ++i)
+    {
+        for (int j=0; j < 20; ++j)
+        {
+            t = min(t, sphere(0.1, {i * 0.25f, j * 0.25f, 0}));
+        }
+    }
+    Evaluator e(t);
+
+    std::chrono::time_point<std::chrono::system_clock> start, end;
+    std::chrono::duration<double> elapsed;
+    std::string log;
+
+    // Descend towards a single sphere, timing push / pop at each depth
+    const Eigen::Vector3f center(1.3, 1.3, 0);
+    const int count = 1000;
+    for (int depth=0; depth <= 12; ++depth)
+    {
+        const Eigen::Vector3f r = Eigen::Vector3f::Constant(8.0f / (1 << depth));
+        e.eval(center - r, center + r);
+
+        // Time with and without the tape cache (which hits every time)
+        double us[2];
+        for (int cached=0; cached < 2; ++cached)
+        {
+            e.setTapeCacheSize(cached ? 32 : 0);
+            start = std::chrono::system_clock::now();
+            for (int i=0; i < count; ++i)
+            {
+                e.push();
+                e.pop();
+            }
+            end = std::chrono::system_clock::now();
+            elapsed = end - start;
+            us[cached] = elapsed.count() / count * 1e6;
+        }
+
+        log += "\nDepth " + std::to_string(depth) + ": utilization " +
+               std::to_string(e.utilization()) + ", push / pop in " +
+               std::to_string(us[0]) + " us (" + std::to_string(us[1]) +
+               " us cached)";
+
+        // Then go one level deeper for the next round
+        e.push();
+    }
+    REQUIRE(e.utilization() < 0.01);
+
+    WARN(log);
+}
+
+TEST_CASE("Evaluator::eval (interval): Performance")
+{
+    std::chrono::time_point<std::chrono::system_clock> start, end;
+    std::chrono::duration<double> elapsed;
+    std::string log;
+
+    Tree x = Tree::X(), y = Tree::Y(), z = Tree::Z();
+    const std::vector<std::pair<std::string, Tree>> shapes = {
+        {"sphere", sphere(1)},
+        {"sponge", menger(2)},
+        {"gyroid", sin(x * 4) * cos(y * 4) + sin(y * 4) * cos(z * 4) +
+                   sin(z * 4) * cos(x * 4)}};
+
+    // Evaluate each shape over a 32^3 grid of boxes
+    const int n = 32;
+    const float size = 3.0f / n;
+    for (auto& s : shapes)
+    {
+        Evaluator e(s.second);
+        bool ambiguous = false;
+
+        start = std::chrono::system_clock::now();
+        for (int i=0; i < n; ++i)
+        {
+            for (int j=0; j < n; ++j)
+            {
+                for (int k=0; k < n; ++k)
+                {
+                    const Eigen::Vector3f lower(i * size - 1.5f,
+                                                j * size - 1.5f,
+                                                k * size - 1.5f);
+                    auto out = e.eval(lower, lower +
+                                      Eigen::Vector3f::Constant(size));
+                    ambiguous |= Interval::state(out) == Interval::AMBIGUOUS;
+                }
+            }
+        }
+        end = std::chrono::system_clock::now();
+        elapsed = end - start;
+        REQUIRE(ambiguous);
+
+        log += "\nEvaluated " + s.first + " on " + std::to_string(n*n*n) +
+               " boxes in " + std::to_string(elapsed.count()) + " sec";
+
+        // Then evaluate the same boxes in batches
+        const int b = Result::K;
+        start = std::chrono::system_clock::now();
+        for (int i=0; i < n; ++i)
+        {
+            for (int j=0; j < n; ++j)
+            {
+                for (int k=0; k < n; ++k)
+                {
+                    const Eigen::Vector3f lower(i * size - 1.5f,
+                                                j * size - 1.5f,
+                                                k * size - 1.5f);
+                    e.set(lower, lower + Eigen::Vector3f::Constant(size),
+                          k % b);
+                    if (k % b == b - 1)
+                    {
+                        e.intervals(b);
+                    }
+                }
+            }
+        }
+        end = std::chrono::system_clock::now();
+        elapsed = end - start;
+
+        log += " (" + std::to_string(elapsed.count()) + " sec in batches of " +
+               std::to_string(b) + ")";
+    }
+
+    WARN(log);
+}
+
+TEST_CASE("Evaluator::setRangeMode: Performance")
+{
+    std::chrono::time_point<std::chrono::system_clock> start, end;
+    std::chrono::duration<double> elapsed;
+    std::string log;
+
+    Tree x = Tree::X(), y = Tree::Y(), z = Tree::Z();
+    Eigen::Matrix3f m;
+    m = Eigen::AngleAxisf(float(M_PI/4), Eigen::Vector3f::UnitY()) *
+        Eigen::AngleAxisf(float(atan(1/sqrt(2))), Eigen::Vector3f::UnitX());
+    auto rotate = [&](Tree t) {
+        return t.remap(m(0,0)*x + m(0,1)*y + m(0,2)*z,
+                       m(1,0)*x + m(1,1)*y + m(1,2)*z,
+                       m(2,0)*x + m(2,1)*y + m(2,2)*z); };
+
+    const std::vector<std::pair<std::string, Tree>> shapes = {
+        {"sphere", sphere(1.5)},
+        {"sponge", menger(2)},
+        {"rotated sponge", rotate(menger(2))},
+        {"rotated box", rotate(box({-1, -1, -1}, {1, 1, 1}))},
+        {"quadratic", square(x) - 2 * x * y + square(y) + square(z) - 1}};
+
+    // Count the boxes in a 32^3 grid that each mode can't prove to be
+    // empty or filled (which would be subdivided further by a renderer)
+    const int n = 32;
+    const float size = 5.0f / n;
+    for (auto& s : shapes)
+    {
+        Evaluator e(s.second);
+        int ambiguous[3] = {0, 0, 0};
+        for (auto mode : {Evaluator::INTERVAL, Evaluator::AFFINE,
+                          Evaluator::MEAN_VALUE})
+        {
+            e.setRangeMode(mode);
+
+            start = std::chrono::system_clock::now();
+            for (int i=0; i < n; ++i)
+            {
+                for (int j=0; j < n; ++j)
+                {
+                    for (int k=0; k < n; ++k)
+                    {
+                        const Eigen::Vector3f lower(i * size - 2.5f,
+                                                    j * size - 2.5f,
+                                                    k * size - 2.5f);
+                        auto out = e.eval(lower, lower +
+                                          Eigen::Vector3f::Constant(size));
+                        ambiguous[mode] += Interval::state(out) ==
+                                           Interval::AMBIGUOUS;
+                    }
+                }
+            }
+            end = std::chrono::system_clock::now();
+            elapsed = end - start;
+
+            const char* labels[] = {": ", " (affine): ", " (mean value): "};
+            log += "\n" + s.first + labels[mode] +
+                   std::to_string(ambiguous[mode]) + " ambiguous in " +
+                   std::to_string(elapsed.count()) + " sec";
+        }
+        REQUIRE(ambiguous[Evaluator::AFFINE] <=
+                ambiguous[Evaluator::INTERVAL]);
+        REQUIRE(ambiguous[Evaluator::MEAN_VALUE] <=
+                ambiguous[Evaluator::INTERVAL]);
+    }
+
+    WARN(log);
+}
+
 TEST_CASE("Evaluator::push(Feature)")
 {
     Evaluator e(min(Tree::X(), -Tree::X()));
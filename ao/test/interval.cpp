@@ -0,0 +1,185 @@
+#include <cmath>
+
+#include "catch.hpp"
+
+#include "ao/eval/interval.hpp"
+
+using namespace Kernel;
+using Interval::I;
+
+TEST_CASE("Interval::I: exact arithmetic")
+{
+    auto a = I(1, 2) + I(1, 1);
+    REQUIRE(a.lower() == 2);
+    REQUIRE(a.upper() == 3);
+
+    auto b = I(-2, 3) * I(4, 5);
+    REQUIRE(b.lower() == -10);
+    REQUIRE(b.upper() == 15);
+
+    auto c = I(1, 4) / I(2, 2);
+    REQUIRE(c.lower() == 0.5);
+    REQUIRE(c.upper() == 2);
+
+    auto d = Interval::sqrt(I(4, 9));
+    REQUIRE(d.lower() == 2);
+    REQUIRE(d.upper() == 3);
+}
+
+TEST_CASE("Interval::I: outward rounding")
+{
+    SECTION("Sum")
+    {
+        auto a = I(0.1f) + I(0.2f);
+        REQUIRE(a.lower() < a.upper());
+        REQUIRE(a.lower() <= double(0.1f) + double(0.2f));
+        REQUIRE(a.upper() >= double(0.1f) + double(0.2f));
+    }
+
+    SECTION("Sum with a tiny value")
+    {
+        // The double-precision sum is rounded back onto 1 here
+        auto a = I(1) + I(-1e-30f);
+        REQUIRE(a.lower() < 1);
+        REQUIRE(a.upper() == 1);
+    }
+
+    SECTION("Product")
+    {
+        auto a = I(1.1f) * I(1.1f);
+        REQUIRE(a.lower() < a.upper());
+        REQUIRE(a.lower() <= double(1.1f) * double(1.1f));
+        REQUIRE(a.upper() >= double(1.1f) * double(1.1f));
+    }
+
+    SECTION("Quotient")
+    {
+        auto a = I(1) / I(3);
+        REQUIRE(a.lower() <= 1 / 3.0);
+        REQUIRE(a.upper() >= 1 / 3.0);
+    }
+
+    SECTION("Overflow")
+    {
+        const float m = std::numeric_limits<float>::max();
+        auto a = I(m) * I(2);
+        REQUIRE(a.lower() == m);
+        REQUIRE(a.upper() == INFINITY);
+    }
+}
+
+TEST_CASE("Interval::I: empty intervals")
+{
+    REQUIRE(I(2, 1).isNaN());
+    REQUIRE(I(NAN).isNaN());
+    REQUIRE((I(2, 1) + I(1)).isNaN());
+    REQUIRE(Interval::sqrt(I(-2, -1)).isNaN());
+    REQUIRE(Interval::asin(I(2, 3)).isNaN());
+    REQUIRE((I(1) / I(0)).isNaN());
+}
+
+TEST_CASE("Interval::I: division by zero")
+{
+    auto a = I(1, 2) / I(-1, 1);
+    REQUIRE(a.lower() == -INFINITY);
+    REQUIRE(a.upper() == INFINITY);
+
+    auto b = I(1, 2) / I(0, 1);
+    REQUIRE(b.lower() == 1);
+    REQUIRE(b.upper() == INFINITY);
+
+    auto c = I(0) / I(-1, 1);
+    REQUIRE(c.lower() == 0);
+    REQUIRE(c.upper() == 0);
+}
+
+TEST_CASE("Interval::I: transcendental functions")
+{
+    SECTION("sin / cos")
+    {
+        // Finds the extrema within an interval
+        auto s = Interval::sin(I(1, 2));
+        REQUIRE(s.lower() <= std::sin(1.0));
+        REQUIRE(s.upper() == 1);
+
+        auto c = Interval::cos(I(3, 4));
+        REQUIRE(c.lower() == -1);
+        REQUIRE(c.upper() >= std::cos(4.0));
+
+        // Far from zero
+        const float fl = 1000 * M_PI - 0.1;
+        const float fu = 1000 * M_PI + 0.2;
+        auto f = Interval::cos(I(fl, fu));
+        REQUIRE(f.upper() == 1);
+        REQUIRE(f.lower() <= std::cos(double(fu)));
+        REQUIRE(f.lower() > 0.9);
+
+        // Whole periods
+        auto w = Interval::sin(I(0, 7));
+        REQUIRE(w.lower() == -1);
+        REQUIRE(w.upper() == 1);
+
+        // libm results are widened by an ulp, but stay within [-1, 1]
+        auto z = Interval::cos(I(0));
+        REQUIRE(z.lower() == Interval::nextDown(1));
+        REQUIRE(z.upper() == 1);
+    }
+
+    SECTION("tan")
+    {
+        auto t = Interval::tan(I(1, 2));
+        REQUIRE(t.lower() == -INFINITY);
+        REQUIRE(t.upper() == INFINITY);
+
+        auto u = Interval::tan(I(-1, 1));
+        REQUIRE(u.lower() <= std::tan(-1.0));
+        REQUIRE(u.upper() >= std::tan(1.0));
+        REQUIRE(u.upper() < 1.6);
+    }
+
+    SECTION("exp")
+    {
+        auto e = Interval::exp(I(0, 1));
+        REQUIRE(e.lower() <= 1);
+        REQUIRE(e.lower() > 0.9999);
+        REQUIRE(e.upper() >= M_E);
+        REQUIRE(e.upper() < 2.72);
+    }
+
+    SECTION("pow / nth_root")
+    {
+        auto p = Interval::pow(I(-2, 3), 2);
+        REQUIRE(p.lower() == 0);
+        REQUIRE(p.upper() == 9);
+
+        auto q = Interval::pow(I(-2, 3), 3);
+        REQUIRE(q.lower() == -8);
+        REQUIRE(q.upper() == 27);
+
+        auto r = Interval::nth_root(I(-8, 27), 3);
+        REQUIRE(r.lower() <= -2);
+        REQUIRE(r.lower() == Approx(-2));
+        REQUIRE(r.upper() >= 3);
+        REQUIRE(r.upper() == Approx(3));
+    }
+
+    SECTION("libm slack")
+    {
+        // libm isn't correctly rounded, so even a point is widened
+        auto a = Interval::atan(I(1));
+        REQUIRE(a.lower() < a.upper());
+        REQUIRE(a.lower() <= M_PI / 4);
+        REQUIRE(a.upper() >= M_PI / 4);
+    }
+
+    SECTION("atan2")
+    {
+        auto a = Interval::atan2(I(1, 2), I(1, 2));
+        REQUIRE(a.lower() <= std::atan2(1.0, 2.0));
+        REQUIRE(a.upper() >= std::atan2(2.0, 1.0));
+
+        auto b = Interval::atan2(I(-1, 1), I(-2, -1));
+        REQUIRE(b.lower() <= -M_PI);
+        REQUIRE(b.upper() >= M_PI);
+    }
+}
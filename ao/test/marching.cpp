@@ -37,3 +37,19 @@ TEST_CASE("Marching::buildTable<3>")
     REQUIRE(t->v[0][0][0].first == -1);
     REQUIRE(t->v[255][0][0].first == -1);
 }
+
+TEST_CASE("Marching::TABLE2")
+{
+    auto t = Marching::buildTable<2>();
+    REQUIRE(Marching::TABLE2.v == t->v);
+    REQUIRE(Marching::TABLE2.e == t->e);
+    REQUIRE(Marching::TABLE2.p == t->p);
+}
+
+TEST_CASE("Marching::TABLE3")
+{
+    auto t = Marching::buildTable<3>();
+    REQUIRE(Marching::TABLE3.v == t->v);
+    REQUIRE(Marching::TABLE3.e == t->e);
+    REQUIRE(Marching::TABLE3.p == t->p);
+}
@@ -1,4 +1,7 @@
 #include <chrono>
+#include <cstdio>
+#include <fstream>
+#include <sstream>
 
 #include "catch.hpp"
 
@@ -51,6 +54,22 @@ TEST_CASE("Mesh::render (cube)")
     auto mesh = Mesh::render(cube, r);
 }
 
+TEST_CASE("Mesh::render (parallel walk)")
+{
+    Tree sponge = max(menger(2), -sphere(1, {1.5, 1.5, 1.5}));
+    Region<3> r({-2.5, -2.5, -2.5}, {2.5, 2.5, 2.5});
+    std::atomic_bool cancel(false);
+    std::map<Tree::Id, float> vars;
+
+    // The parallel walk should give exactly the same mesh as a serial one
+    auto serial = Mesh::render(sponge, vars, r, 0.05, 1e-8, cancel, 1);
+    auto parallel = Mesh::render(sponge, vars, r, 0.05, 1e-8, cancel, 8);
+
+    REQUIRE(serial->branes.size() > 0);
+    REQUIRE(serial->verts == parallel->verts);
+    REQUIRE(serial->branes == parallel->branes);
+}
+
 TEST_CASE("Mesh::render (performance)")
 {
     std::chrono::time_point<std::chrono::system_clock> start, end;
@@ -84,3 +103,323 @@ TEST_CASE("Mesh::Render (face count in rectangular prism)")
     REQUIRE(m->verts.size() == 9); // index 0 is unused
     REQUIRE(m->branes.size() == 12);
 }
+
+/*
+ *  Reads a whole file into a string
+ */
+static std::string slurp(const std::string& filename)
+{
+    std::ifstream in(filename, std::ios::in | std::ios::binary);
+    std::stringstream ss;
+    ss << in.rdbuf();
+    return ss.str();
+}
+
+TEST_CASE("Mesh::save")
+{
+    auto t = max(max(max(-Tree::X(), Tree::X() - 4),
+                     max(-Tree::Y(), Tree::Y() - 1)),
+                     max(-Tree::Z(), Tree::Z() - 0.25));
+    auto m = Mesh::render(t, Region<3>({-1, -1, -1}, {5, 2, 1.25}), 0.125);
+    REQUIRE(m->verts.size() == 9);
+    REQUIRE(m->branes.size() == 12);
+
+    SECTION("STL")
+    {
+        REQUIRE(m->save("ao-test-mesh.stl"));
+        auto data = slurp("ao-test-mesh.stl");
+        REQUIRE(data.size() == 80 + 4 + 12 * 50);
+
+        uint32_t count;
+        memcpy(&count, &data[80], sizeof(count));
+        REQUIRE(count == 12);
+
+        // Check the last vertex of the last triangle
+        float v[3];
+        memcpy(v, &data[data.size() - 14], sizeof(v));
+        const auto& expected = m->verts[m->branes.back()[2]];
+        REQUIRE(v[0] == expected.x());
+        REQUIRE(v[1] == expected.y());
+        REQUIRE(v[2] == expected.z());
+        std::remove("ao-test-mesh.stl");
+    }
+
+    SECTION("PLY")
+    {
+        REQUIRE(m->save("ao-test-mesh.ply"));
+        auto data = slurp("ao-test-mesh.ply");
+        auto end = data.find("end_header\n");
+        REQUIRE(end != std::string::npos);
+        REQUIRE(data.find("element vertex 8\n") < end);
+        REQUIRE(data.find("element face 12\n") < end);
+
+        const size_t body = end + strlen("end_header\n");
+        REQUIRE(data.size() == body + 8 * 12 + 12 * 13);
+
+        // Indices are shifted down by one (since vertex 0 is a marker)
+        uint32_t face[3];
+        memcpy(face, &data[body + 8 * 12 + 1], sizeof(face));
+        REQUIRE(face[0] == m->branes[0][0] - 1);
+        REQUIRE(face[1] == m->branes[0][1] - 1);
+        REQUIRE(face[2] == m->branes[0][2] - 1);
+        std::remove("ao-test-mesh.ply");
+    }
+
+    SECTION("OBJ")
+    {
+        REQUIRE(m->save("ao-test-mesh.obj"));
+        std::ifstream in("ao-test-mesh.obj");
+        std::string line;
+        int vs = 0;
+        int fs = 0;
+        while (std::getline(in, line))
+        {
+            if (line[0] == 'v')
+            {
+                vs++;
+            }
+            else if (line[0] == 'f')
+            {
+                // OBJ is 1-indexed, so indices line up with ours
+                if (fs == 0)
+                {
+                    std::stringstream ss(line.substr(2));
+                    uint32_t a, b, c;
+                    ss >> a >> b >> c;
+                    REQUIRE(a == m->branes[0][0]);
+                    REQUIRE(b == m->branes[0][1]);
+                    REQUIRE(c == m->branes[0][2]);
+                }
+                fs++;
+            }
+        }
+        REQUIRE(vs == 8);
+        REQUIRE(fs == 12);
+        std::remove("ao-test-mesh.obj");
+    }
+}
+
+/*
+ *  Sink that rebuilds a mesh in memory
+ */
+class RebuildSink : public MeshSink
+{
+public:
+    RebuildSink() { verts.push_back(Eigen::Vector3f::Zero()); }
+    void vertex(const Eigen::Vector3f& v) override { verts.push_back(v); }
+    void triangle(const Eigen::Matrix<uint32_t, 3, 1>& t,
+                  const std::array<Eigen::Vector3f, 3>& pos) override
+    {
+        // Vertices must arrive before the triangles that use them
+        for (unsigned i=0; i < 3; ++i)
+        {
+            ok &= (t[i] < verts.size()) && (verts[t[i]] == pos[i]);
+        }
+        branes.push_back(t);
+    }
+
+    std::vector<Eigen::Vector3f> verts;
+    std::vector<Eigen::Matrix<uint32_t, 3, 1>> branes;
+    bool ok=true;
+};
+
+TEST_CASE("Mesh::render (streaming)")
+{
+    Tree sponge = max(menger(2), -sphere(1, {1.5, 1.5, 1.5}));
+    Region<3> r({-2.5, -2.5, -2.5}, {2.5, 2.5, 2.5});
+    std::atomic_bool cancel(false);
+    std::map<Tree::Id, float> vars;
+
+    auto mesh = Mesh::render(sponge, vars, r, 0.05, 1e-8, cancel, 1);
+
+    SECTION("Sink")
+    {
+        RebuildSink sink;
+        REQUIRE(Mesh::render(sponge, vars, r, 0.05, 1e-8, cancel, sink));
+        REQUIRE(sink.ok);
+        REQUIRE(sink.verts == mesh->verts);
+        REQUIRE(sink.branes == mesh->branes);
+    }
+
+    SECTION("STLSink")
+    {
+        {
+            STLSink sink("ao-test-stream.stl");
+            REQUIRE(Mesh::render(sponge, vars, r, 0.05, 1e-8, cancel, sink));
+            REQUIRE(sink.close());
+        }
+        REQUIRE(mesh->saveSTL("ao-test-mesh.stl"));
+        auto streamed = slurp("ao-test-stream.stl");
+        REQUIRE(streamed.size() == 84 + mesh->branes.size() * 50);
+        REQUIRE(streamed == slurp("ao-test-mesh.stl"));
+        std::remove("ao-test-stream.stl");
+        std::remove("ao-test-mesh.stl");
+    }
+}
+
+/*
+ *  Checks that every directed edge in the mesh appears exactly once, with
+ *  its reverse also appearing once (so the mesh is closed and consistently
+ *  oriented)
+ */
+static bool isWatertight(const std::vector<Eigen::Matrix<uint32_t, 3, 1>>& tris)
+{
+    std::map<std::pair<uint32_t, uint32_t>, int> edges;
+    for (const auto& t : tris)
+    {
+        // Skip degenerate triangles, which show up where a quad touches
+        // the same (collapsed) cell twice
+        if (t[0] == t[1] || t[1] == t[2] || t[2] == t[0])
+        {
+            continue;
+        }
+        for (unsigned i=0; i < 3; ++i)
+        {
+            edges[{t[i], t[(i + 1) % 3]}]++;
+        }
+    }
+    for (const auto& e : edges)
+    {
+        auto r = edges.find({e.first.second, e.first.first});
+        if (e.second != 1 || r == edges.end() || r->second != 1)
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+TEST_CASE("Mesh::renderTiled")
+{
+    std::atomic_bool cancel(false);
+    std::map<Tree::Id, float> vars;
+
+    SECTION("Sphere")
+    {
+        // The sphere sits entirely inside the region, so the mesh is closed
+        Tree s = sphere(0.7, {0.1, 0.2, 0.05});
+        Region<3> r({-1, -1, -1}, {1, 1, 1});
+
+        RebuildSink tiled;
+        REQUIRE(Mesh::renderTiled(s, vars, r, 0.05, 1e-8, cancel, tiled, 2));
+        REQUIRE(tiled.ok);
+        REQUIRE(tiled.branes.size() > 0);
+        REQUIRE(isWatertight(tiled.branes));
+
+        // Tiling shouldn't change the mesh
+        RebuildSink flat;
+        REQUIRE(Mesh::render(s, vars, r, 0.05, 1e-8, cancel, flat));
+        REQUIRE(flat.branes.size() == tiled.branes.size());
+
+        // Vertices should all be on the sphere's surface
+        float err = 0;
+        for (auto v = tiled.verts.begin() + 1; v != tiled.verts.end(); ++v)
+        {
+            err = fmax(err, fabs((*v - Eigen::Vector3f(0.1, 0.2, 0.05)).norm() - 0.7));
+        }
+        REQUIRE(err < 0.01);
+    }
+
+    SECTION("Sponge")
+    {
+        Tree sponge = max(menger(2), -sphere(1, {1.5, 1.5, 1.5}));
+        Region<3> r({-2.5, -2.5, -2.5}, {2.5, 2.5, 2.5});
+
+        RebuildSink flat;
+        REQUIRE(Mesh::render(sponge, vars, r, 0.05, 1e-8, cancel, flat));
+        REQUIRE(isWatertight(flat.branes));
+
+        RebuildSink tiled;
+        REQUIRE(Mesh::renderTiled(sponge, vars, r, 0.05, 1e-8, cancel,
+                                  tiled, 2));
+        REQUIRE(tiled.ok);
+        REQUIRE(isWatertight(tiled.branes));
+    }
+}
+
+TEST_CASE("Mesh::render (incremental)")
+{
+    // A sponge with a small sphere that moves along the x axis
+    auto x = Tree::var();
+    Tree ball = sqrt(square(Tree::X() - x) + square(Tree::Y() - 2.2) +
+                     square(Tree::Z() - 2.2)) - 0.2;
+    Tree shape = min(max(menger(2), -sphere(1, {1.5, 1.5, 1.5})), ball);
+    Region<3> r({-2.5, -2.5, -2.5}, {2.5, 2.5, 2.5});
+    std::atomic_bool cancel(false);
+
+    std::vector<Evaluator> evals;
+    evals.reserve(8);
+    evals.emplace_back(shape, std::map<Tree::Id, float>{{x.id(), 0}});
+    for (unsigned i=1; i < evals.capacity(); ++i)
+    {
+        evals.emplace_back(evals.front());
+    }
+    std::vector<Evaluator*> es;
+    for (auto& e : evals)
+    {
+        es.push_back(&e);
+    }
+
+    std::unique_ptr<const XTree<3>> xtree;
+    auto first = Mesh::render(es, r, 0.05, 1e-8, cancel, xtree, {});
+    REQUIRE(first.get() != nullptr);
+    REQUIRE(xtree.get() != nullptr);
+
+    for (auto e : es)
+    {
+        e->setVar(x.id(), 0.5);
+    }
+
+    std::chrono::time_point<std::chrono::system_clock> start, mid, end;
+    start = std::chrono::system_clock::now();
+    auto incremental = Mesh::render(es, r, 0.05, 1e-8, cancel, xtree,
+                                    {x.id()});
+    mid = std::chrono::system_clock::now();
+    auto full = Mesh::render(es, r, 0.05, 1e-8, cancel);
+    end = std::chrono::system_clock::now();
+
+    std::chrono::duration<double> a = mid - start;
+    std::chrono::duration<double> b = end - mid;
+    WARN("\nRe-meshed moved sphere in " + std::to_string(a.count()) +
+         " sec (vs. " + std::to_string(b.count()) + " sec from scratch)");
+
+    REQUIRE(incremental.get() != nullptr);
+    REQUIRE(incremental->verts.size() == full->verts.size());
+    REQUIRE(incremental->branes.size() == full->branes.size());
+    for (unsigned i=0; i < full->verts.size(); ++i)
+    {
+        CAPTURE(i);
+        REQUIRE(incremental->verts[i] == full->verts[i]);
+    }
+    for (unsigned i=0; i < full->branes.size(); ++i)
+    {
+        CAPTURE(i);
+        REQUIRE(incremental->branes[i] == full->branes[i]);
+    }
+}
+
+TEST_CASE("Mesh::save (performance)")
+{
+    Tree sponge = max(menger(2), -sphere(1, {1.5, 1.5, 1.5}));
+    Region<3> r({-2.5, -2.5, -2.5}, {2.5, 2.5, 2.5});
+    auto mesh = Mesh::render(sponge, r, 0.02);
+
+    std::string log = "\nSaving " + std::to_string(mesh->branes.size()) +
+                      " triangles:";
+    for (auto ext : {"stl", "ply", "obj"})
+    {
+        const std::string filename = std::string("ao-test-mesh.") + ext;
+
+        auto start = std::chrono::system_clock::now();
+        REQUIRE(mesh->save(filename));
+        auto end = std::chrono::system_clock::now();
+        std::chrono::duration<double> elapsed = end - start;
+
+        const double mb = slurp(filename).size() / 1e6;
+        log += "\n  " + std::string(ext) + ": " + std::to_string(mb) +
+               " MB in " + std::to_string(elapsed.count()) + " sec (" +
+               std::to_string(mb / elapsed.count()) + " MB/s)";
+        std::remove(filename.c_str());
+    }
+    WARN(log);
+}
@@ -0,0 +1,74 @@
+#include "catch.hpp"
+
+#include "ao/render/pool.hpp"
+#include "ao/render/brep/xtree.hpp"
+
+#include "util/shapes.hpp"
+
+using namespace Kernel;
+
+TEST_CASE("WorkPool::run")
+{
+    Evaluator a(Tree::X()), b(Tree::X()), c(Tree::X()), d(Tree::X());
+    WorkPool pool({&a, &b, &c, &d});
+    REQUIRE(pool.size() == 4);
+
+    // Recursively spawn a binary tree of tasks, counting the leaves
+    std::atomic_uint leaves(0);
+    std::function<void(unsigned, unsigned)> recurse =
+        [&](unsigned w, unsigned depth)
+        {
+            if (depth == 0)
+            {
+                leaves++;
+                return;
+            }
+            std::atomic_uint pending(1);
+            pool.spawn(w, [&](unsigned w_) {
+                    recurse(w_, depth - 1);
+                    pending--; });
+            recurse(w, depth - 1);
+            pool.wait(w, pending);
+        };
+
+    pool.run([&](unsigned w){ recurse(w, 10); });
+    REQUIRE(leaves.load() == 1024);
+}
+
+TEST_CASE("XTree<3>::build with multiple workers")
+{
+    // Walks two trees in lockstep, checking that they match
+    std::function<void(const XTree<3>*, const XTree<3>*)> compare =
+        [&](const XTree<3>* a, const XTree<3>* b)
+        {
+            REQUIRE(a->isBranch() == b->isBranch());
+            REQUIRE(a->type == b->type);
+            REQUIRE(a->corner_mask == b->corner_mask);
+            REQUIRE(a->vertex_count == b->vertex_count);
+            for (unsigned i=0; i < a->vertex_count; ++i)
+            {
+                REQUIRE(a->vert(i) == b->vert(i));
+            }
+            if (a->isBranch())
+            {
+                for (unsigned i=0; i < a->children->size(); ++i)
+                {
+                    compare(a->child(i), b->child(i));
+                }
+            }
+        };
+
+    auto s = max(sphere(1), -sphere(0.6, {0.5, 0.5, 0.5}));
+    Region<3> r({-1.5, -1.5, -1.5}, {1.5, 1.5, 1.5});
+    std::map<Tree::Id, float> vars;
+    std::atomic_bool cancel(false);
+
+    auto serial = XTree<3>::build(s, vars, r, 0.05, 1e-8, 1, cancel);
+    for (unsigned workers : {2, 3, 16})
+    {
+        CAPTURE(workers);
+        auto parallel = XTree<3>::build(s, vars, r, 0.05, 1e-8,
+                                        workers, cancel);
+        compare(serial.get(), parallel.get());
+    }
+}
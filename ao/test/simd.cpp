@@ -0,0 +1,130 @@
+#include <cmath>
+#include <vector>
+
+#include "catch.hpp"
+
+#include "ao/eval/simd.hpp"
+
+using namespace Kernel;
+
+/*
+ *  Runs a SIMD kernel over the given inputs, returning the results
+ *  (inputs are padded out to a multiple of 8, as kernels require)
+ */
+static std::vector<float> run(Simd::Fn k, std::vector<float> a,
+                              std::vector<float> b)
+{
+    const auto count = a.size();
+    a.resize((count + 7) & ~7, 0);
+    b.resize(a.size(), 1);
+    std::vector<float> out(a.size());
+    k(out.data(), a.data(), b.data(), count);
+    out.resize(count);
+    return out;
+}
+
+TEST_CASE("Simd::kernel")
+{
+    if (Simd::kernel(Opcode::ADD) == nullptr)
+    {
+        WARN("No SIMD kernels on this CPU (" << Simd::isa() << ")");
+        return;
+    }
+
+    // Sweep over a range of inputs, with a count that isn't a multiple of 8
+    std::vector<float> xs;
+    for (int i=0; i < 4001; ++i)
+    {
+        xs.push_back((i - 2000) / 20.0f);
+    }
+
+    SECTION("sin / cos")
+    {
+        auto s = run(Simd::kernel(Opcode::SIN), xs, xs);
+        auto c = run(Simd::kernel(Opcode::COS), xs, xs);
+        float err = 0;
+        for (unsigned i=0; i < xs.size(); ++i)
+        {
+            err = fmax(err, fabs(s[i] - sin(xs[i])));
+            err = fmax(err, fabs(c[i] - cos(xs[i])));
+        }
+        REQUIRE(err < 3e-7);
+
+        // Large inputs fall back to the C library
+        auto big = run(Simd::kernel(Opcode::SIN), {1e6, INFINITY}, {});
+        REQUIRE(big[0] == std::sin(1e6f));
+        REQUIRE(std::isnan(big[1]));
+    }
+
+    SECTION("exp")
+    {
+        auto e = run(Simd::kernel(Opcode::EXP), xs, xs);
+        float err = 0;
+        for (unsigned i=0; i < xs.size(); ++i)
+        {
+            const float expected = exp(xs[i]);
+            if (std::isnormal(expected))
+            {
+                err = fmax(err, fabs(e[i] - expected) / expected);
+            }
+        }
+        REQUIRE(err < 2e-7);
+
+        auto edge = run(Simd::kernel(Opcode::EXP), {-200, 200, NAN}, {});
+        REQUIRE(edge[0] == 0);
+        REQUIRE(edge[1] == INFINITY);
+        REQUIRE(std::isnan(edge[2]));
+    }
+
+    SECTION("atan2")
+    {
+        std::vector<float> ys;
+        for (unsigned i=0; i < xs.size(); ++i)
+        {
+            ys.push_back(xs[(i * 7) % xs.size()]);
+        }
+        auto a = run(Simd::kernel(Opcode::ATAN2), ys, xs);
+        float err = 0;
+        for (unsigned i=0; i < xs.size(); ++i)
+        {
+            const float expected = atan2(ys[i], xs[i]);
+            err = fmax(err, fabs(a[i] - expected) / fmax(fabs(expected), 1e-3));
+        }
+        REQUIRE(err < 5e-7);
+
+        // Signed zeros behave like std::atan2
+        auto z = run(Simd::kernel(Opcode::ATAN2), {0, -0.0f, 0, -0.0f, 1},
+                                                  {0, 0, -0.0f, -0.0f, -0.0f});
+        REQUIRE(z[0] == atan2(0.0f, 0.0f));
+        REQUIRE(std::signbit(z[1]));
+        REQUIRE(z[2] == Approx(M_PI));
+        REQUIRE(z[3] == Approx(-M_PI));
+        REQUIRE(z[4] == Approx(M_PI / 2));
+    }
+
+    SECTION("mod")
+    {
+        auto m = run(Simd::kernel(Opcode::MOD), xs,
+                     std::vector<float>(xs.size(), 0.7f));
+        for (unsigned i=0; i < xs.size(); ++i)
+        {
+            float expected = fmod(xs[i], 0.7f);
+            if (expected < 0)
+            {
+                expected += 0.7f;
+            }
+            CAPTURE(xs[i]);
+            REQUIRE(m[i] == expected);
+        }
+    }
+
+    SECTION("min / max with NaN")
+    {
+        auto lo = run(Simd::kernel(Opcode::MIN), {NAN, 1}, {1, NAN});
+        auto hi = run(Simd::kernel(Opcode::MAX), {NAN, 1}, {1, NAN});
+        REQUIRE(std::isnan(lo[0]) == std::isnan(std::min(NAN, 1.0f)));
+        REQUIRE(std::isnan(lo[1]) == std::isnan(std::min(1.0f, NAN)));
+        REQUIRE(std::isnan(hi[0]) == std::isnan(std::max(NAN, 1.0f)));
+        REQUIRE(std::isnan(hi[1]) == std::isnan(std::max(1.0f, NAN)));
+    }
+}
@@ -1,6 +1,14 @@
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <set>
+#include <thread>
+
 #include "catch.hpp"
 
 #include "ao/tree/tree.hpp"
+#include "ao/tree/arena.hpp"
+#include "ao/eval/evaluator.hpp"
 
 using namespace Kernel;
 
@@ -111,3 +119,160 @@ TEST_CASE("Tree: operator<<")
     ss << (Tree::X() + 5);
     REQUIRE(ss.str() == "(+ x 5)");
 }
+
+TEST_CASE("Tree: deep chain destruction")
+{
+    // Dropping this tree recursively would overflow the stack
+    auto build = [](){
+        auto t = Tree::X();
+        for (unsigned i=0; i < 1000000; ++i)
+        {
+            t = sin(t);
+        }
+        return t;
+    };
+
+    {
+        auto t = build();
+        REQUIRE(t->rank == 1000000);
+    }
+
+    // Blocks from the first tree should be recycled for the second one
+    const auto reserved = Arena::reserved();
+    {
+        auto t = build();
+        REQUIRE(t->rank == 1000000);
+    }
+    REQUIRE(Arena::reserved() == reserved);
+}
+
+TEST_CASE("Arena: blocks freed on another thread")
+{
+    // One thread builds trees and another drops them (like a script thread
+    // handing trees to a renderer), so the freed blocks have to make their
+    // way back to the building thread
+    std::mutex mut;
+    std::condition_variable cv;
+    std::vector<Tree> inbox;
+    unsigned dropped = 0;
+    bool done = false;
+
+    std::thread consumer([&](){
+        std::unique_lock<std::mutex> lock(mut);
+        while (!done)
+        {
+            cv.wait(lock, [&](){ return done || inbox.size(); });
+            auto ts = std::move(inbox);
+            inbox.clear();
+            lock.unlock();
+            ts.clear();
+            lock.lock();
+            dropped++;
+            cv.notify_all();
+        }
+    });
+
+    size_t reserved = 0;
+    for (unsigned i=0; i < 10; ++i)
+    {
+        auto t = Tree::X();
+        for (unsigned j=0; j < 100000; ++j)
+        {
+            t = sin(t);
+        }
+
+        std::unique_lock<std::mutex> lock(mut);
+        inbox.push_back(std::move(t));
+        cv.notify_all();
+        cv.wait(lock, [&](){ return dropped == i + 1; });
+
+        if (i == 0)
+        {
+            reserved = Arena::reserved();
+        }
+    }
+    REQUIRE(Arena::reserved() < reserved + 100000);
+
+    {
+        std::lock_guard<std::mutex> lock(mut);
+        done = true;
+    }
+    cv.notify_all();
+    consumer.join();
+}
+
+TEST_CASE("Tree::ordered")
+{
+    auto a = Tree::X() + 1;
+    auto t = min(a * Tree::Y(), a / Tree::Z()) - a;
+
+    auto flat = t.ordered();
+    REQUIRE(flat.size() == 9);
+    REQUIRE(flat.back() == t);
+
+    std::set<Tree::Id> seen;
+    for (unsigned i=0; i < flat.size(); ++i)
+    {
+        seen.insert(flat[i].id());
+        if (i > 0)
+        {
+            REQUIRE(flat[i]->rank >= flat[i - 1]->rank);
+        }
+        // Children must come before their parents
+        if (flat[i]->lhs)
+        {
+            REQUIRE(seen.count(flat[i]->lhs.get()));
+        }
+        if (flat[i]->rhs)
+        {
+            REQUIRE(seen.count(flat[i]->rhs.get()));
+        }
+    }
+    REQUIRE(seen.size() == flat.size());
+}
+
+TEST_CASE("Tree::ordered: Performance")
+{
+    // Build a tree with 10^6 unique nodes
+    // (each iteration adds a constant, a MUL, and a SUB)
+    auto t = Tree::X();
+    for (int i=0; i < 333333; ++i)
+    {
+        t = t - Tree::Y() * (i + 2.0f);
+    }
+
+    std::chrono::time_point<std::chrono::system_clock> start, end;
+    std::chrono::duration<double> elapsed;
+    std::string log;
+
+    start = std::chrono::system_clock::now();
+    auto flat = t.ordered();
+    end = std::chrono::system_clock::now();
+    elapsed = end - start;
+    log += "\nFlattened " + std::to_string(flat.size()) + " nodes in " +
+           std::to_string(elapsed.count()) + " sec";
+    REQUIRE(flat.size() == 1000001);
+    REQUIRE(flat.back() == t);
+
+    WARN(log);
+}
+
+TEST_CASE("Tree::ordered: Evaluator construction", "[.benchmark]")
+{
+    // Same tree as above, but timing the whole Evaluator constructor,
+    // which is much slower and allocates far more memory than ordered()
+    auto t = Tree::X();
+    for (int i=0; i < 333333; ++i)
+    {
+        t = t - Tree::Y() * (i + 2.0f);
+    }
+
+    std::chrono::time_point<std::chrono::system_clock> start, end;
+    std::chrono::duration<double> elapsed;
+
+    start = std::chrono::system_clock::now();
+    Evaluator e(t);
+    end = std::chrono::system_clock::now();
+    elapsed = end - start;
+    WARN("Built Evaluator in " + std::to_string(elapsed.count()) + " sec");
+}
@@ -84,14 +84,14 @@ TEST_CASE("XTree<2>::rank")
     SECTION("Containing line")
     {
         auto e = XTree<2>::build(Tree::X(), Region<2>({-2, -2}, {2, 2}));
-        REQUIRE(e->rank == 1);
+        REQUIRE(e->leaf->rank == 1);
     }
 
     SECTION("Containing corner")
     {
         Tree a = min(Tree::X(), Tree::Y());
         auto ta = XTree<2>::build(a, Region<2>({-3, -3}, {1, 1}));
-        REQUIRE(ta->rank == 2);
+        REQUIRE(ta->leaf->rank == 2);
     }
 }
 
@@ -101,7 +101,7 @@ TEST_CASE("XTree<2>::vertex_count")
     {
         Tree a = min(Tree::X(), Tree::Y());
         auto ta = XTree<2>::build(a, Region<2>({-3, -3}, {3, 3}), 100);
-        REQUIRE(ta->rank == 2);
+        REQUIRE(ta->leaf->rank == 2);
         REQUIRE(ta->level == 0);
         REQUIRE(ta->vertex_count == 1);
     }
@@ -123,6 +123,37 @@ TEST_CASE("XTree<2>::vertex_count")
     }
 }
 
+TEST_CASE("XTree<2>::specialize")
+{
+    // The radius only depends on Z, which is fixed by the region
+    auto t = sqrt(square(Tree::X()) + square(Tree::Y())) -
+             (0.5 + 0.25 * sin(Tree::Z()));
+    Region<2> r({-1, -1}, {1, 1}, Region<2>::Perp(1));
+
+    SECTION("Folding")
+    {
+        auto f = XTree<2>::specialize(t, r);
+        REQUIRE(f->op == Opcode::SUB);
+        REQUIRE(f->rhs->op == Opcode::CONST);
+        REQUIRE(f->rhs->value == Approx(0.5 + 0.25 * std::sin(1.0)));
+        REQUIRE(f.ordered().size() < t.ordered().size());
+    }
+
+    SECTION("Used by build")
+    {
+        // Cells record a fingerprint of the tape that built them, so
+        // a tree built from t should match one built from the folded tree
+        std::atomic_bool cancel(false);
+        Evaluator folded(XTree<2>::specialize(t, r));
+        Evaluator plain(t);
+        auto a = XTree<2>::build(t, r, 0.1, 1e-8, false);
+        auto b = XTree<2>::build({&folded}, r, 0.1, 1e-8, cancel);
+        auto c = XTree<2>::build({&plain}, r, 0.1, 1e-8, cancel);
+        REQUIRE(a->tape == b->tape);
+        REQUIRE(a->tape != c->tape);
+    }
+}
+
 TEST_CASE("XTree<3>::vert")
 {
     auto walk = [](std::unique_ptr<const XTree<3>>& xtree,
@@ -135,9 +166,9 @@ TEST_CASE("XTree<3>::vert")
             todo.pop_front();
             if (t->isBranch())
             {
-                for (auto& c : t->children)
+                for (auto& c : *t->children)
                 {
-                    todo.push_back(c.get());
+                    todo.push_back(&c);
                 }
             }
             if (!t->isBranch() && t->type == Interval::AMBIGUOUS)
@@ -145,7 +176,7 @@ TEST_CASE("XTree<3>::vert")
                 for (unsigned i=0; i < t->vertex_count; ++i)
                 {
                     CAPTURE(t->vert(i).transpose());
-                    CAPTURE(t->rank);
+                    CAPTURE(t->leaf->rank);
                     CAPTURE(t->level);
                     CAPTURE(t->vertex_count);
                     CAPTURE(i);
@@ -190,6 +221,25 @@ TEST_CASE("XTree<3>::vert")
     }
 }
 
+TEST_CASE("XTree<3>::build (leaves)")
+{
+    // Leaves are finished under their parent's tape, which isn't pruned
+    // as far as their own; make sure that it doesn't change the results
+    auto s = min(sphere(1.2), sphere(0.3, {1.5, 1.5, 1.5}));
+    auto alone = XTree<3>::build(s, Region<3>({0, 0, 0}, {1, 1, 1}), 1);
+    auto parent = XTree<3>::build(s, Region<3>({0, 0, 0}, {2, 2, 2}), 1);
+
+    REQUIRE(!alone->isBranch());
+    REQUIRE(parent->isBranch());
+
+    auto leaf = parent->child(0);
+    REQUIRE(leaf->type == Interval::AMBIGUOUS);
+    REQUIRE(leaf->type == alone->type);
+    REQUIRE(leaf->corner_mask == alone->corner_mask);
+    REQUIRE(leaf->vertex_count == alone->vertex_count);
+    REQUIRE(leaf->vert() == alone->vert());
+}
+
 TEST_CASE("XTree<3> cancellation")
 {
     std::chrono::time_point<std::chrono::system_clock> start, end;
@@ -202,7 +252,7 @@ TEST_CASE("XTree<3> cancellation")
 
     // Start a long render operation, then cancel it immediately
     auto future = std::async(std::launch::async, [&](){
-        return XTree<3>::build(sponge, vars, r, 0.02, 8, true, cancel); });
+        return XTree<3>::build(sponge, vars, r, 0.02, 8, 8, cancel); });
 
     // Record how long it takes betwen triggering the cancel
     // and the future finishing, so we can check that the cancelling
@@ -221,3 +271,123 @@ TEST_CASE("XTree<3> cancellation")
     // (rather than a partially-constructed or invalid tree)
     REQUIRE(result.get() == nullptr);
 }
+
+/*
+ *  Checks that two trees have the same structure, states, and vertices
+ */
+static bool sameTree(const XTree<3>* a, const XTree<3>* b)
+{
+    if (a->type != b->type || a->level != b->level ||
+        a->corner_mask != b->corner_mask ||
+        a->vertex_count != b->vertex_count ||
+        a->isBranch() != b->isBranch())
+    {
+        return false;
+    }
+    for (unsigned i=0; i < a->vertex_count; ++i)
+    {
+        if (a->vert(i) != b->vert(i))
+        {
+            return false;
+        }
+    }
+    if (a->isBranch())
+    {
+        for (unsigned i=0; i < a->children->size(); ++i)
+        {
+            if (!sameTree(a->child(i), b->child(i)))
+            {
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+TEST_CASE("XTree<3>::rebuild")
+{
+    // One sphere is fixed in the lower octant, and the other (in the upper
+    // octant) has a variable radius
+    auto radius = Tree::var();
+    Tree moving = sqrt(square(Tree::X() - 0.6) + square(Tree::Y() - 0.6) +
+                       square(Tree::Z() - 0.6)) - radius;
+    Tree shape = min(sphere(0.25, {-0.5, -0.5, -0.5}), moving);
+    Region<3> r({-1, -1, -1}, {1, 1, 1});
+    std::atomic_bool cancel(false);
+
+    std::vector<Evaluator> evals;
+    evals.reserve(4);
+    evals.emplace_back(shape, std::map<Tree::Id, float>{{radius.id(), 0.25}});
+    for (unsigned i=1; i < evals.capacity(); ++i)
+    {
+        evals.emplace_back(evals.front());
+    }
+    std::vector<Evaluator*> es;
+    for (auto& e : evals)
+    {
+        es.push_back(&e);
+    }
+
+    auto prev = XTree<3>::build(es, r, 0.05, 1e-8, cancel);
+    REQUIRE(prev.get() != nullptr);
+    // Re-used cells are moved into the new tree, bringing their blocks of
+    // children with them, so we check for re-use by looking at those blocks
+    const auto fixed = prev->child(0)->children.get();
+
+    SECTION("Nothing changed")
+    {
+        const auto root = prev->children.get();
+        auto next = XTree<3>::rebuild(es, r, 0.05, 1e-8, cancel,
+                                      std::move(prev), {});
+        REQUIRE(next->children.get() == root);
+    }
+
+    SECTION("Variable changed")
+    {
+        for (auto e : es)
+        {
+            e->setVar(radius.id(), 0.3);
+        }
+        auto next = XTree<3>::rebuild(es, r, 0.05, 1e-8, cancel,
+                                      std::move(prev), {radius.id()});
+        REQUIRE(next.get() != nullptr);
+
+        // The octant that can't see the variable is re-used as-is
+        REQUIRE(next->child(0)->children.get() == fixed);
+
+        // The result matches a tree built from scratch
+        auto fresh = XTree<3>::build(es, r, 0.05, 1e-8, cancel);
+        REQUIRE(sameTree(next.get(), fresh.get()));
+    }
+}
+
+TEST_CASE("XTree<3>::refine")
+{
+    Tree s = sphere(0.5);
+    Region<3> r({-1, -1, -1}, {1, 1, 1});
+    std::atomic_bool cancel(false);
+
+    Evaluator eval(s);
+    std::vector<Evaluator*> es = {&eval};
+
+    auto coarse = XTree<3>::build(es, r, 0.2, 1e-8, cancel);
+    REQUIRE(coarse.get() != nullptr);
+
+    // This corner cell is outside of the sphere, which is proven by
+    // interval arithmetic, so it's re-used without being evaluated
+    // (which we check by tagging it with a tape fingerprint that wouldn't
+    // survive a rebuild)
+    auto corner = const_cast<XTree<3>*>(coarse->child(0)->child(0));
+    REQUIRE(corner->type == Interval::EMPTY);
+    REQUIRE(corner->exact);
+    corner->tape = 12345;
+
+    auto fine = XTree<3>::refine(es, r, 0.05, 1e-8, cancel,
+                                 std::move(coarse));
+    REQUIRE(fine.get() != nullptr);
+    REQUIRE(fine->child(0)->child(0)->tape == 12345);
+
+    // The result matches a tree built from scratch
+    auto fresh = XTree<3>::build(es, r, 0.05, 1e-8, cancel);
+    REQUIRE(sameTree(fine.get(), fresh.get()));
+}
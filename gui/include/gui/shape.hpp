@@ -107,7 +107,8 @@ protected:
     bool grabbed=false;
     bool drag_valid=true;
 
-    Kernel::Mesh* renderMesh(QPair<Settings, int> s);
+    Kernel::Mesh* renderMesh(QPair<Settings, int> s,
+                             std::set<Kernel::Tree::Id> changed);
     QFuture<Kernel::Mesh*> mesh_future;
     QFutureWatcher<Kernel::Mesh*> mesh_watcher;
     std::atomic_bool cancel;
@@ -120,6 +121,22 @@ protected:
     QScopedPointer<Kernel::Mesh> mesh;
     QPair<Settings, int> next;
 
+    /*  Octree from the most recent render after a variable change, along
+     *  with its settings and the variables that have been loaded into es
+     *  since it was built.  These are only used in renderMesh.  */
+    std::unique_ptr<const Kernel::XTree<3>> xtree;
+    QPair<Settings, int> xtree_settings;
+    std::set<Kernel::Tree::Id> xtree_changed;
+
+    /*  Octree from the most recent progressive pass (and its settings),
+     *  which the next, finer pass refines instead of building a new one.
+     *  This is only used in renderMesh.  */
+    std::unique_ptr<const Kernel::XTree<3>> preview;
+    QPair<Settings, int> preview_settings;
+
+    /*  Variables that have changed since values were loaded into es  */
+    std::set<Kernel::Tree::Id> changed_vars;
+
     /*  running marks not just whether the future has finished, but whether
      *  the main thread has handled it.  This prevents situations where the
      *  mesh_future.isRunning() == false but onFutureFinished hasn't yet
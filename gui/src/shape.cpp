@@ -11,11 +11,13 @@ Shape::Shape(Kernel::Tree t, std::shared_ptr<std::map<Kernel::Tree::Id,
     : tree(t), vars(vars), vert_vbo(QOpenGLBuffer::VertexBuffer),
       tri_vbo(QOpenGLBuffer::IndexBuffer)
 {
-    // Construct evaluators to run meshing (in parallel)
-    es.reserve(8);
-    for (unsigned i=0; i < es.capacity(); ++i)
+    // Construct evaluators to run meshing (in parallel, one per core)
+    // (the first is built from the tree, and the rest are cheap clones)
+    es.reserve(std::max(QThread::idealThreadCount(), 1));
+    es.emplace_back(t, *vars);
+    for (unsigned i=1; i < es.capacity(); ++i)
     {
-        es.emplace_back(Kernel::Evaluator(t, *vars));
+        es.emplace_back(es.front());
     }
 
     connect(this, &Shape::gotMesh, this, &Shape::redraw);
@@ -51,6 +53,7 @@ bool Shape::updateVars(const std::map<Kernel::Tree::Id, float>& vs)
             }
             changed = true;
             va->second = v.second;
+            changed_vars.insert(v.first);
         }
     }
 
@@ -177,6 +180,9 @@ void Shape::startRender(QPair<Settings, int> s)
     }
     else
     {
+        // Variables that are loaded into the evaluators here are passed
+        // to the render, so that it only rebuilds cells that use them
+        std::set<Kernel::Tree::Id> changed;
         if (s.second == MESH_DIV_NEW_VARS ||
             s.second == MESH_DIV_NEW_VARS_SMALL)
         {
@@ -184,6 +190,7 @@ void Shape::startRender(QPair<Settings, int> s)
             {
                 e.updateVars(*vars);
             }
+            std::swap(changed, changed_vars);
             s.second = (s.second == MESH_DIV_NEW_VARS) ? default_div : 0;
         }
 
@@ -191,7 +198,7 @@ void Shape::startRender(QPair<Settings, int> s)
 
         timer.start();
         running = true;
-        mesh_future = QtConcurrent::run(this, &Shape::renderMesh, s);
+        mesh_future = QtConcurrent::run(this, &Shape::renderMesh, s, changed);
         mesh_watcher.setFuture(mesh_future);
 
         next = {s.first, s.second - 1};
@@ -286,13 +293,59 @@ void Shape::onFutureFinished()
 
 ////////////////////////////////////////////////////////////////////////////////
 // This function is called in a separate thread:
-Kernel::Mesh* Shape::renderMesh(QPair<Settings, int> s)
+Kernel::Mesh* Shape::renderMesh(QPair<Settings, int> s,
+                                std::set<Kernel::Tree::Id> changed)
 {
     cancel.store(false);
     Kernel::Region<3> r({s.first.min.x(), s.first.min.y(), s.first.min.z()},
                         {s.first.max.x(), s.first.max.y(), s.first.max.z()});
-    auto m = Kernel::Mesh::render(es.data(), r,
-            1 / (s.first.res / (1 << s.second)),
-            pow(10, -s.first.quality), cancel);
+    std::vector<Kernel::Evaluator*> workers;
+    for (auto& e : es)
+    {
+        workers.push_back(&e);
+    }
+    const double min_feature = 1 / (s.first.res / (1 << s.second));
+    const double max_err = pow(10, -s.first.quality);
+
+    // Renders after variable changes re-use the octree from the previous
+    // such render (if it had the same settings), only rebuilding cells that
+    // read a variable that has changed since then.  Other renders (e.g.
+    // refinements) leave the stored octree alone.
+    xtree_changed.insert(changed.begin(), changed.end());
+    std::unique_ptr<Kernel::Mesh> m;
+    if (changed.size())
+    {
+        // The progressive preview was built with the old variable values,
+        // and refine would re-use its settled cells without evaluating them
+        preview.reset();
+
+        if (xtree_settings != s)
+        {
+            xtree.reset();
+        }
+        m = Kernel::Mesh::render(workers, r, min_feature, max_err, cancel,
+                                 xtree, xtree_changed);
+        xtree_settings = s;
+        xtree_changed.clear();
+    }
+    else
+    {
+        // Progressive passes refine the previous pass's octree, if it was
+        // built with the same settings at a coarser resolution
+        if (preview_settings.first != s.first ||
+            preview_settings.second <= s.second)
+        {
+            preview.reset();
+        }
+        m = Kernel::Mesh::refine(workers, r, min_feature, max_err, cancel,
+                                 preview);
+        preview_settings = s;
+
+        // The final pass has nothing left to refine
+        if (s.second == 0)
+        {
+            preview.reset();
+        }
+    }
     return m.release();
 }